@@ -276,7 +276,7 @@ static void attr_write_handler(
 
 	lbm_flat_value_t flat;
 	// The length should be 31 + len. 40 + len is used to be on the safe side.
-	if (!lbm_start_flatten(&flat, 40 + len)) {
+	if (!lbm_start_flatten_pooled(&flat, 40 + len)) {
 		return;
 	}
 
@@ -294,7 +294,7 @@ static void attr_write_handler(
 	lbm_finish_flatten(&flat);
 
 	if (!lbm_event(&flat)) {
-		lbm_free(flat.buf);
+		lbm_flat_value_free_buf(flat.buf);
 	}
 }
 
@@ -320,9 +320,7 @@ static void char1_write_handler(
 	write_attr(ble_chars[0].char_val, param);
 
 	if (ble_chars[0].char_val != NULL) {
-		for (int i = 0; i < param->write.len; ++i) {
-			packet_process_byte(param->write.value[i], packet_state);
-		}
+		packet_process_buffer(param->write.value, param->write.len, packet_state);
 	}
 
 	notify_gatts_if = gatts_if;
@@ -619,33 +617,64 @@ static void process_packet(unsigned char *data, unsigned int len) {
 	commands_process_packet(data, len, comm_ble_send_packet);
 }
 
-static void send_packet_raw(unsigned char *buffer, unsigned int len) {
+static void send_packet_vec(PACKET_SEG_t *segs, int seg_num) {
 	if (!is_connected) {
 		return;
 	}
 
-	uint16_t bytes_sent = 0;
+	// Only used for notifications that span more than one segment
+	static uint8_t chunk[GATTS_CHAR_VAL_LEN_MAX];
+	unsigned int chunk_len = 0;
+	unsigned int mtu = ble_current_mtu;
+
+	for (int i = 0;i < seg_num;i++) {
+		unsigned char *data = segs[i].data;
+		unsigned int len = segs[i].len;
+
+		while (len > 0) {
+			if (chunk_len == 0 && len >= mtu) {
+				// Full notification from this segment, send it without copying
+				esp_ble_gatts_send_indicate(
+					notify_gatts_if, notify_conn_id, ble_chars[1].char_handle, mtu,
+					data, false
+				);
 
-	while (bytes_sent < len) {
-		uint8_t length = 0;
-		if (len - bytes_sent > ble_current_mtu) {
-			length = ble_current_mtu;
-		} else {
-			length = len - bytes_sent;
+				data += mtu;
+				len -= mtu;
+				continue;
+			}
+
+			unsigned int to_copy = mtu - chunk_len;
+			if (to_copy > len) {
+				to_copy = len;
+			}
+
+			memcpy(chunk + chunk_len, data, to_copy);
+			chunk_len += to_copy;
+			data += to_copy;
+			len -= to_copy;
+
+			if (chunk_len == mtu) {
+				esp_ble_gatts_send_indicate(
+					notify_gatts_if, notify_conn_id, ble_chars[1].char_handle,
+					chunk_len, chunk, false
+				);
+				chunk_len = 0;
+			}
 		}
+	}
 
+	if (chunk_len > 0) {
 		esp_ble_gatts_send_indicate(
-			notify_gatts_if, notify_conn_id, ble_chars[1].char_handle, length,
-			buffer + bytes_sent, false
+			notify_gatts_if, notify_conn_id, ble_chars[1].char_handle, chunk_len,
+			chunk, false
 		);
-
-		bytes_sent += length;
 	}
 }
 
 void comm_ble_init(void) {
 	packet_state = calloc(1, sizeof(PACKET_STATE_t));
-	packet_init(send_packet_raw, process_packet, packet_state);
+	packet_init_vec(send_packet_vec, process_packet, packet_state);
 
 	if (backup.config.ble_mode == BLE_MODE_ENCRYPTED) {
 		ble_chars[0].char_perm =
@@ -20,6 +20,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "freertos/queue.h"
 #include "datatypes.h"
 #include "buffer.h"
 #include "driver/twai.h"
@@ -38,23 +39,52 @@
 #include "soc/gpio_sig_map.h"
 
 #include <string.h>
-
-// Status messages
-static can_status_msg stat_msgs[CAN_STATUS_MSGS_TO_STORE];
-static can_status_msg_2 stat_msgs_2[CAN_STATUS_MSGS_TO_STORE];
-static can_status_msg_3 stat_msgs_3[CAN_STATUS_MSGS_TO_STORE];
-static can_status_msg_4 stat_msgs_4[CAN_STATUS_MSGS_TO_STORE];
-static can_status_msg_5 stat_msgs_5[CAN_STATUS_MSGS_TO_STORE];
-static can_status_msg_6 stat_msgs_6[CAN_STATUS_MSGS_TO_STORE];
-static io_board_adc_values io_board_adc_1_4[CAN_STATUS_MSGS_TO_STORE];
-static io_board_adc_values io_board_adc_5_8[CAN_STATUS_MSGS_TO_STORE];
-static io_board_digial_inputs io_board_digital_in[CAN_STATUS_MSGS_TO_STORE];
-static psw_status psw_stat[CAN_STATUS_MSGS_TO_STORE];
-
+#include <stdatomic.h>
+
+// Status messages. All messages from one controller are stored in the same
+// slot, and node_slot maps the controller id to that slot directly.
+typedef struct {
+	can_status_msg stat_msg;
+	can_status_msg_2 stat_msg_2;
+	can_status_msg_3 stat_msg_3;
+	can_status_msg_4 stat_msg_4;
+	can_status_msg_5 stat_msg_5;
+	can_status_msg_6 stat_msg_6;
+	io_board_adc_values io_board_adc_1_4;
+	io_board_adc_values io_board_adc_5_8;
+	io_board_digial_inputs io_board_digital_in;
+	psw_status psw_stat;
+} can_node_status;
+
+static can_node_status node_status[CAN_STATUS_MSGS_TO_STORE];
+static volatile uint8_t node_slot[256]; // Slot index + 1, 0 means no slot
+static volatile int node_num = 0;
+
+#ifndef RX_BUFFER_NUM
 #define RX_BUFFER_NUM				3
+#endif
 #define RX_BUFFER_SIZE				PACKET_MAX_PL_LEN
+#define RX_BUFFER_TIMEOUT_MS		500
 #define RXBUF_LEN					50
 
+// Buffers sent with comm_can_send_buffer are copied to a job and sent from
+// tx_task. Larger buffers are sent directly by the caller.
+#define TX_JOB_NUM					4
+#define TX_JOB_SIZE					PACKET_MAX_PL_LEN
+
+// Max number of buffer frames in the driver queue. Frames sent with
+// comm_can_transmit_eid/sid only have to wait for these, not for the
+// rest of the buffer.
+#define TX_BULK_MAX_PENDING			8
+
+// If the driver queue does not drain within this many ticks, e.g. when
+// nothing on the bus acknowledges the frames, the rest of the buffer is
+// dropped. Same as the timeout used for single frames.
+#define TX_THROTTLE_TIMEOUT			5
+
+// Max time to wait for a free buffer job before giving up
+#define TX_JOB_WAIT_MS				100
+
 static twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
 static const twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
 static twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(0, 0, TWAI_MODE_NORMAL);
@@ -71,25 +101,236 @@ static SemaphoreHandle_t proc_sem;
 static SemaphoreHandle_t status_sem;
 static SemaphoreHandle_t send_mutex;
 static volatile HW_TYPE ping_hw_last = HW_TYPE_VESC;
-static uint8_t rx_buffer[RX_BUFFER_NUM][RX_BUFFER_SIZE];
-static int rx_buffer_offset[RX_BUFFER_NUM];
+// Buffers for reassembling multi-frame transfers. The fill frames do not
+// contain the sender, so a transfer is identified by the offset it expects
+// next and is only tied to the sender when it is processed.
+typedef struct {
+	uint8_t data[RX_BUFFER_SIZE];
+	int offset; // Next expected offset, 0 when unused
+	TickType_t update_time;
+} can_rx_buffer;
+
+static can_rx_buffer rx_buffer[RX_BUFFER_NUM];
+static volatile uint32_t rx_buffer_completed_cnt = 0;
+static volatile uint32_t rx_buffer_crc_error_cnt = 0;
+static volatile uint32_t rx_buffer_aborted_cnt = 0;
+static volatile uint32_t rx_buffer_dropped_cnt = 0;
 static volatile unsigned int rx_buffer_last_id;
 static volatile unsigned int rx_buffer_response_type = 1;
 
+// Single producer (rx_task), single consumer (process_task). Only rx_task
+// writes rx_write and only process_task writes rx_read, so no lock is needed.
 static twai_message_t rx_buf[RXBUF_LEN];
 static volatile int rx_write = 0;
 static volatile int rx_read = 0;
 static volatile bool use_vesc_decoder = true;
 
+static volatile uint32_t rx_frame_cnt = 0;
+static volatile uint32_t rx_overflow_cnt = 0;
+static volatile uint32_t rx_wakeup_cnt = 0;
+static volatile int rx_high_water = 0;
+
 static volatile int rx_recovery_cnt = 0;
 
+typedef struct {
+	uint8_t controller_id;
+	uint8_t send;
+	unsigned int len;
+	void(*done_cb)(void *arg);
+	void *done_arg;
+	uint8_t data[TX_JOB_SIZE];
+} can_tx_job;
+
+static can_tx_job tx_jobs[TX_JOB_NUM];
+static QueueHandle_t tx_job_free;
+static QueueHandle_t tx_job_queue;
+
+static volatile uint32_t tx_frame_cnt = 0;
+static volatile uint32_t tx_buffer_cnt = 0;
+static volatile uint32_t tx_buffer_bytes = 0;
+static volatile uint32_t tx_buffer_stall_cnt = 0;
+static volatile uint32_t tx_buffer_drop_cnt = 0;
+
 // Private functions
 static void update_baud(CAN_BAUD baudrate);
+static void tx_task(void *arg);
 
 static void send_packet_wrapper(unsigned char *data, unsigned int len) {
 	comm_can_send_buffer(rx_buffer_last_id, data, len, rx_buffer_response_type);
 }
 
+static void node_status_reset(void) {
+	node_num = 0;
+	memset((void*)node_slot, 0, sizeof(node_slot));
+
+	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
+		can_node_status *node = &node_status[i];
+		node->stat_msg.id = -1;
+		node->stat_msg_2.id = -1;
+		node->stat_msg_3.id = -1;
+		node->stat_msg_4.id = -1;
+		node->stat_msg_5.id = -1;
+		node->stat_msg_6.id = -1;
+
+		node->io_board_adc_1_4.id = -1;
+		node->io_board_adc_5_8.id = -1;
+		node->io_board_digital_in.id = -1;
+
+		node->psw_stat.id = -1;
+	}
+}
+
+static can_node_status *node_get(int id) {
+	if (id < 0 || id > 255) {
+		return 0;
+	}
+
+	int slot = node_slot[id];
+	if (slot == 0) {
+		return 0;
+	}
+
+	return &node_status[slot - 1];
+}
+
+/**
+ * Get the status slot for a controller id, and assign a free slot to it if
+ * it does not have one yet. Only called from process_task.
+ *
+ * @return
+ * The slot, or null if all slots are used by other controllers.
+ */
+static can_node_status *node_get_or_add(uint8_t id) {
+	can_node_status *node = node_get(id);
+
+	if (!node && node_num < CAN_STATUS_MSGS_TO_STORE) {
+		node = &node_status[node_num];
+		node_num++;
+		node_slot[id] = node_num;
+	}
+
+	return node;
+}
+
+/**
+ * Release buffers whose transfer has not made progress for RX_BUFFER_TIMEOUT_MS.
+ */
+static void rx_buffer_expire(void) {
+	TickType_t now = xTaskGetTickCount();
+
+	for (int i = 0;i < RX_BUFFER_NUM;i++) {
+		if (rx_buffer[i].offset > 0 &&
+				(now - rx_buffer[i].update_time) > pdMS_TO_TICKS(RX_BUFFER_TIMEOUT_MS)) {
+			rx_buffer[i].offset = 0;
+			rx_buffer_aborted_cnt++;
+		}
+	}
+}
+
+/**
+ * Find the buffer that a fill frame belongs to.
+ *
+ * Fill frames do not carry the id of the sender, so a transfer can only be
+ * recognized by the offset it expects next. If two senders are interleaved
+ * and reach the same offset, their frames can end up in each other's
+ * buffer. The CRC check in rx_buffer_take rejects such a transfer.
+ *
+ * @param offset
+ * The offset of the fill frame.
+ *
+ * @return
+ * The buffer, or null if no transfer expects this offset.
+ */
+static can_rx_buffer *rx_buffer_for_fill(int offset) {
+	rx_buffer_expire();
+
+	if (offset > 0) {
+		for (int i = 0;i < RX_BUFFER_NUM;i++) {
+			if (rx_buffer[i].offset == offset) {
+				return &rx_buffer[i];
+			}
+		}
+
+		rx_buffer_dropped_cnt++;
+		return 0;
+	}
+
+	// A new transfer. Use a free buffer, or take over the one that has been
+	// idle for the longest time.
+	can_rx_buffer *oldest = &rx_buffer[0];
+	for (int i = 0;i < RX_BUFFER_NUM;i++) {
+		if (rx_buffer[i].offset == 0) {
+			return &rx_buffer[i];
+		}
+
+		if ((int32_t)(rx_buffer[i].update_time - oldest->update_time) < 0) {
+			oldest = &rx_buffer[i];
+		}
+	}
+
+	oldest->offset = 0;
+	rx_buffer_aborted_cnt++;
+	return oldest;
+}
+
+static void rx_buffer_fill(int offset, const uint8_t *data, int len) {
+	if (len < 0 || (offset + len) > RX_BUFFER_SIZE) {
+		rx_buffer_dropped_cnt++;
+		return;
+	}
+
+	can_rx_buffer *buf = rx_buffer_for_fill(offset);
+	if (!buf) {
+		return;
+	}
+
+	memcpy(buf->data + offset, data, len);
+	buf->offset = offset + len;
+	buf->update_time = xTaskGetTickCount();
+}
+
+/**
+ * Take the completed buffer for a process frame. As transfers from different
+ * senders can have the same length, the CRC decides which buffer it is.
+ *
+ * @return
+ * The buffer, or null if there is no complete buffer with a matching CRC. The
+ * buffer is released, but its data stays valid until the next fill frame.
+ */
+static can_rx_buffer *rx_buffer_take(int len, unsigned short crc) {
+	can_rx_buffer *latest = 0;
+
+	for (int i = 0;i < RX_BUFFER_NUM;i++) {
+		can_rx_buffer *buf = &rx_buffer[i];
+
+		if (buf->offset != len) {
+			continue;
+		}
+
+		if (crc16(buf->data, len) == crc) {
+			buf->offset = 0;
+			rx_buffer_completed_cnt++;
+			return buf;
+		}
+
+		if (!latest || (int32_t)(buf->update_time - latest->update_time) > 0) {
+			latest = buf;
+		}
+	}
+
+	if (latest) {
+		// The process frame follows the last fill frame of its transfer, so
+		// the most recently filled buffer is the corrupted one. Others with
+		// the same offset can be transfers that are still in progress.
+		latest->offset = 0;
+		rx_buffer_crc_error_cnt++;
+	} else {
+		rx_buffer_dropped_cnt++;
+	}
+
+	return 0;
+}
+
 static void decode_msg(uint32_t eid, uint8_t *data8, int len, bool is_replaced) {
 	int32_t ind = 0;
 	uint8_t crc_low;
@@ -102,56 +343,20 @@ static void decode_msg(uint32_t eid, uint8_t *data8, int len, bool is_replaced)
 	if (id == 255 || id == backup.config.controller_id) {
 		switch (cmd) {
 		case CAN_PACKET_FILL_RX_BUFFER: {
-			int buf_ind = -1;
 			int offset = data8[0];
 			data8++;
 			len--;
 
-			for (int i = 0; i < RX_BUFFER_NUM;i++) {
-				if ((rx_buffer_offset[i]) == offset ) {
-					buf_ind = i;
-					break;
-				}
-			}
-
-			if (buf_ind < 0) {
-				if (offset == 0) {
-					buf_ind = 0;
-				} else {
-					break;
-				}
-			}
-
-			memcpy(rx_buffer[buf_ind] + offset, data8, len);
-			rx_buffer_offset[buf_ind] = offset + len;
+			rx_buffer_fill(offset, data8, len);
 		} break;
 
 		case CAN_PACKET_FILL_RX_BUFFER_LONG: {
-			int buf_ind = -1;
 			int offset = (int)data8[0] << 8;
 			offset |= data8[1];
 			data8 += 2;
 			len -= 2;
 
-			for (int i = 0; i < RX_BUFFER_NUM;i++) {
-				if ((rx_buffer_offset[i]) == offset ) {
-					buf_ind = i;
-					break;
-				}
-			}
-
-			if (buf_ind < 0) {
-				if (offset == 0) {
-					buf_ind = 0;
-				} else {
-					break;
-				}
-			}
-
-			if ((offset + len) <= RX_BUFFER_SIZE) {
-				memcpy(rx_buffer[buf_ind] + offset, data8, len);
-				rx_buffer_offset[buf_ind] = offset + len;
-			}
+			rx_buffer_fill(offset, data8, len);
 		} break;
 
 		case CAN_PACKET_PROCESS_RX_BUFFER: {
@@ -176,37 +381,19 @@ static void decode_msg(uint32_t eid, uint8_t *data8, int len, bool is_replaced)
 				break;
 			}
 
-			int buf_ind = -1;
-			for (int i = 0; i < RX_BUFFER_NUM;i++) {
-				if ((rx_buffer_offset[i]) == rxbuf_len ) {
-					buf_ind = i;
-					break;
-				}
-			}
-
-			// Something is wrong, reset all buffers
-			if (buf_ind < 0) {
-				for (int i = 0; i < RX_BUFFER_NUM;i++) {
-					rx_buffer_offset[i] = 0;
-				}
-				break;
-			}
-
-			rx_buffer_offset[buf_ind] = 0;
-
 			crc_high = data8[ind++];
 			crc_low = data8[ind++];
 
-			if (crc16(rx_buffer[buf_ind], rxbuf_len)
-					== ((unsigned short) crc_high << 8
-							| (unsigned short) crc_low)) {
+			can_rx_buffer *buf = rx_buffer_take(rxbuf_len,
+					(unsigned short) crc_high << 8 | (unsigned short) crc_low);
 
+			if (buf) {
 				if (is_replaced) {
-					if (rx_buffer[buf_ind][0] == COMM_JUMP_TO_BOOTLOADER ||
-							rx_buffer[buf_ind][0] == COMM_ERASE_NEW_APP ||
-							rx_buffer[buf_ind][0] == COMM_WRITE_NEW_APP_DATA ||
-							rx_buffer[buf_ind][0] == COMM_WRITE_NEW_APP_DATA_LZO ||
-							rx_buffer[buf_ind][0] == COMM_ERASE_BOOTLOADER) {
+					if (buf->data[0] == COMM_JUMP_TO_BOOTLOADER ||
+							buf->data[0] == COMM_ERASE_NEW_APP ||
+							buf->data[0] == COMM_WRITE_NEW_APP_DATA ||
+							buf->data[0] == COMM_WRITE_NEW_APP_DATA_LZO ||
+							buf->data[0] == COMM_ERASE_BOOTLOADER) {
 						break;
 					}
 				}
@@ -214,13 +401,13 @@ static void decode_msg(uint32_t eid, uint8_t *data8, int len, bool is_replaced)
 				switch (commands_send) {
 				case 0:
 				case 3:
-					commands_process_packet(rx_buffer[buf_ind], rxbuf_len, send_packet_wrapper);
+					commands_process_packet(buf->data, rxbuf_len, send_packet_wrapper);
 					break;
 				case 1:
-					commands_send_packet_can_last(rx_buffer[buf_ind], rxbuf_len);
+					commands_send_packet_can_last(buf->data, rxbuf_len);
 					break;
 				case 2:
-					commands_process_packet(rx_buffer[buf_ind], rxbuf_len, 0);
+					commands_process_packet(buf->data, rxbuf_len, 0);
 					break;
 				default:
 					break;
@@ -293,165 +480,154 @@ static void decode_msg(uint32_t eid, uint8_t *data8, int len, bool is_replaced)
 
 	// The packets below are addressed to all devices, mainly containing status information.
 
+	can_node_status *node = 0;
 	switch (cmd) {
 	case CAN_PACKET_STATUS:
-		for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-			can_status_msg *stat_tmp = &stat_msgs[i];
-			if (stat_tmp->id == id || stat_tmp->id == -1) {
-				ind = 0;
-				stat_tmp->id = id;
-				stat_tmp->rx_time = xTaskGetTickCount();
-				stat_tmp->rpm = (float)buffer_get_int32(data8, &ind);
-				stat_tmp->current = (float)buffer_get_int16(data8, &ind) / 10.0;
-				stat_tmp->duty = (float)buffer_get_int16(data8, &ind) / 1000.0;
-				break;
-			}
+	case CAN_PACKET_STATUS_2:
+	case CAN_PACKET_STATUS_3:
+	case CAN_PACKET_STATUS_4:
+	case CAN_PACKET_STATUS_5:
+	case CAN_PACKET_STATUS_6:
+	case CAN_PACKET_IO_BOARD_ADC_1_TO_4:
+	case CAN_PACKET_IO_BOARD_ADC_5_TO_8:
+	case CAN_PACKET_IO_BOARD_DIGITAL_IN:
+	case CAN_PACKET_PSW_STAT:
+		node = node_get_or_add(id);
+		break;
+
+	default:
+		break;
+	}
+
+	switch (cmd) {
+	case CAN_PACKET_STATUS:
+		if (node) {
+			can_status_msg *stat_tmp = &node->stat_msg;
+			ind = 0;
+			stat_tmp->id = id;
+			stat_tmp->rx_time = xTaskGetTickCount();
+			stat_tmp->rpm = (float)buffer_get_int32(data8, &ind);
+			stat_tmp->current = (float)buffer_get_int16(data8, &ind) / 10.0;
+			stat_tmp->duty = (float)buffer_get_int16(data8, &ind) / 1000.0;
 		}
 		break;
 
 	case CAN_PACKET_STATUS_2:
-		for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-			can_status_msg_2 *stat_tmp_2 = &stat_msgs_2[i];
-			if (stat_tmp_2->id == id || stat_tmp_2->id == -1) {
-				ind = 0;
-				stat_tmp_2->id = id;
-				stat_tmp_2->rx_time = xTaskGetTickCount();
-				stat_tmp_2->amp_hours = (float)buffer_get_int32(data8, &ind) / 1e4;
-				stat_tmp_2->amp_hours_charged = (float)buffer_get_int32(data8, &ind) / 1e4;
-				break;
-			}
+		if (node) {
+			can_status_msg_2 *stat_tmp_2 = &node->stat_msg_2;
+			ind = 0;
+			stat_tmp_2->id = id;
+			stat_tmp_2->rx_time = xTaskGetTickCount();
+			stat_tmp_2->amp_hours = (float)buffer_get_int32(data8, &ind) / 1e4;
+			stat_tmp_2->amp_hours_charged = (float)buffer_get_int32(data8, &ind) / 1e4;
 		}
 		break;
 
 	case CAN_PACKET_STATUS_3:
-		for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-			can_status_msg_3 *stat_tmp_3 = &stat_msgs_3[i];
-			if (stat_tmp_3->id == id || stat_tmp_3->id == -1) {
-				ind = 0;
-				stat_tmp_3->id = id;
-				stat_tmp_3->rx_time = xTaskGetTickCount();
-				stat_tmp_3->watt_hours = (float)buffer_get_int32(data8, &ind) / 1e4;
-				stat_tmp_3->watt_hours_charged = (float)buffer_get_int32(data8, &ind) / 1e4;
-				break;
-			}
+		if (node) {
+			can_status_msg_3 *stat_tmp_3 = &node->stat_msg_3;
+			ind = 0;
+			stat_tmp_3->id = id;
+			stat_tmp_3->rx_time = xTaskGetTickCount();
+			stat_tmp_3->watt_hours = (float)buffer_get_int32(data8, &ind) / 1e4;
+			stat_tmp_3->watt_hours_charged = (float)buffer_get_int32(data8, &ind) / 1e4;
 		}
 		break;
 
 	case CAN_PACKET_STATUS_4:
-		for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-			can_status_msg_4 *stat_tmp_4 = &stat_msgs_4[i];
-			if (stat_tmp_4->id == id || stat_tmp_4->id == -1) {
-				ind = 0;
-				stat_tmp_4->id = id;
-				stat_tmp_4->rx_time = xTaskGetTickCount();
-				stat_tmp_4->temp_fet = (float)buffer_get_int16(data8, &ind) / 10.0;
-				stat_tmp_4->temp_motor = (float)buffer_get_int16(data8, &ind) / 10.0;
-				stat_tmp_4->current_in = (float)buffer_get_int16(data8, &ind) / 10.0;
-				stat_tmp_4->pid_pos_now = (float)buffer_get_int16(data8, &ind) / 50.0;
-				break;
-			}
+		if (node) {
+			can_status_msg_4 *stat_tmp_4 = &node->stat_msg_4;
+			ind = 0;
+			stat_tmp_4->id = id;
+			stat_tmp_4->rx_time = xTaskGetTickCount();
+			stat_tmp_4->temp_fet = (float)buffer_get_int16(data8, &ind) / 10.0;
+			stat_tmp_4->temp_motor = (float)buffer_get_int16(data8, &ind) / 10.0;
+			stat_tmp_4->current_in = (float)buffer_get_int16(data8, &ind) / 10.0;
+			stat_tmp_4->pid_pos_now = (float)buffer_get_int16(data8, &ind) / 50.0;
 		}
 		break;
 
 	case CAN_PACKET_STATUS_5:
-		for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-			can_status_msg_5 *stat_tmp_5 = &stat_msgs_5[i];
-			if (stat_tmp_5->id == id || stat_tmp_5->id == -1) {
-				ind = 0;
-				stat_tmp_5->id = id;
-				stat_tmp_5->rx_time = xTaskGetTickCount();
-				stat_tmp_5->tacho_value = buffer_get_int32(data8, &ind);
-				stat_tmp_5->v_in = (float)buffer_get_int16(data8, &ind) / 1e1;
-				break;
-			}
+		if (node) {
+			can_status_msg_5 *stat_tmp_5 = &node->stat_msg_5;
+			ind = 0;
+			stat_tmp_5->id = id;
+			stat_tmp_5->rx_time = xTaskGetTickCount();
+			stat_tmp_5->tacho_value = buffer_get_int32(data8, &ind);
+			stat_tmp_5->v_in = (float)buffer_get_int16(data8, &ind) / 1e1;
 		}
 		break;
 
 	case CAN_PACKET_STATUS_6:
-		for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-			can_status_msg_6 *stat_tmp_6 = &stat_msgs_6[i];
-			if (stat_tmp_6->id == id || stat_tmp_6->id == -1) {
-				ind = 0;
-				stat_tmp_6->id = id;
-				stat_tmp_6->rx_time = xTaskGetTickCount();
-				stat_tmp_6->adc_1 = buffer_get_float16(data8, 1e3, &ind);
-				stat_tmp_6->adc_2 = buffer_get_float16(data8, 1e3, &ind);
-				stat_tmp_6->adc_3 = buffer_get_float16(data8, 1e3, &ind);
-				stat_tmp_6->ppm = buffer_get_float16(data8, 1e3, &ind);
-				break;
-			}
+		if (node) {
+			can_status_msg_6 *stat_tmp_6 = &node->stat_msg_6;
+			ind = 0;
+			stat_tmp_6->id = id;
+			stat_tmp_6->rx_time = xTaskGetTickCount();
+			stat_tmp_6->adc_1 = buffer_get_float16(data8, 1e3, &ind);
+			stat_tmp_6->adc_2 = buffer_get_float16(data8, 1e3, &ind);
+			stat_tmp_6->adc_3 = buffer_get_float16(data8, 1e3, &ind);
+			stat_tmp_6->ppm = buffer_get_float16(data8, 1e3, &ind);
 		}
 		break;
 
 	case CAN_PACKET_IO_BOARD_ADC_1_TO_4:
-		for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-			io_board_adc_values *msg = &io_board_adc_1_4[i];
-			if (msg->id == id || msg->id == -1) {
-				ind = 0;
-				msg->id = id;
-				msg->rx_time = xTaskGetTickCount();
-				ind = 0;
-				int j = 0;
-				while (ind < len) {
-					msg->adc_voltages[j++] = buffer_get_float16(data8, 1e2, &ind);
-				}
-				break;
+		if (node) {
+			io_board_adc_values *msg = &node->io_board_adc_1_4;
+			ind = 0;
+			msg->id = id;
+			msg->rx_time = xTaskGetTickCount();
+			ind = 0;
+			int j = 0;
+			while (ind < len) {
+				msg->adc_voltages[j++] = buffer_get_float16(data8, 1e2, &ind);
 			}
 		}
 		break;
 
 	case CAN_PACKET_IO_BOARD_ADC_5_TO_8:
-		for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-			io_board_adc_values *msg = &io_board_adc_5_8[i];
-			if (msg->id == id || msg->id == -1) {
-				ind = 0;
-				msg->id = id;
-				msg->rx_time = xTaskGetTickCount();
-				ind = 0;
-				int j = 0;
-				while (ind < len) {
-					msg->adc_voltages[j++] = buffer_get_float16(data8, 1e2, &ind);
-				}
-				break;
+		if (node) {
+			io_board_adc_values *msg = &node->io_board_adc_5_8;
+			ind = 0;
+			msg->id = id;
+			msg->rx_time = xTaskGetTickCount();
+			ind = 0;
+			int j = 0;
+			while (ind < len) {
+				msg->adc_voltages[j++] = buffer_get_float16(data8, 1e2, &ind);
 			}
 		}
 		break;
 
 	case CAN_PACKET_IO_BOARD_DIGITAL_IN:
-		for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-			io_board_digial_inputs *msg = &io_board_digital_in[i];
-			if (msg->id == id || msg->id == -1) {
-				ind = 0;
-				msg->id = id;
-				msg->rx_time = xTaskGetTickCount();
-				msg->inputs = 0;
-				ind = 0;
-				while (ind < len) {
-					msg->inputs |= (uint64_t)data8[ind] << (ind * 8);
-					ind++;
-				}
-				break;
+		if (node) {
+			io_board_digial_inputs *msg = &node->io_board_digital_in;
+			ind = 0;
+			msg->id = id;
+			msg->rx_time = xTaskGetTickCount();
+			msg->inputs = 0;
+			ind = 0;
+			while (ind < len) {
+				msg->inputs |= (uint64_t)data8[ind] << (ind * 8);
+				ind++;
 			}
 		}
 		break;
 
 	case CAN_PACKET_PSW_STAT: {
-		for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-			psw_status *msg = &psw_stat[i];
-			if (msg->id == id || msg->id == -1) {
-				ind = 0;
-				msg->id = id;
-				msg->rx_time = xTaskGetTickCount();
-
-				msg->v_in = buffer_get_float16(data8, 10.0, &ind);
-				msg->v_out = buffer_get_float16(data8, 10.0, &ind);
-				msg->temp = buffer_get_float16(data8, 10.0, &ind);
-				msg->is_out_on = (data8[ind] >> 0) & 1;
-				msg->is_pch_on = (data8[ind] >> 1) & 1;
-				msg->is_dsc_on = (data8[ind] >> 2) & 1;
-				ind++;
-				break;
-			}
+		if (node) {
+			psw_status *msg = &node->psw_stat;
+			ind = 0;
+			msg->id = id;
+			msg->rx_time = xTaskGetTickCount();
+
+			msg->v_in = buffer_get_float16(data8, 10.0, &ind);
+			msg->v_out = buffer_get_float16(data8, 10.0, &ind);
+			msg->temp = buffer_get_float16(data8, 10.0, &ind);
+			msg->is_out_on = (data8[ind] >> 0) & 1;
+			msg->is_pch_on = (data8[ind] >> 1) & 1;
+			msg->is_dsc_on = (data8[ind] >> 2) & 1;
+			ind++;
 		}
 	} break;
 
@@ -539,6 +715,48 @@ static void decode_msg(uint32_t eid, uint8_t *data8, int len, bool is_replaced)
 	}
 }
 
+/**
+ * Put a frame in the receive ring. Only called from rx_task.
+ *
+ * @return
+ * false if the ring is full and the frame was dropped.
+ */
+static bool rx_push(const twai_message_t *msg) {
+	int write = rx_write;
+	int next = write + 1;
+	if (next >= RXBUF_LEN) {
+		next = 0;
+	}
+
+	int read = rx_read;
+	atomic_thread_fence(memory_order_acquire);
+
+	// Drop the new frame rather than overwriting the one process_task might be reading
+	if (next == read) {
+		rx_overflow_cnt++;
+		return false;
+	}
+
+	rx_buf[write] = *msg;
+
+	// The frame must be in the buffer before process_task can see the new index
+	atomic_thread_fence(memory_order_release);
+	rx_write = next;
+
+	rx_frame_cnt++;
+
+	int fill = next - read;
+	if (fill < 0) {
+		fill += RXBUF_LEN;
+	}
+
+	if (fill > rx_high_water) {
+		rx_high_water = fill;
+	}
+
+	return true;
+}
+
 static void rx_task(void *arg) {
 	twai_message_t rx_message;
 
@@ -546,12 +764,15 @@ static void rx_task(void *arg) {
 		esp_err_t res = twai_receive(&rx_message, 2);
 
 		if (res == ESP_OK) {
-			rx_buf[rx_write] = rx_message;
-			rx_write++;
-			if (rx_write >= RXBUF_LEN) {
-				rx_write = 0;
+			rx_push(&rx_message);
+
+			// Move the rest of the burst that already is in the driver queue and
+			// wake up process_task once for all of it.
+			while (twai_receive(&rx_message, 0) == ESP_OK) {
+				rx_push(&rx_message);
 			}
 
+			rx_wakeup_cnt++;
 			xSemaphoreGive(proc_sem);
 		}
 
@@ -588,18 +809,25 @@ static void process_task(void *arg) {
 		xSemaphoreTake(proc_sem, 10 / portTICK_PERIOD_MS);
 
 		while (rx_read != rx_write) {
-			twai_message_t *msg = &rx_buf[rx_read];
-			rx_read++;
-			if (rx_read >= RXBUF_LEN) {
-				rx_read = 0;
+			atomic_thread_fence(memory_order_acquire);
+
+			// Copy the frame so that the slot can be released before processing it
+			twai_message_t msg = rx_buf[rx_read];
+
+			int read = rx_read + 1;
+			if (read >= RXBUF_LEN) {
+				read = 0;
 			}
 
-			lispif_process_can(msg->identifier, msg->data, msg->data_length_code, msg->extd);
+			atomic_thread_fence(memory_order_release);
+			rx_read = read;
+
+			lispif_process_can(msg.identifier, msg.data, msg.data_length_code, msg.extd);
 
 			if (use_vesc_decoder) {
-				if (!bms_process_can_frame(msg->identifier, msg->data, msg->data_length_code, msg->extd)) {
-					if (msg->extd) {
-						decode_msg(msg->identifier, msg->data, msg->data_length_code, false);
+				if (!bms_process_can_frame(msg.identifier, msg.data, msg.data_length_code, msg.extd)) {
+					if (msg.extd) {
+						decode_msg(msg.identifier, msg.data, msg.data_length_code, false);
 					}
 				}
 			}
@@ -762,20 +990,7 @@ void comm_can_start(int pin_tx, int pin_rx) {
 		return;
 	}
 
-	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-		stat_msgs[i].id = -1;
-		stat_msgs_2[i].id = -1;
-		stat_msgs_3[i].id = -1;
-		stat_msgs_4[i].id = -1;
-		stat_msgs_5[i].id = -1;
-		stat_msgs_6[i].id = -1;
-
-		io_board_adc_1_4[i].id = -1;
-		io_board_adc_5_8[i].id = -1;
-		io_board_digital_in[i].id = -1;
-
-		psw_stat[i].id = -1;
-	}
+	node_status_reset();
 
 	if (!sem_init_done) {
 		ping_sem = xSemaphoreCreateBinary();
@@ -783,9 +998,17 @@ void comm_can_start(int pin_tx, int pin_rx) {
 		status_sem = xSemaphoreCreateBinary();
 		send_mutex = xSemaphoreCreateMutex();
 
+		tx_job_free = xQueueCreate(TX_JOB_NUM, sizeof(can_tx_job*));
+		tx_job_queue = xQueueCreate(TX_JOB_NUM, sizeof(can_tx_job*));
+		for (int i = 0;i < TX_JOB_NUM;i++) {
+			can_tx_job *job = &tx_jobs[i];
+			xQueueSend(tx_job_free, &job, 0);
+		}
+
 		// The process-task is left running after the first init in case comm_can_stop
 		// is called from it.
 		xTaskCreatePinnedToCore(process_task, "can_proc", 3072, NULL, 8, NULL, tskNO_AFFINITY);
+		xTaskCreatePinnedToCore(tx_task, "can_tx", 2048, NULL, 8, NULL, tskNO_AFFINITY);
 
 		sem_init_done = true;
 	}
@@ -832,6 +1055,35 @@ int comm_can_get_rx_recovery_cnt(void) {
 	return rx_recovery_cnt;
 }
 
+/**
+ * Get statistics for the receive ring between the CAN RX and processing tasks.
+ *
+ * @param stats
+ * Filled with the current statistics.
+ */
+void comm_can_get_rx_stats(can_rx_stats *stats) {
+	stats->frames = rx_frame_cnt;
+	stats->overflows = rx_overflow_cnt;
+	stats->wakeups = rx_wakeup_cnt;
+	stats->high_water = rx_high_water;
+	stats->size = RXBUF_LEN - 1;
+	stats->buf_completed = rx_buffer_completed_cnt;
+	stats->buf_crc_errors = rx_buffer_crc_error_cnt;
+	stats->buf_aborted = rx_buffer_aborted_cnt;
+	stats->buf_dropped = rx_buffer_dropped_cnt;
+}
+
+void comm_can_reset_rx_stats(void) {
+	rx_frame_cnt = 0;
+	rx_overflow_cnt = 0;
+	rx_wakeup_cnt = 0;
+	rx_high_water = 0;
+	rx_buffer_completed_cnt = 0;
+	rx_buffer_crc_error_cnt = 0;
+	rx_buffer_aborted_cnt = 0;
+	rx_buffer_dropped_cnt = 0;
+}
+
 void comm_can_use_vesc_decoder(bool use_vesc_dec) {
 	use_vesc_decoder = use_vesc_dec;
 }
@@ -915,8 +1167,10 @@ void comm_can_transmit_eid(uint32_t id, const uint8_t *data, uint8_t len) {
 		return;
 	}
 
-	twai_transmit(&tx_msg, 5);
-	
+	if (twai_transmit(&tx_msg, 5) == ESP_OK) {
+		tx_frame_cnt++;
+	}
+
 	xSemaphoreGive(send_mutex);
 }
 
@@ -943,33 +1197,44 @@ void comm_can_transmit_sid(uint32_t id, const uint8_t *data, uint8_t len) {
 		return;
 	}
 
-	twai_transmit(&tx_msg, 5);
-	
+	if (twai_transmit(&tx_msg, 5) == ESP_OK) {
+		tx_frame_cnt++;
+	}
+
 	xSemaphoreGive(send_mutex);
 }
 
 /**
- * Send a buffer up to RX_BUFFER_SIZE bytes as fragments. If the buffer is 6 bytes or less
- * it will be sent in a single CAN frame, otherwise it will be split into
- * several frames.
+ * Wait until there is room for another buffer frame in the driver queue.
  *
- * @param controller_id
- * The controller id to send to.
- *
- * @param data
- * The payload.
- *
- * @param len
- * The payload length.
+ * @return
+ * false if the queue did not drain within TX_THROTTLE_TIMEOUT ticks.
+ */
+static bool tx_throttle(void) {
+	for (int i = 0;;i++) {
+		twai_status_info_t status;
+		if (!init_done || twai_get_status_info(&status) != ESP_OK ||
+				status.msgs_to_tx < TX_BULK_MAX_PENDING) {
+			return true;
+		}
+
+		if (i >= TX_THROTTLE_TIMEOUT) {
+			return false;
+		}
+
+		vTaskDelay(1);
+	}
+}
+
+/**
+ * Send the frames of a buffer. When throttling, the rest of the buffer is
+ * dropped if the driver queue does not drain.
  *
- * @param send
- * 0: Packet goes to commands_process_packet of receiver
- * 1: Packet goes to commands_send_packet of receiver
- * 2: Packet goes to commands_process and send function is set to null
- *    so that no reply is sent back.
- * 3: Same as 0, but the reply is processed locally and not sent out on the last interface.
+ * @return
+ * false if the buffer was dropped.
  */
-void comm_can_send_buffer(uint8_t controller_id, uint8_t *data, unsigned int len, uint8_t send) {
+static bool send_buffer_frames(uint8_t controller_id, const uint8_t *data,
+		unsigned int len, uint8_t send, bool throttle) {
 	uint8_t send_buffer[8];
 
 	if (len <= 6) {
@@ -999,6 +1264,10 @@ void comm_can_send_buffer(uint8_t controller_id, uint8_t *data, unsigned int len
 				memcpy(send_buffer + 1, data + i, send_len);
 			}
 
+			if (throttle && !tx_throttle()) {
+				return false;
+			}
+
 			comm_can_transmit_eid(controller_id |
 					((uint32_t)CAN_PACKET_FILL_RX_BUFFER << 8), send_buffer, send_len + 1);
 		}
@@ -1015,6 +1284,10 @@ void comm_can_send_buffer(uint8_t controller_id, uint8_t *data, unsigned int len
 				memcpy(send_buffer + 2, data + i, send_len);
 			}
 
+			if (throttle && !tx_throttle()) {
+				return false;
+			}
+
 			comm_can_transmit_eid(controller_id |
 					((uint32_t)CAN_PACKET_FILL_RX_BUFFER_LONG << 8), send_buffer, send_len + 2);
 		}
@@ -1024,13 +1297,157 @@ void comm_can_send_buffer(uint8_t controller_id, uint8_t *data, unsigned int len
 		send_buffer[ind++] = send;
 		send_buffer[ind++] = len >> 8;
 		send_buffer[ind++] = len & 0xFF;
-		unsigned short crc = crc16(data, len);
+		unsigned short crc = crc16((uint8_t*)data, len);
 		send_buffer[ind++] = (uint8_t)(crc >> 8);
 		send_buffer[ind++] = (uint8_t)(crc & 0xFF);
 
+		if (throttle && !tx_throttle()) {
+			return false;
+		}
+
 		comm_can_transmit_eid(controller_id |
 				((uint32_t)CAN_PACKET_PROCESS_RX_BUFFER << 8), send_buffer, ind++);
 	}
+
+	return true;
+}
+
+static void tx_task(void *arg) {
+	for (;;) {
+		can_tx_job *job;
+		xQueueReceive(tx_job_queue, &job, portMAX_DELAY);
+
+		if (send_buffer_frames(job->controller_id, job->data, job->len, job->send, true)) {
+			tx_buffer_cnt++;
+			tx_buffer_bytes += job->len;
+		} else {
+			tx_buffer_drop_cnt++;
+		}
+
+		void(*done_cb)(void *arg) = job->done_cb;
+		void *done_arg = job->done_arg;
+
+		xQueueSend(tx_job_free, &job, portMAX_DELAY);
+
+		if (done_cb) {
+			done_cb(done_arg);
+		}
+	}
+
+	vTaskDelete(NULL);
+}
+
+/**
+ * Send a buffer as fragments. If the buffer is 6 bytes or less it will be sent
+ * in a single CAN frame, otherwise it will be split into several frames.
+ *
+ * Buffers up to TX_JOB_SIZE bytes are copied and sent in the background by
+ * tx_task, in the order they were queued, so this returns before the transfer
+ * is done. If all jobs are in use the caller waits up to TX_JOB_WAIT_MS for
+ * one to become free. A queued buffer is dropped if the frames cannot be
+ * passed to the driver, e.g. when nothing on the bus acknowledges them.
+ * Frames sent with comm_can_transmit_eid while a buffer is being sent are not
+ * delayed by the whole buffer. Larger buffers are sent directly.
+ *
+ * @param controller_id
+ * The controller id to send to.
+ *
+ * @param data
+ * The payload.
+ *
+ * @param len
+ * The payload length.
+ *
+ * @param send
+ * 0: Packet goes to commands_process_packet of receiver
+ * 1: Packet goes to commands_send_packet of receiver
+ * 2: Packet goes to commands_process and send function is set to null
+ *    so that no reply is sent back.
+ * 3: Same as 0, but the reply is processed locally and not sent out on the last interface.
+ */
+void comm_can_send_buffer(uint8_t controller_id, uint8_t *data, unsigned int len, uint8_t send) {
+	comm_can_send_buffer_cb(controller_id, data, len, send, 0, 0);
+}
+
+/**
+ * Same as comm_can_send_buffer, but with a callback for when the last frame
+ * has been passed to the driver.
+ *
+ * @param done_cb
+ * Called from tx_task after the buffer has been sent, or directly if the buffer
+ * was sent without queueing it. Must not wait for other buffers to be sent. Can
+ * be null.
+ *
+ * @param done_arg
+ * Argument to done_cb.
+ *
+ * @return
+ * true if the buffer was queued or sent, false if CAN is not running or if
+ * no job became free in time. done_cb is not called when false is returned.
+ */
+bool comm_can_send_buffer_cb(uint8_t controller_id, uint8_t *data, unsigned int len,
+		uint8_t send, void(*done_cb)(void *arg), void *done_arg) {
+	if (!init_done) {
+		return false;
+	}
+
+	if (len > TX_JOB_SIZE) {
+		// Let the queued buffers go first so that the frames do not get mixed up
+		TickType_t t_start = xTaskGetTickCount();
+		while (init_done && uxQueueMessagesWaiting(tx_job_free) < TX_JOB_NUM) {
+			if ((xTaskGetTickCount() - t_start) >= pdMS_TO_TICKS(TX_JOB_WAIT_MS)) {
+				tx_buffer_drop_cnt++;
+				return false;
+			}
+
+			vTaskDelay(1);
+		}
+
+		send_buffer_frames(controller_id, data, len, send, false);
+		tx_buffer_cnt++;
+		tx_buffer_bytes += len;
+
+		if (done_cb) {
+			done_cb(done_arg);
+		}
+
+		return true;
+	}
+
+	can_tx_job *job;
+	if (xQueueReceive(tx_job_free, &job, 0) != pdTRUE) {
+		tx_buffer_stall_cnt++;
+		if (xQueueReceive(tx_job_free, &job, pdMS_TO_TICKS(TX_JOB_WAIT_MS)) != pdTRUE) {
+			tx_buffer_drop_cnt++;
+			return false;
+		}
+	}
+
+	job->controller_id = controller_id;
+	job->send = send;
+	job->len = len;
+	job->done_cb = done_cb;
+	job->done_arg = done_arg;
+	memcpy(job->data, data, len);
+
+	xQueueSend(tx_job_queue, &job, portMAX_DELAY);
+
+	return true;
+}
+
+/**
+ * Get transmit statistics.
+ *
+ * @param stats
+ * Filled with the current statistics.
+ */
+void comm_can_get_tx_stats(can_tx_stats *stats) {
+	stats->frames = tx_frame_cnt;
+	stats->buffers = tx_buffer_cnt;
+	stats->buffer_bytes = tx_buffer_bytes;
+	stats->stalls = tx_buffer_stall_cnt;
+	stats->dropped = tx_buffer_drop_cnt;
+	stats->queued = sem_init_done ? (TX_JOB_NUM - uxQueueMessagesWaiting(tx_job_free)) : 0;
 }
 
 /**
@@ -1156,174 +1573,195 @@ void comm_can_set_handbrake_rel(uint8_t controller_id, float current_rel) {
 }
 
 can_status_msg *comm_can_get_status_msg_index(int index) {
-	if (index < CAN_STATUS_MSGS_TO_STORE) {
-		return &stat_msgs[index];
+	if (index >= 0 && index < CAN_STATUS_MSGS_TO_STORE) {
+		return &node_status[index].stat_msg;
 	} else {
 		return 0;
 	}
 }
 
 can_status_msg *comm_can_get_status_msg_id(int id) {
-	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-		if (stat_msgs[i].id == id) {
-			return &stat_msgs[i];
-		}
+	can_node_status *node = node_get(id);
+
+	if (node && node->stat_msg.id == id) {
+		return &node->stat_msg;
 	}
 
 	return 0;
 }
 
 can_status_msg_2 *comm_can_get_status_msg_2_index(int index) {
-	if (index < CAN_STATUS_MSGS_TO_STORE) {
-		return &stat_msgs_2[index];
+	if (index >= 0 && index < CAN_STATUS_MSGS_TO_STORE) {
+		return &node_status[index].stat_msg_2;
 	} else {
 		return 0;
 	}
 }
 
 can_status_msg_2 *comm_can_get_status_msg_2_id(int id) {
-	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-		if (stat_msgs_2[i].id == id) {
-			return &stat_msgs_2[i];
-		}
+	can_node_status *node = node_get(id);
+
+	if (node && node->stat_msg_2.id == id) {
+		return &node->stat_msg_2;
 	}
 
 	return 0;
 }
 
 can_status_msg_3 *comm_can_get_status_msg_3_index(int index) {
-	if (index < CAN_STATUS_MSGS_TO_STORE) {
-		return &stat_msgs_3[index];
+	if (index >= 0 && index < CAN_STATUS_MSGS_TO_STORE) {
+		return &node_status[index].stat_msg_3;
 	} else {
 		return 0;
 	}
 }
 
 can_status_msg_3 *comm_can_get_status_msg_3_id(int id) {
-	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-		if (stat_msgs_3[i].id == id) {
-			return &stat_msgs_3[i];
-		}
+	can_node_status *node = node_get(id);
+
+	if (node && node->stat_msg_3.id == id) {
+		return &node->stat_msg_3;
 	}
 
 	return 0;
 }
 
 can_status_msg_4 *comm_can_get_status_msg_4_index(int index) {
-	if (index < CAN_STATUS_MSGS_TO_STORE) {
-		return &stat_msgs_4[index];
+	if (index >= 0 && index < CAN_STATUS_MSGS_TO_STORE) {
+		return &node_status[index].stat_msg_4;
 	} else {
 		return 0;
 	}
 }
 
 can_status_msg_4 *comm_can_get_status_msg_4_id(int id) {
-	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-		if (stat_msgs_4[i].id == id) {
-			return &stat_msgs_4[i];
-		}
+	can_node_status *node = node_get(id);
+
+	if (node && node->stat_msg_4.id == id) {
+		return &node->stat_msg_4;
 	}
 
 	return 0;
 }
 
 can_status_msg_5 *comm_can_get_status_msg_5_index(int index) {
-	if (index < CAN_STATUS_MSGS_TO_STORE) {
-		return &stat_msgs_5[index];
+	if (index >= 0 && index < CAN_STATUS_MSGS_TO_STORE) {
+		return &node_status[index].stat_msg_5;
 	} else {
 		return 0;
 	}
 }
 
 can_status_msg_5 *comm_can_get_status_msg_5_id(int id) {
-	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-		if (stat_msgs_5[i].id == id) {
-			return &stat_msgs_5[i];
-		}
+	can_node_status *node = node_get(id);
+
+	if (node && node->stat_msg_5.id == id) {
+		return &node->stat_msg_5;
 	}
 
 	return 0;
 }
 
 can_status_msg_6 *comm_can_get_status_msg_6_index(int index) {
-	if (index < CAN_STATUS_MSGS_TO_STORE) {
-		return &stat_msgs_6[index];
+	if (index >= 0 && index < CAN_STATUS_MSGS_TO_STORE) {
+		return &node_status[index].stat_msg_6;
 	} else {
 		return 0;
 	}
 }
 
 can_status_msg_6 *comm_can_get_status_msg_6_id(int id) {
-	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-		if (stat_msgs_6[i].id == id) {
-			return &stat_msgs_6[i];
-		}
+	can_node_status *node = node_get(id);
+
+	if (node && node->stat_msg_6.id == id) {
+		return &node->stat_msg_6;
 	}
 
 	return 0;
 }
 
 io_board_adc_values *comm_can_get_io_board_adc_1_4_index(int index) {
-	if (index < CAN_STATUS_MSGS_TO_STORE && io_board_adc_1_4[index].id >= 0) {
-		return &io_board_adc_1_4[index];
+	if (index >= 0 && index < CAN_STATUS_MSGS_TO_STORE && node_status[index].io_board_adc_1_4.id >= 0) {
+		return &node_status[index].io_board_adc_1_4;
 	} else {
 		return 0;
 	}
 }
 
 io_board_adc_values *comm_can_get_io_board_adc_1_4_id(int id) {
-	if (id == 255 && io_board_adc_1_4[0].id >= 0) {
-		return &io_board_adc_1_4[0];
+	if (id == 255) {
+		// Any io-board, use the first one that has been seen
+		for (int i = 0;i < node_num;i++) {
+			if (node_status[i].io_board_adc_1_4.id >= 0) {
+				return &node_status[i].io_board_adc_1_4;
+			}
+		}
+
+		return 0;
 	}
 
-	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-		if (io_board_adc_1_4[i].id == id) {
-			return &io_board_adc_1_4[i];
-		}
+	can_node_status *node = node_get(id);
+
+	if (node && node->io_board_adc_1_4.id == id) {
+		return &node->io_board_adc_1_4;
 	}
 
 	return 0;
 }
 
 io_board_adc_values *comm_can_get_io_board_adc_5_8_index(int index) {
-	if (index < CAN_STATUS_MSGS_TO_STORE && io_board_adc_5_8[index].id >= 0) {
-		return &io_board_adc_5_8[index];
+	if (index >= 0 && index < CAN_STATUS_MSGS_TO_STORE && node_status[index].io_board_adc_5_8.id >= 0) {
+		return &node_status[index].io_board_adc_5_8;
 	} else {
 		return 0;
 	}
 }
 
 io_board_adc_values *comm_can_get_io_board_adc_5_8_id(int id) {
-	if (id == 255 && io_board_adc_5_8[0].id >= 0) {
-		return &io_board_adc_5_8[0];
+	if (id == 255) {
+		// Any io-board, use the first one that has been seen
+		for (int i = 0;i < node_num;i++) {
+			if (node_status[i].io_board_adc_5_8.id >= 0) {
+				return &node_status[i].io_board_adc_5_8;
+			}
+		}
+
+		return 0;
 	}
 
-	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-		if (io_board_adc_5_8[i].id == id) {
-			return &io_board_adc_5_8[i];
-		}
+	can_node_status *node = node_get(id);
+
+	if (node && node->io_board_adc_5_8.id == id) {
+		return &node->io_board_adc_5_8;
 	}
 
 	return 0;
 }
 
 io_board_digial_inputs *comm_can_get_io_board_digital_in_index(int index) {
-	if (index < CAN_STATUS_MSGS_TO_STORE) {
-		return &io_board_digital_in[index];
+	if (index >= 0 && index < CAN_STATUS_MSGS_TO_STORE) {
+		return &node_status[index].io_board_digital_in;
 	} else {
 		return 0;
 	}
 }
 
 io_board_digial_inputs *comm_can_get_io_board_digital_in_id(int id) {
-	if (id == 255 && io_board_digital_in[0].id >= 0) {
-		return &io_board_digital_in[0];
+	if (id == 255) {
+		// Any io-board, use the first one that has been seen
+		for (int i = 0;i < node_num;i++) {
+			if (node_status[i].io_board_digital_in.id >= 0) {
+				return &node_status[i].io_board_digital_in;
+			}
+		}
+
+		return 0;
 	}
 
-	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-		if (io_board_digital_in[i].id == id) {
-			return &io_board_digital_in[i];
-		}
+	can_node_status *node = node_get(id);
+
+	if (node && node->io_board_digital_in.id == id) {
+		return &node->io_board_digital_in;
 	}
 
 	return 0;
@@ -1351,18 +1789,18 @@ void comm_can_io_board_set_output_pwm(int id, int channel, float duty) {
 }
 
 psw_status *comm_can_get_psw_status_index(int index) {
-	if (index < CAN_STATUS_MSGS_TO_STORE) {
-		return &psw_stat[index];
+	if (index >= 0 && index < CAN_STATUS_MSGS_TO_STORE) {
+		return &node_status[index].psw_stat;
 	} else {
 		return 0;
 	}
 }
 
 psw_status *comm_can_get_psw_status_id(int id) {
-	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-		if (psw_stat[i].id == id) {
-			return &psw_stat[i];
-		}
+	can_node_status *node = node_get(id);
+
+	if (node && node->psw_stat.id == id) {
+		return &node->psw_stat;
 	}
 
 	return 0;
@@ -22,18 +22,31 @@
 
 #include "datatypes.h"
 
+// Number of controllers to store status messages from. Lookups by id are
+// direct, so this only affects the memory usage.
+#ifndef CAN_STATUS_MSGS_TO_STORE
 #define CAN_STATUS_MSGS_TO_STORE	10
+#endif
+
+#if CAN_STATUS_MSGS_TO_STORE > 255
+#error "CAN_STATUS_MSGS_TO_STORE can be at most 255"
+#endif
 
 // Functions
 void comm_can_start(int pin_tx, int pin_rx);
 void comm_can_stop(void);
 int comm_can_get_rx_recovery_cnt(void);
+void comm_can_get_rx_stats(can_rx_stats *stats);
+void comm_can_reset_rx_stats(void);
 void comm_can_use_vesc_decoder(bool use_vesc_dec);
 void comm_can_update_baudrate(void);
 void comm_can_change_pins(int tx, int rx);
 void comm_can_transmit_eid(uint32_t id, const uint8_t *data, uint8_t len);
 void comm_can_transmit_sid(uint32_t id, const uint8_t *data, uint8_t len);
 void comm_can_send_buffer(uint8_t controller_id, uint8_t *data, unsigned int len, uint8_t send);
+bool comm_can_send_buffer_cb(uint8_t controller_id, uint8_t *data, unsigned int len,
+		uint8_t send, void(*done_cb)(void *arg), void *done_arg);
+void comm_can_get_tx_stats(can_tx_stats *stats);
 bool comm_can_ping(uint8_t controller_id, HW_TYPE *hw_type);
 
 void comm_can_set_duty(uint8_t controller_id, float duty);
@@ -39,10 +39,24 @@ static void rx_task(void *arg) {
 	state->is_running = true;
 
 	while (!state->should_stop) {
-		uint8_t buf[1];
+		uint8_t buf[128];
 		int bytes = uart_read_bytes(state->uart_num, buf, 1, 3);
 		if (bytes > 0) {
-			packet_process_byte(buf[0], &(state->packet_state));
+			// Pick up the rest of what is already in the driver buffer without waiting
+			size_t buffered = 0;
+			uart_get_buffered_data_len(state->uart_num, &buffered);
+			if (buffered > (sizeof(buf) - 1)) {
+				buffered = sizeof(buf) - 1;
+			}
+
+			if (buffered > 0) {
+				int more = uart_read_bytes(state->uart_num, buf + 1, buffered, 0);
+				if (more > 0) {
+					bytes += more;
+				}
+			}
+
+			packet_process_buffer(buf, bytes, &(state->packet_state));
 		}
 
 		// Check if this uart has been stopped externally
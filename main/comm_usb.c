@@ -39,9 +39,11 @@ static PACKET_STATE_t packet_state;
 
 static void rx_task(void *arg) {
 	for (;;) {
-		uint8_t buf[1];
-		usb_serial_jtag_read_bytes(buf, 1, portMAX_DELAY);
-		packet_process_byte(buf[0], &packet_state);
+		uint8_t buf[128];
+		int bytes = usb_serial_jtag_read_bytes(buf, sizeof(buf), portMAX_DELAY);
+		if (bytes > 0) {
+			packet_process_buffer(buf, bytes, &packet_state);
+		}
 	}
 }
 
@@ -49,27 +51,35 @@ static void process_packet(unsigned char *data, unsigned int len) {
 	commands_process_packet(data, len, comm_usb_send_packet);
 }
 
-static void send_packet_raw(unsigned char *buffer, unsigned int len) {
-	unsigned int sent = 0;
+// Send all segments of a packet. Gives up on the whole packet once the
+// driver stops accepting data, so that no further segments of a broken
+// frame are written.
+static void send_packet_vec(PACKET_SEG_t *segs, int seg_num) {
 	int fail_cnt = 0;
 
-	while (sent < len) {
-		int to_send = len - sent;
-		if (to_send > 150) {
-			to_send = 150;
-		}
-
-		unsigned int sent_now = usb_serial_jtag_write_bytes(buffer + sent, to_send, 10);
-		sent += sent_now;
-
-		if (sent_now == 0) {
-			fail_cnt++;
-		} else {
-			fail_cnt = 0;
-		}
-
-		if (fail_cnt >= 3) {
-			break;
+	for (int i = 0;i < seg_num;i++) {
+		unsigned char *buffer = segs[i].data;
+		unsigned int len = segs[i].len;
+		unsigned int sent = 0;
+
+		while (sent < len) {
+			int to_send = len - sent;
+			if (to_send > 150) {
+				to_send = 150;
+			}
+
+			unsigned int sent_now = usb_serial_jtag_write_bytes(buffer + sent, to_send, 10);
+			sent += sent_now;
+
+			if (sent_now == 0) {
+				fail_cnt++;
+			} else {
+				fail_cnt = 0;
+			}
+
+			if (fail_cnt >= 3) {
+				return;
+			}
 		}
 	}
 }
@@ -80,7 +90,7 @@ void comm_usb_init(void) {
 	usb_serial_jtag_config.tx_buffer_size = 256;
 	usb_serial_jtag_driver_install(&usb_serial_jtag_config);
 
-	packet_init(send_packet_raw, process_packet, &packet_state);
+	packet_init_vec(send_packet_vec, process_packet, &packet_state);
 
 	xTaskCreatePinnedToCore(rx_task, "usb_rx", 3072, NULL, 8, NULL, tskNO_AFFINITY);
 }
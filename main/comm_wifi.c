@@ -191,15 +191,15 @@ static const char *wifi_reason_to_str(wifi_err_reason_t reason) {
 
 static void do_comm(const int sock, comm_state *comm) {
 	int len;
-	char rx_buffer[128];
+	uint8_t rx_buffer[512];
 
 	comm->socket = sock;
 
 	do {
-		len = recv(sock, rx_buffer, sizeof(rx_buffer) - 1, 0);
+		len = recv(sock, rx_buffer, sizeof(rx_buffer), 0);
 
-		for (int i = 0;i < len;i++) {
-			packet_process_byte(rx_buffer[i], comm->packet);
+		if (len > 0) {
+			packet_process_buffer(rx_buffer, len, comm->packet);
 		}
 	} while (len > 0);
 
@@ -430,6 +430,58 @@ void comm_wifi_send_raw_local(unsigned char *buffer, unsigned int len) {
 	}
 }
 
+static void send_segs(int sock, PACKET_SEG_t *segs, int seg_num) {
+	if (sock < 0 || seg_num > PACKET_SEG_NUM) {
+		return;
+	}
+
+	struct iovec iov[PACKET_SEG_NUM];
+	for (int i = 0;i < seg_num;i++) {
+		iov[i].iov_base = segs[i].data;
+		iov[i].iov_len = segs[i].len;
+	}
+
+	struct msghdr msg = {0};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = seg_num;
+
+	int error_cnt = 0;
+
+	while (msg.msg_iovlen > 0) {
+		int written = sendmsg(sock, &msg, 0);
+		if (written < 0) {
+			error_cnt++;
+
+			if (error_cnt > SEND_RAW_MAX_RETRIES) {
+				return;
+			}
+
+			vTaskDelay(1);
+			continue;
+		}
+
+		// Skip what was written, the rest is sent in the next iteration
+		while (msg.msg_iovlen > 0 && (size_t)written >= msg.msg_iov->iov_len) {
+			written -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+
+		if (msg.msg_iovlen > 0) {
+			msg.msg_iov->iov_base = (uint8_t*)msg.msg_iov->iov_base + written;
+			msg.msg_iov->iov_len -= written;
+		}
+	}
+}
+
+static void send_vec_local(PACKET_SEG_t *segs, int seg_num) {
+	send_segs(comm_local.socket, segs, seg_num);
+}
+
+static void send_vec_hub(PACKET_SEG_t *segs, int seg_num) {
+	send_segs(comm_hub.socket, segs, seg_num);
+}
+
 void comm_wifi_send_raw_hub(unsigned char *buffer, unsigned int len) {
 	if (comm_hub.socket < 0) {
 		return;
@@ -542,14 +594,14 @@ void comm_wifi_init(void) {
 
 	if (backup.config.use_tcp_local) {
 		comm_local.packet = calloc(1, sizeof(PACKET_STATE_t));
-		packet_init(comm_wifi_send_raw_local, process_packet_local, comm_local.packet);
-		xTaskCreatePinnedToCore(tcp_task_local, "tcp_local", 3500, NULL, 8, NULL, tskNO_AFFINITY);
+		packet_init_vec(send_vec_local, process_packet_local, comm_local.packet);
+		xTaskCreatePinnedToCore(tcp_task_local, "tcp_local", 4000, NULL, 8, NULL, tskNO_AFFINITY);
 	}
 
 	if (backup.config.use_tcp_hub) {
 		comm_hub.packet = calloc(1, sizeof(PACKET_STATE_t));
-		packet_init(comm_wifi_send_raw_hub, process_packet_hub, comm_hub.packet);
-		xTaskCreatePinnedToCore(tcp_task_hub, "tcp_hub", 3500, NULL, 8, NULL, tskNO_AFFINITY);
+		packet_init_vec(send_vec_hub, process_packet_hub, comm_hub.packet);
+		xTaskCreatePinnedToCore(tcp_task_hub, "tcp_hub", 4000, NULL, 8, NULL, tskNO_AFFINITY);
 	}
 
 	xTaskCreatePinnedToCore(broadcast_task, "udp_multicast", 1024, NULL, 8, NULL, tskNO_AFFINITY);
@@ -22,6 +22,23 @@
 
 #include <stdint.h>
 
+// Settings
+
+// Number of bytes processed per table lookup step: 1, 4 or 8. More slices
+// are faster on long buffers, but need 1.5 kB more flash per slice.
+#ifndef CRC_SLICES
+#define CRC_SLICES			4
+#endif
+
+// Use the CRC functions in the ESP ROM instead of the tables
+#ifndef CRC_USE_ROM
+#define CRC_USE_ROM			0
+#endif
+
+#if CRC_SLICES != 1 && CRC_SLICES != 4 && CRC_SLICES != 8
+#error "CRC_SLICES must be 1, 4 or 8"
+#endif
+
 /*
  * Functions
  */
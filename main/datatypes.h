@@ -424,4 +424,37 @@ typedef struct {
 	bool is_dsc_on;
 } psw_status;
 
+typedef struct {
+	uint32_t frames; // Frames put in the receive ring
+	uint32_t overflows; // Frames dropped because the ring was full
+	uint32_t wakeups; // Times the processing task was woken up
+	int high_water; // Highest number of frames waiting in the ring
+	int size; // Number of frames the ring can hold
+	uint32_t buf_completed; // Multi-frame transfers received with a valid CRC
+	uint32_t buf_crc_errors; // Multi-frame transfers dropped because of a CRC error
+	uint32_t buf_aborted; // Multi-frame transfers that timed out or were evicted
+	uint32_t buf_dropped; // Fill or process frames without a matching transfer
+} can_rx_stats;
+
+typedef struct {
+	uint32_t frames; // Frames passed to the driver
+	uint32_t buffers; // Buffers sent with comm_can_send_buffer
+	uint32_t buffer_bytes; // Payload bytes of those buffers
+	uint32_t stalls; // Times a caller had to wait for a free buffer job
+	uint32_t dropped; // Buffers dropped because the bus or the jobs did not free up in time
+	int queued; // Buffer jobs waiting or being sent right now
+} can_tx_stats;
+
+typedef struct {
+	uint32_t bytes_written;
+	uint32_t writes;
+	uint32_t write_time_max_ms; // Longest single write
+	uint32_t fsyncs;
+	uint32_t fsync_time_max_ms;
+	uint32_t stalls; // Times a writer found all buffers in use
+	uint32_t drops; // Writes dropped as no buffer became free in time
+	uint32_t errors; // Failed or short writes
+	int queued; // Buffers waiting to be written right now
+} file_writer_stats;
+
 #endif /* MAIN_DATATYPES_H_ */
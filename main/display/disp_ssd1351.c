@@ -69,73 +69,54 @@ static uint16_t to_disp_color(uint32_t rgb) {
 	return color;
 }
 
-static void blast_indexed2(image_buffer_t *img, color_t *colors) {
-	command_start(0x5C);
-	hwspi_data_stream_start();
-
-	uint8_t *data = img->data;
-	int num_pix = img->width * img->height;
-
-	for (int i = 0; i < num_pix; i ++) {
-		int byte = i >> 3;
-		int bit  = 7 - (i & 0x7);
-		int color_ind = (data[byte] & (1 << bit)) >> bit;
-
-		uint16_t c = to_disp_color(
-				COLOR_TO_RGB888(colors[color_ind],
-						i % img->width, i / img->width));
-		hwspi_data_stream_write((uint8_t)c);
-		hwspi_data_stream_write((uint8_t)(c >> 8));
-	}
-
-	hwspi_data_stream_finish();
-}
+// Pixels packed per write to the SPI stream.
+#define BLAST_CHUNK_PIX		64
 
-static void blast_indexed4(image_buffer_t *img, color_t *colors) {
+static void blast_indexed(image_buffer_t *img, color_t *colors, int bits) {
 	command_start(0x5C);
 	hwspi_data_stream_start();
 
 	uint8_t *data = img->data;
-	int num_pix = img->width * img->height;
-
-	for (int i = 0; i < num_pix; i ++) {
-		int byte = i >> 2;
-		int bit = (3 - (i & 0x03)) * 2;
-		int color_ind = (data[byte] & (0x03 << bit)) >> bit;
-
-		uint16_t c = to_disp_color(
-				COLOR_TO_RGB888(colors[color_ind],
-						i % img->width, i / img->width));
-		hwspi_data_stream_write((uint8_t)c);
-		hwspi_data_stream_write((uint8_t)(c >> 8));
+	int width = img->width;
+	int height = img->height;
+	int mask = (1 << bits) - 1;
+
+	// Palette in display byte order. Gradient colors depend on the position
+	// and are the only ones converted per pixel.
+	uint16_t lut[16];
+	uint32_t gradient = 0;
+	for (int i = 0; i <= mask; i++) {
+		if (colors[i].type == COLOR_REGULAR) {
+			lut[i] = to_disp_color((uint32_t)colors[i].color1);
+		} else {
+			lut[i] = 0;
+			gradient |= 1 << i;
+		}
 	}
 
-	hwspi_data_stream_finish();
-}
-
-static void blast_indexed16(image_buffer_t *img, color_t *colors) {
-	command_start(0x5C);
-	hwspi_data_stream_start();
-
-	uint8_t *data = img->data;
-	int num_pix = img->width * img->height;
-
-	for (int i = 0; i < num_pix; i ++) {
-		int byte = i >> 1;    // byte to access is pix / 2
-		int bit = (1 - (i & 0x01)) * 4; // bit position to access within byte
-		int color_ind = (data[byte] & (0x0F << bit)) >> bit; // extract 4 bit value.
-
-		uint16_t c = to_disp_color(
-				COLOR_TO_RGB888(colors[color_ind],
-						i % img->width, i / img->width));
-		hwspi_data_stream_write((uint8_t)c);
-		hwspi_data_stream_write((uint8_t)(c >> 8));
+	uint8_t chunk[2 * BLAST_CHUNK_PIX];
+	uint32_t bit = 0;
+	for (int y = 0; y < height; y++) {
+		for (int x0 = 0; x0 < width; x0 += BLAST_CHUNK_PIX) {
+			int n = width - x0 < BLAST_CHUNK_PIX ? width - x0 : BLAST_CHUNK_PIX;
+			for (int j = 0; j < n; j++) {
+				int ind = (data[bit >> 3] >> (8 - bits - (bit & 7))) & mask;
+				bit += bits;
+
+				uint16_t c = lut[ind];
+				if (gradient & (1 << ind)) {
+					c = to_disp_color(COLOR_TO_RGB888(colors[ind], x0 + j, y));
+				}
+				chunk[2 * j] = (uint8_t)c;
+				chunk[2 * j + 1] = (uint8_t)(c >> 8);
+			}
+			hwspi_data_stream_write_buf(chunk, 2 * n);
+		}
 	}
 
 	hwspi_data_stream_finish();
 }
 
-
 static void blast_rgb332(uint8_t *data, uint32_t num_pix) {
 	command_start(0x5C);
 	hwspi_data_stream_start();
@@ -215,15 +196,15 @@ bool disp_ssd1351_render_image(image_buffer_t *img, uint16_t x, uint16_t y, colo
 	switch(img->fmt) {
 	case indexed2:
 		if (!colors) return false;
-		blast_indexed2(img, colors);
+		blast_indexed(img, colors, 1);
 		break;
 	case indexed4:
 		if (!colors) return false;
-		blast_indexed4(img, colors);
+		blast_indexed(img, colors, 2);
 		break;
 	case indexed16:
 		if (!colors) return false;
-		blast_indexed16(img, colors);
+		blast_indexed(img, colors, 4);
 		break;
 	case rgb332:
 		blast_rgb332(img->data, num_pix);
@@ -35,6 +35,7 @@
 #include "display/disp_st7735.h"
 #include "display/disp_ssd1351.h"
 #include "display/disp_icna3306.h"
+#include "hwspi.h"
 
 #include <math.h>
 
@@ -338,6 +339,17 @@ static lbm_value ext_disp_load_icna3306(lbm_value *args, lbm_uint argn) {
 	return ENC_SYM_TRUE;
 }
 
+static lbm_value ext_disp_spi_chunk_size(lbm_value *args, lbm_uint argn) {
+	LBM_CHECK_ARGN_NUMBER(1);
+
+	if (!hwspi_set_chunk_size(lbm_dec_as_i32(args[0]))) {
+		lbm_set_error_reason("Invalid chunk size or out of DMA memory");
+		return ENC_SYM_EERROR;
+	}
+
+	return ENC_SYM_TRUE;
+}
+
 void lispif_load_disp_extensions(void) {
 
 	lbm_display_extensions_init();
@@ -350,5 +362,6 @@ void lispif_load_disp_extensions(void) {
 	lbm_add_extension("disp-load-st7735", ext_disp_load_st7735);
 	lbm_add_extension("disp-load-ssd1351", ext_disp_load_ssd1351);
 	lbm_add_extension("disp-load-icna3306", ext_disp_load_icna3306);
+	lbm_add_extension("disp-spi-chunk-size", ext_disp_spi_chunk_size);
 }
 
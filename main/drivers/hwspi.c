@@ -21,6 +21,9 @@
 #include "hwspi.h"
 #include <string.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "soc/gpio_struct.h"
 #include "driver/gpio.h"
 #include "driver/spi_master.h"
@@ -28,7 +31,7 @@
 #define SET_CS() 		(GPIO.out_w1ts.val = 1 << m_pin_cs)
 #define CLEAR_CS()		(GPIO.out_w1tc.val = 1 << m_pin_cs)
 
-// Stream buffer for triple buffering
+// Stream buffer for double buffering
 typedef struct data_stream_buffer_s {
 	uint8_t *data;
 	int pos;
@@ -41,23 +44,89 @@ static spi_device_handle_t m_spi;
 static int m_pin_cs = -1;
 static data_stream_buffer_t m_data_buffers[HWSPI_BUFFERS];
 static data_stream_buffer_t *m_active_buffer = 0;
+static int m_in_flight = 0;
 static bool m_init_done = false;
 static spi_bus_config_t m_buscfg = {0};
 static spi_device_interface_config_t m_devcfg = {0};
+static SemaphoreHandle_t m_idle_sem;
+static SemaphoreHandle_t m_tail_sem;
 
 // Global variables
 uint8_t *hwspi_buffer_pointer = 0;
 int *hwspi_buffer_pos = 0;
+int hwspi_chunk_size = HWSPI_CHUNK_SIZE_DEFAULT;
 
 #include "commands.h"
 
+static void wait_oldest(void) {
+	spi_transaction_t *t;
+	spi_device_get_trans_result(m_spi, &t, portMAX_DELAY);
+	m_in_flight--;
+}
+
+static void wait_all(void) {
+	while (m_in_flight > 0) {
+		wait_oldest();
+	}
+}
+
+static void queue_active(void) {
+	m_active_buffer->trans.length = m_active_buffer->pos * 8;
+	m_active_buffer->pos = 0;
+	spi_device_queue_trans(m_spi, &m_active_buffer->trans, portMAX_DELAY);
+	m_in_flight++;
+}
+
+static void release(void) {
+	SET_CS();
+	spi_device_release_bus(m_spi);
+	xSemaphoreGive(m_idle_sem);
+}
+
+// Finishes the streams that hwspi_end left running
+static void tail_task(void *arg) {
+	for (;;) {
+		xSemaphoreTake(m_tail_sem, portMAX_DELAY);
+		wait_all();
+		release();
+	}
+}
+
+static bool alloc_buffers(int size) {
+	uint8_t *bufs[HWSPI_BUFFERS];
+
+	for (int i = 0;i < HWSPI_BUFFERS;i++) {
+		bufs[i] = heap_caps_malloc(size, MALLOC_CAP_DMA);
+		if (!bufs[i]) {
+			for (int j = 0;j < i;j++) {
+				heap_caps_free(bufs[j]);
+			}
+			return false;
+		}
+	}
+
+	for (int i = 0;i < HWSPI_BUFFERS;i++) {
+		if (m_data_buffers[i].data) {
+			heap_caps_free(m_data_buffers[i].data);
+		}
+		m_data_buffers[i].data = bufs[i];
+	}
+
+	hwspi_chunk_size = size;
+	return true;
+}
+
 void hwspi_init(int clk_mhz, int mode,
 		int pin_miso, int pin_mosi, int pin_clk, int pin_cs) {
 
 	if (!m_init_done) {
-		for (int i = 0;i < HWSPI_BUFFERS;i++) {
-			m_data_buffers[i].data = heap_caps_malloc(HWSPI_DATA_BUFFER_SIZE, MALLOC_CAP_DMA);
-		}
+		alloc_buffers(hwspi_chunk_size);
+		m_idle_sem = xSemaphoreCreateBinary();
+		m_tail_sem = xSemaphoreCreateBinary();
+		xTaskCreatePinnedToCore(tail_task, "hwspi_tail", 2048, NULL, 7, NULL, tskNO_AFFINITY);
+	} else {
+		// Wait for the last stream to the old device
+		xSemaphoreTake(m_idle_sem, portMAX_DELAY);
 	}
 
 	m_pin_cs = pin_cs;
@@ -67,13 +136,13 @@ void hwspi_init(int clk_mhz, int mode,
 	m_buscfg.sclk_io_num = pin_clk;
 	m_buscfg.quadwp_io_num = -1;
 	m_buscfg.quadhd_io_num = -1;
-	m_buscfg.max_transfer_sz = 4092;
+	m_buscfg.max_transfer_sz = HWSPI_CHUNK_SIZE_MAX;
 
 	m_devcfg.clock_speed_hz = clk_mhz * 1000 * 1000;
 	m_devcfg.mode = mode;
 	m_devcfg.spics_io_num = -1; // We handle CS manually
 	m_devcfg.flags = 0;
-	m_devcfg.queue_size = 1; // Must be 1, otherwise multiple buffers will be queued at the same time
+	m_devcfg.queue_size = HWSPI_BUFFERS; // One buffer on the wire and one waiting
 	m_devcfg.pre_cb = NULL;
 
 	gpio_config_t gpconf = {0};
@@ -87,9 +156,6 @@ void hwspi_init(int clk_mhz, int mode,
 	SET_CS();
 
 	if (m_init_done) {
-		static spi_transaction_t *tmp_ptr = 0;
-		spi_device_get_trans_result(m_spi, &tmp_ptr, 0);
-		spi_device_get_trans_result(m_spi, &tmp_ptr, 0);
 		spi_bus_remove_device(m_spi);
 		spi_bus_free(SPI2_HOST);
 	}
@@ -98,28 +164,60 @@ void hwspi_init(int clk_mhz, int mode,
 	spi_bus_add_device(SPI2_HOST, &m_devcfg, &m_spi);
 
 	m_init_done = true;
+	xSemaphoreGive(m_idle_sem);
+}
+
+/*
+ * Set the number of bytes sent per DMA transfer when streaming. Larger chunks mean
+ * fewer transfers to queue, smaller ones less memory for the two buffers.
+ */
+bool hwspi_set_chunk_size(int size) {
+	if (size < HWSPI_CHUNK_SIZE_MIN || size > HWSPI_CHUNK_SIZE_MAX) {
+		return false;
+	}
+
+	if (!m_init_done) {
+		hwspi_chunk_size = size;
+		return true;
+	}
+
+	xSemaphoreTake(m_idle_sem, portMAX_DELAY);
+	bool res = alloc_buffers(size);
+	xSemaphoreGive(m_idle_sem);
+	return res;
 }
 
 void hwspi_begin(void) {
+	xSemaphoreTake(m_idle_sem, portMAX_DELAY);
 	spi_device_acquire_bus(m_spi, portMAX_DELAY);
 	CLEAR_CS();
 }
 
 void hwspi_end(void) {
-	SET_CS();
-	spi_device_release_bus(m_spi);
+	if (m_in_flight > 0) {
+		xSemaphoreGive(m_tail_sem);
+	} else {
+		release();
+	}
 }
 
 void hwspi_swap_buffer(void) {
-	m_active_buffer->trans.length = m_active_buffer->pos * 8;
-	m_active_buffer->pos = 0;
-	spi_device_queue_trans(m_spi, &m_active_buffer->trans, portMAX_DELAY);
+	queue_active();
 	m_active_buffer = m_active_buffer->next;
+
+	// Both buffers are queued, so the next one can only be reused once the
+	// oldest transfer is done.
+	if (m_in_flight == HWSPI_BUFFERS) {
+		wait_oldest();
+	}
+
 	hwspi_buffer_pointer = m_active_buffer->data;
 	hwspi_buffer_pos = &m_active_buffer->pos;
 }
 
 void hwspi_data_stream_start(void) {
+	wait_all();
+
 	for (int i = 0;i < HWSPI_BUFFERS;i++) {
 		memset(&m_data_buffers[i].trans, 0, sizeof(spi_transaction_t));
 		m_data_buffers[i].pos = 0;
@@ -139,10 +237,14 @@ void hwspi_data_stream_start(void) {
 }
 
 void hwspi_data_stream_finish(void) {
-	hwspi_send_data(m_active_buffer->data, m_active_buffer->pos);
+	if (m_active_buffer->pos > 0) {
+		queue_active();
+	}
 }
 
 void hwspi_send_data(const uint8_t *data, int len) {
+	wait_all();
+
 	spi_transaction_t t;
 	memset(&t, 0, sizeof(t));
 	t.length = len * 8;
@@ -150,4 +252,3 @@ void hwspi_send_data(const uint8_t *data, int len) {
 	t.flags = 0;
 	spi_device_polling_transmit(m_spi, &t);
 }
-
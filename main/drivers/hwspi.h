@@ -22,26 +22,32 @@
 #define MAIN_HWSPI_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 
 /*
- * Triple buffering: Write to one buffer while one is in the queue for sending and one
- * is being sent. That means when the transaction finishes the next buffer is already
- * in the queue and there is no delay for queuing it before the next transaction can
- * start.
+ * Double buffering: The driver converts pixels into one buffer while the other one
+ * is sent with DMA. When the buffer being written is full it is queued and the
+ * writer waits for the other one to finish before continuing in it.
  *
- * NOTE: Making the buffer any larger seems to cause some data loss. No idea why that
- * happens, looks like some ESP-issue...
+ * hwspi_end returns without waiting for the last buffers of a stream. A background
+ * task waits for them and releases CS and the bus. The next hwspi_begin waits
+ * until that has happened.
  */
-#define HWSPI_DATA_BUFFER_SIZE 	1024
-#define HWSPI_BUFFERS			3
+#define HWSPI_CHUNK_SIZE_DEFAULT	1024
+#define HWSPI_CHUNK_SIZE_MIN		64
+#define HWSPI_CHUNK_SIZE_MAX		4092
+#define HWSPI_BUFFERS				2
 
 // Global variables
 extern uint8_t *hwspi_buffer_pointer;
 extern int *hwspi_buffer_pos;
+extern int hwspi_chunk_size;
 
 // Functions
 void hwspi_init(int clk_mhz, int mode,
 		int pin_miso, int pin_mosi, int pin_clk, int pin_cs);
+bool hwspi_set_chunk_size(int size);
 void hwspi_begin(void);
 void hwspi_end(void);
 void hwspi_swap_buffer(void);
@@ -49,11 +55,30 @@ void hwspi_send_data(const uint8_t *data, int len);
 
 void hwspi_data_stream_start(void);
 static inline void hwspi_data_stream_write(uint8_t byte) {
-	if (*hwspi_buffer_pos == HWSPI_DATA_BUFFER_SIZE) {
+	if (*hwspi_buffer_pos == hwspi_chunk_size) {
 		hwspi_swap_buffer();
 	}
 	hwspi_buffer_pointer[(*hwspi_buffer_pos)++] = byte;
 }
+
+static inline void hwspi_data_stream_write_buf(const uint8_t *data, int len) {
+	while (len > 0) {
+		if (*hwspi_buffer_pos == hwspi_chunk_size) {
+			hwspi_swap_buffer();
+		}
+
+		int n = hwspi_chunk_size - *hwspi_buffer_pos;
+		if (n > len) {
+			n = len;
+		}
+
+		memcpy(hwspi_buffer_pointer + *hwspi_buffer_pos, data, n);
+		*hwspi_buffer_pos += n;
+		data += n;
+		len -= n;
+	}
+}
+
 void hwspi_data_stream_finish(void);
 
 #endif /* MAIN_HWSPI_H_ */
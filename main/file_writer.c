@@ -0,0 +1,424 @@
+/*
+	Copyright 2026 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "file_writer.h"
+
+#include <string.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define JOB_FSYNC		1
+#define JOB_FORGET		2
+
+typedef struct {
+	file_writer_stream *s;
+	uint8_t *buf;
+	int len;
+	int flags;
+} fw_job;
+
+typedef struct {
+	file_writer_stream *s;
+	bool dirty;
+	TickType_t last_fsync;
+} fw_file;
+
+// Private variables
+static QueueHandle_t m_buf_free = 0;
+static QueueHandle_t m_job_queue = 0;
+static SemaphoreHandle_t m_alloc_mutex = 0;
+static int m_buf_allocated = 0;
+static volatile int m_fsync_interval_ms = FILE_WRITER_FSYNC_INTERVAL_MS;
+static fw_file m_files[FILE_WRITER_MAX_FILES];
+static volatile file_writer_stats m_stats = {0};
+
+static fw_file *file_get(file_writer_stream *s, bool add) {
+	fw_file *empty = 0;
+	for (int i = 0;i < FILE_WRITER_MAX_FILES;i++) {
+		if (m_files[i].s == s) {
+			return &m_files[i];
+		}
+
+		if (!empty && !m_files[i].s) {
+			empty = &m_files[i];
+		}
+	}
+
+	if (add && empty) {
+		empty->s = s;
+		empty->dirty = false;
+		empty->last_fsync = xTaskGetTickCount();
+		return empty;
+	}
+
+	return 0;
+}
+
+static void do_fsync(file_writer_stream *s) {
+	TickType_t t_start = xTaskGetTickCount();
+	fflush(s->f);
+	fsync(fileno(s->f));
+	uint32_t ms = pdTICKS_TO_MS(xTaskGetTickCount() - t_start);
+
+	m_stats.fsyncs++;
+	if (ms > m_stats.fsync_time_max_ms) {
+		m_stats.fsync_time_max_ms = ms;
+	}
+}
+
+static void writer_task(void *arg) {
+	for (;;) {
+		fw_job job;
+		if (xQueueReceive(m_job_queue, &job, configTICK_RATE_HZ / 10) == pdTRUE) {
+			file_writer_stream *s = job.s;
+			fw_file *file = file_get(s, job.buf != 0);
+
+			if (job.buf) {
+				TickType_t t_start = xTaskGetTickCount();
+				size_t wr = fwrite(job.buf, 1, job.len, s->f);
+				uint32_t ms = pdTICKS_TO_MS(xTaskGetTickCount() - t_start);
+
+				if (wr != (size_t)job.len) {
+					s->error = true;
+					m_stats.errors++;
+				}
+
+				m_stats.bytes_written += wr;
+				m_stats.writes++;
+				if (ms > m_stats.write_time_max_ms) {
+					m_stats.write_time_max_ms = ms;
+				}
+
+				xQueueSend(m_buf_free, &job.buf, portMAX_DELAY);
+
+				if (file) {
+					file->dirty = true;
+				}
+			}
+
+			if (job.flags & JOB_FSYNC) {
+				do_fsync(s);
+				if (file) {
+					file->dirty = false;
+					file->last_fsync = xTaskGetTickCount();
+				}
+			}
+
+			if ((job.flags & JOB_FORGET) && file) {
+				file->s = 0;
+			}
+
+			s->done++;
+		}
+
+		int interval = m_fsync_interval_ms;
+		if (interval < 0) {
+			continue;
+		}
+
+		for (int i = 0;i < FILE_WRITER_MAX_FILES;i++) {
+			fw_file *file = &m_files[i];
+			if (file->s && file->dirty &&
+					(int)pdTICKS_TO_MS(xTaskGetTickCount() - file->last_fsync) >= interval) {
+				do_fsync(file->s);
+				file->dirty = false;
+				file->last_fsync = xTaskGetTickCount();
+			}
+		}
+	}
+}
+
+static uint8_t *take_buffer(int timeout_ms) {
+	uint8_t *buf = 0;
+
+	if (xQueueReceive(m_buf_free, &buf, 0) == pdTRUE) {
+		return buf;
+	}
+
+	xSemaphoreTake(m_alloc_mutex, portMAX_DELAY);
+	if (m_buf_allocated < FILE_WRITER_BUF_NUM) {
+		buf = malloc(FILE_WRITER_BUF_SIZE);
+		if (buf) {
+			m_buf_allocated++;
+		}
+	}
+	xSemaphoreGive(m_alloc_mutex);
+
+	if (buf) {
+		return buf;
+	}
+
+	m_stats.stalls++;
+
+	if (timeout_ms > 0 &&
+			xQueueReceive(m_buf_free, &buf, pdMS_TO_TICKS(timeout_ms)) == pdTRUE) {
+		return buf;
+	}
+
+	m_stats.drops++;
+	return 0;
+}
+
+static bool get_buffer(file_writer_stream *s) {
+	if (!s->buf) {
+		s->buf = take_buffer(s->timeout_ms);
+	}
+
+	return s->buf != 0;
+}
+
+static void wait_done(file_writer_stream *s) {
+	while (s->done != s->submitted) {
+		vTaskDelay(1);
+	}
+}
+
+void file_writer_init(void) {
+	m_buf_free = xQueueCreate(FILE_WRITER_BUF_NUM, sizeof(uint8_t*));
+	m_job_queue = xQueueCreate(FILE_WRITER_BUF_NUM + FILE_WRITER_MAX_FILES, sizeof(fw_job));
+	m_alloc_mutex = xSemaphoreCreateMutex();
+
+	xTaskCreatePinnedToCore(writer_task, "file_writer", 3072, NULL, 7, NULL, tskNO_AFFINITY);
+}
+
+/**
+ * Initialize a stream for an open file.
+ *
+ * @param s
+ * The stream to initialize.
+ *
+ * @param f
+ * The file to write to.
+ *
+ * @param timeout_ms
+ * How long writes wait for a free buffer when all are in use. 0 drops the
+ * data right away, which is what samplers that must not block want.
+ */
+void file_writer_open(file_writer_stream *s, FILE *f, int timeout_ms) {
+	memset(s, 0, sizeof(file_writer_stream));
+	s->f = f;
+	s->timeout_ms = timeout_ms;
+}
+
+/**
+ * Copy data to the stream buffer. Full buffers are passed to the writer
+ * task, so this only blocks when all buffers are in use. Writes of up to
+ * FILE_WRITER_BUF_SIZE bytes are all or nothing, so a dropped record never
+ * leaves a partial record behind in the file.
+ *
+ * @return
+ * true on success, false if data was dropped.
+ */
+bool file_writer_write(file_writer_stream *s, const void *data, int len) {
+	const uint8_t *d = data;
+
+	while (len > 0) {
+		if (!get_buffer(s)) {
+			return false;
+		}
+
+		int now = FILE_WRITER_BUF_SIZE - s->len;
+		uint8_t *next = 0;
+
+		if (now >= len) {
+			now = len;
+		} else if (len <= FILE_WRITER_BUF_SIZE) {
+			// Get the buffer for the rest before copying anything
+			next = take_buffer(s->timeout_ms);
+			if (!next) {
+				return false;
+			}
+		}
+
+		memcpy(s->buf + s->len, d, now);
+		s->len += now;
+		d += now;
+		len -= now;
+
+		if (s->len == FILE_WRITER_BUF_SIZE) {
+			file_writer_submit(s);
+			s->buf = next;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Format directly into the stream buffer, like fprintf. Output that does
+ * not fit in one buffer is formatted on the heap and written in pieces, so
+ * it is never truncated.
+ *
+ * @return
+ * true on success, false if the output was dropped.
+ */
+bool file_writer_printf(file_writer_stream *s, const char *fmt, ...) {
+	for (;;) {
+		if (!get_buffer(s)) {
+			return false;
+		}
+
+		int left = FILE_WRITER_BUF_SIZE - s->len;
+
+		va_list args;
+		va_start(args, fmt);
+		int n = vsnprintf((char*)s->buf + s->len, left, fmt, args);
+		va_end(args);
+
+		if (n < 0) {
+			return false;
+		}
+
+		// vsnprintf needs room for the null terminator
+		if (n < left) {
+			s->len += n;
+			return true;
+		}
+
+		if (n >= FILE_WRITER_BUF_SIZE) {
+			char *tmp = malloc(n + 1);
+			if (!tmp) {
+				m_stats.drops++;
+				return false;
+			}
+
+			va_start(args, fmt);
+			vsnprintf(tmp, n + 1, fmt, args);
+			va_end(args);
+
+			bool res = file_writer_write(s, tmp, n);
+			free(tmp);
+			return res;
+		}
+
+		file_writer_submit(s);
+	}
+}
+
+/**
+ * Pass what is buffered to the writer task without waiting for it to be
+ * written.
+ */
+bool file_writer_submit(file_writer_stream *s) {
+	if (!s->buf || s->len == 0) {
+		return true;
+	}
+
+	fw_job job;
+	job.s = s;
+	job.buf = s->buf;
+	job.len = s->len;
+	job.flags = 0;
+
+	s->buf = 0;
+	s->len = 0;
+	s->submitted++;
+
+	return xQueueSend(m_job_queue, &job, portMAX_DELAY) == pdTRUE;
+}
+
+/**
+ * Wait until everything written to the stream is in the file.
+ *
+ * @param fsync
+ * Also flush the file to the card.
+ *
+ * @return
+ * false if a write failed since the last sync.
+ */
+bool file_writer_sync(file_writer_stream *s, bool fsync) {
+	file_writer_submit(s);
+
+	if (fsync) {
+		fw_job job;
+		job.s = s;
+		job.buf = 0;
+		job.len = 0;
+		job.flags = JOB_FSYNC;
+		s->submitted++;
+		xQueueSend(m_job_queue, &job, portMAX_DELAY);
+	}
+
+	wait_done(s);
+
+	bool res = !s->error;
+	s->error = false;
+	return res;
+}
+
+/**
+ * Write everything that is buffered and close the file.
+ *
+ * @return
+ * false if a write failed since the last sync.
+ */
+bool file_writer_close(file_writer_stream *s) {
+	file_writer_submit(s);
+
+	if (s->submitted != 0) {
+		fw_job job;
+		job.s = s;
+		job.buf = 0;
+		job.len = 0;
+		job.flags = JOB_FORGET;
+		s->submitted++;
+		xQueueSend(m_job_queue, &job, portMAX_DELAY);
+	}
+
+	wait_done(s);
+
+	if (s->buf) {
+		xQueueSend(m_buf_free, &s->buf, portMAX_DELAY);
+		s->buf = 0;
+	}
+
+	bool res = !s->error;
+	fclose(s->f);
+	s->f = 0;
+	return res;
+}
+
+/**
+ * Set how often files with written data are flushed to the card.
+ *
+ * @param ms
+ * Interval in milliseconds. 0 flushes after every write and a negative
+ * value only flushes on file_writer_sync.
+ */
+void file_writer_set_fsync_interval(int ms) {
+	m_fsync_interval_ms = ms;
+}
+
+int file_writer_get_fsync_interval(void) {
+	return m_fsync_interval_ms;
+}
+
+void file_writer_get_stats(file_writer_stats *stats) {
+	*stats = m_stats;
+	stats->queued = uxQueueMessagesWaiting(m_job_queue);
+}
+
+void file_writer_reset_stats(void) {
+	memset((void*)&m_stats, 0, sizeof(m_stats));
+}
@@ -0,0 +1,73 @@
+/*
+	Copyright 2026 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef MAIN_FILE_WRITER_H_
+#define MAIN_FILE_WRITER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "datatypes.h"
+
+// Settings
+#ifndef FILE_WRITER_BUF_SIZE
+#define FILE_WRITER_BUF_SIZE			4096 // Multiple of the 512 byte sector size
+#endif
+
+#ifndef FILE_WRITER_BUF_NUM
+#define FILE_WRITER_BUF_NUM				6 // Allocated on demand
+#endif
+
+#ifndef FILE_WRITER_MAX_FILES
+#define FILE_WRITER_MAX_FILES			8 // Files tracked for periodic fsync
+#endif
+
+#ifndef FILE_WRITER_FSYNC_INTERVAL_MS
+#define FILE_WRITER_FSYNC_INTERVAL_MS	2000
+#endif
+
+/*
+ * A stream collects writes to one file in a RAM buffer that is handed to
+ * the writer task when it is full or submitted. A stream must only be used
+ * from one task at a time.
+ */
+typedef struct {
+	FILE *f;
+	uint8_t *buf;
+	int len;
+	int timeout_ms;
+	uint32_t submitted;
+	volatile uint32_t done;
+	volatile bool error;
+} file_writer_stream;
+
+// Functions
+void file_writer_init(void);
+void file_writer_open(file_writer_stream *s, FILE *f, int timeout_ms);
+bool file_writer_write(file_writer_stream *s, const void *data, int len);
+bool file_writer_printf(file_writer_stream *s, const char *fmt, ...);
+bool file_writer_submit(file_writer_stream *s);
+bool file_writer_sync(file_writer_stream *s, bool fsync);
+bool file_writer_close(file_writer_stream *s);
+void file_writer_set_fsync_interval(int ms);
+int file_writer_get_fsync_interval(void);
+void file_writer_get_stats(file_writer_stats *stats);
+void file_writer_reset_stats(void);
+
+#endif /* MAIN_FILE_WRITER_H_ */
@@ -0,0 +1,473 @@
+/*
+    Copyright 2024 Joel Svensson        svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Host side benchmark runner.
+
+   Each benchmark is loaded into a freshly initialized LBM a number of
+   times. Wall time, evaluation steps, GC statistics and peak heap and
+   memory usage are reported as CSV and, optionally, JSON. The results
+   can be compared against a stored CSV baseline, in which case the
+   exit code is non-zero if a benchmark got slower than the threshold
+   allows.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "lispbm.h"
+#include "repl_exts.h"
+
+#define GC_STACK_SIZE 256
+#define PRINT_STACK_SIZE 256
+#define EXTENSION_STORAGE_SIZE 256
+#define CONSTANT_MEMORY_SIZE 32*1024
+
+#define DEFAULT_HEAP_SIZE 4096
+#define DEFAULT_NUM_RUNS  5
+#define DEFAULT_TIMEOUT   60
+#define DEFAULT_THRESHOLD 10.0
+
+#define MAX_BENCHMARKS 64
+
+#define EXIT_REGRESSION 1
+#define EXIT_ERROR      2
+
+typedef struct {
+  char     name[64];
+  unsigned runs;
+  double   wall_mean;   // seconds
+  double   wall_min;
+  double   wall_max;
+  lbm_uint eval_steps;
+  lbm_uint gc_num;
+  double   gc_time;     // us, mean per run
+  lbm_uint gc_max_pause;
+  lbm_uint peak_heap;   // cells
+  lbm_uint peak_memory; // words
+  bool     ok;
+} bench_result_t;
+
+static lbm_extension_t extensions[EXTENSION_STORAGE_SIZE];
+static lbm_uint constants_memory[CONSTANT_MEMORY_SIZE];
+static lbm_uint memory[LBM_MEMORY_SIZE_1M];
+static lbm_uint bitmap[LBM_MEMORY_BITMAP_SIZE_1M];
+static lbm_cons_t *heap_storage = NULL;
+static lbm_uint heap_size = DEFAULT_HEAP_SIZE;
+static lbm_const_heap_t const_heap;
+
+static lbm_char_channel_t string_tok;
+static lbm_string_channel_state_t string_tok_state;
+
+static pthread_t lispbm_thd;
+static bool eval_thd_running = false;
+
+static volatile lbm_cid bench_cid = -1;
+static volatile bool bench_done = false;
+static volatile bool bench_error = false;
+static struct timespec bench_end;
+
+static bench_result_t results[MAX_BENCHMARKS];
+static bench_result_t baseline[MAX_BENCHMARKS];
+
+static void *eval_thd_wrapper(void *v) {
+  (void)v;
+  lbm_run_eval();
+  return NULL;
+}
+
+static void sleep_callback(uint32_t us) {
+  struct timespec s;
+  struct timespec r;
+  s.tv_sec = 0;
+  s.tv_nsec = (long)us * 1000;
+  nanosleep(&s, &r);
+}
+
+static void critical(void) {
+  printf("CRITICAL ERROR\n");
+  exit(EXIT_ERROR);
+}
+
+static bool const_heap_write(lbm_uint ix, lbm_uint w) {
+  if (ix >= CONSTANT_MEMORY_SIZE) return false;
+  if (constants_memory[ix] != (lbm_uint)-1) {
+    return false;
+  }
+  constants_memory[ix] = w;
+  return true;
+}
+
+static void done_callback(eval_context_t *ctx) {
+  if (ctx->id == bench_cid) {
+    clock_gettime(CLOCK_MONOTONIC, &bench_end);
+    bench_error = lbm_is_error(ctx->r);
+    bench_done = true;
+  }
+}
+
+static double elapsed(struct timespec *start, struct timespec *end) {
+  return (double)(end->tv_sec - start->tv_sec) +
+    (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static bool wait_state(uint32_t state) {
+  for (int i = 0; i < 5000; i ++) {
+    if (lbm_get_eval_state() == state) return true;
+    sleep_callback(200);
+  }
+  return false;
+}
+
+// Bring up a clean LBM, the same way for every run.
+static bool init_lbm(void) {
+  if (eval_thd_running) {
+    lbm_reset_eval();
+    if (!wait_state(EVAL_CPS_STATE_RESET)) return false;
+  }
+
+  if (!lbm_init(heap_storage, heap_size,
+                memory, LBM_MEMORY_SIZE_1M,
+                bitmap, LBM_MEMORY_BITMAP_SIZE_1M,
+                GC_STACK_SIZE,
+                PRINT_STACK_SIZE,
+                extensions,
+                EXTENSION_STORAGE_SIZE)) {
+    return false;
+  }
+  if (!lbm_eval_init_events(20)) return false;
+
+  memset(constants_memory, 0xFF, CONSTANT_MEMORY_SIZE * sizeof(lbm_uint));
+  if (!lbm_const_heap_init(const_heap_write,
+                           &const_heap, constants_memory,
+                           CONSTANT_MEMORY_SIZE)) {
+    return false;
+  }
+
+  lbm_set_critical_error_callback(critical);
+  lbm_set_ctx_done_callback(done_callback);
+  lbm_set_timestamp_us_callback(timestamp);
+  lbm_set_usleep_callback(sleep_callback);
+  lbm_set_dynamic_load_callback(dynamic_loader);
+  lbm_set_printf_callback(printf);
+  set_allow_print(false);
+  init_exts();
+
+  if (!eval_thd_running) {
+    if (pthread_create(&lispbm_thd, NULL, eval_thd_wrapper, NULL)) {
+      return false;
+    }
+    eval_thd_running = true;
+  }
+
+  lbm_pause_eval();
+  return wait_state(EVAL_CPS_STATE_PAUSED);
+}
+
+static bool run_once(char *code, unsigned timeout, bench_result_t *r, double *wall) {
+  if (!init_lbm()) {
+    printf("Failed to initialize LBM\n");
+    return false;
+  }
+
+  lbm_create_string_char_channel(&string_tok_state, &string_tok, code);
+  bench_done = false;
+  bench_error = false;
+  bench_cid = lbm_load_and_eval_program(&string_tok, "bench");
+  if (bench_cid <= 0) {
+    printf("Failed to load benchmark\n");
+    return false;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  lbm_continue_eval();
+
+  unsigned waited = 0;
+  while (!bench_done) {
+    if (waited >= timeout * 10000) {
+      printf("Timeout after %u s\n", timeout);
+      return false;
+    }
+    sleep_callback(100);
+    waited ++;
+  }
+
+  lbm_pause_eval();
+  if (!wait_state(EVAL_CPS_STATE_PAUSED)) return false;
+
+  *wall = elapsed(&start, &bench_end);
+
+  lbm_heap_state_t hs;
+  lbm_get_heap_state(&hs);
+  lbm_uint peak_heap = hs.heap_size - hs.gc_least_free;
+  if (hs.num_alloc > peak_heap) peak_heap = hs.num_alloc;
+
+  r->eval_steps   = lbm_get_eval_steps();
+  r->gc_num       = hs.gc_num;
+  r->gc_time     += (double)hs.gc_time_total;
+  if (hs.gc_time_max > r->gc_max_pause) r->gc_max_pause = hs.gc_time_max;
+  if (peak_heap > r->peak_heap) r->peak_heap = peak_heap;
+  lbm_uint peak_memory = lbm_memory_num_words() - lbm_memory_least_free();
+  if (peak_memory > r->peak_memory) r->peak_memory = peak_memory;
+  return !bench_error;
+}
+
+static char *read_file(char *filename) {
+  FILE *fp = fopen(filename, "r");
+  if (!fp) return NULL;
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *buf = NULL;
+  if (size > 0) {
+    buf = calloc((size_t)size + 1, 1);
+    if (buf && fread(buf, 1, (size_t)size, fp) != (size_t)size) {
+      free(buf);
+      buf = NULL;
+    }
+  }
+  fclose(fp);
+  return buf;
+}
+
+static bool run_benchmark(char *filename, unsigned runs, unsigned timeout, bench_result_t *r) {
+  memset(r, 0, sizeof(bench_result_t));
+  char *base = strrchr(filename, '/');
+  snprintf(r->name, sizeof(r->name), "%s", base ? base + 1 : filename);
+
+  char *code = read_file(filename);
+  if (!code) {
+    printf("Cannot read %s\n", filename);
+    return false;
+  }
+
+  r->ok = true;
+  double total = 0.0;
+  for (unsigned i = 0; i < runs; i ++) {
+    double wall = 0.0;
+    if (!run_once(code, timeout, r, &wall)) {
+      r->ok = false;
+      break;
+    }
+    total += wall;
+    if (i == 0 || wall < r->wall_min) r->wall_min = wall;
+    if (wall > r->wall_max) r->wall_max = wall;
+    r->runs ++;
+  }
+  if (r->runs > 0) {
+    r->wall_mean = total / r->runs;
+    r->gc_time = r->gc_time / r->runs;
+  }
+  free(code);
+  return r->ok;
+}
+
+static const char *csv_header =
+  "File, Runs, Wall mean (s), Wall min (s), Wall max (s), Eval steps, "
+  "GC invocations, GC time (us), GC max pause (us), Peak heap (cells), "
+  "Peak memory (words), Status";
+
+static void write_csv(FILE *fp, bench_result_t *res, int n) {
+  fprintf(fp, "%s\n", csv_header);
+  for (int i = 0; i < n; i ++) {
+    bench_result_t *r = &res[i];
+    fprintf(fp, "%s, %u, %.6f, %.6f, %.6f, %"PRI_UINT", %"PRI_UINT", %.1f, %"PRI_UINT", %"PRI_UINT", %"PRI_UINT", %s\n",
+            r->name, r->runs, r->wall_mean, r->wall_min, r->wall_max,
+            r->eval_steps, r->gc_num, r->gc_time, r->gc_max_pause,
+            r->peak_heap, r->peak_memory, r->ok ? "ok" : "failed");
+  }
+}
+
+static void write_json(FILE *fp, bench_result_t *res, int n) {
+  fprintf(fp, "[\n");
+  for (int i = 0; i < n; i ++) {
+    bench_result_t *r = &res[i];
+    fprintf(fp, "  {\"file\": \"%s\", \"runs\": %u, "
+            "\"wall_mean\": %.6f, \"wall_min\": %.6f, \"wall_max\": %.6f, "
+            "\"eval_steps\": %"PRI_UINT", \"gc_num\": %"PRI_UINT", "
+            "\"gc_time_us\": %.1f, \"gc_max_pause_us\": %"PRI_UINT", "
+            "\"peak_heap_cells\": %"PRI_UINT", \"peak_memory_words\": %"PRI_UINT", "
+            "\"ok\": %s}%s\n",
+            r->name, r->runs, r->wall_mean, r->wall_min, r->wall_max,
+            r->eval_steps, r->gc_num, r->gc_time, r->gc_max_pause,
+            r->peak_heap, r->peak_memory, r->ok ? "true" : "false",
+            i < n - 1 ? "," : "");
+  }
+  fprintf(fp, "]\n");
+}
+
+// Reads a CSV file written by write_csv.
+static int read_baseline(char *filename, bench_result_t *res) {
+  FILE *fp = fopen(filename, "r");
+  if (!fp) return -1;
+  char line[512];
+  int n = 0;
+  if (!fgets(line, sizeof(line), fp)) {
+    fclose(fp);
+    return -1;
+  }
+  while (n < MAX_BENCHMARKS && fgets(line, sizeof(line), fp)) {
+    bench_result_t *r = &res[n];
+    memset(r, 0, sizeof(bench_result_t));
+    char status[16];
+    unsigned long steps, gc_num, gc_max, heap, mem;
+    int k = sscanf(line, "%63[^,], %u, %lf, %lf, %lf, %lu, %lu, %lf, %lu, %lu, %lu, %15s",
+                   r->name, &r->runs, &r->wall_mean, &r->wall_min, &r->wall_max,
+                   &steps, &gc_num, &r->gc_time, &gc_max, &heap, &mem, status);
+    if (k != 12) continue;
+    r->eval_steps = (lbm_uint)steps;
+    r->gc_num = (lbm_uint)gc_num;
+    r->gc_max_pause = (lbm_uint)gc_max;
+    r->peak_heap = (lbm_uint)heap;
+    r->peak_memory = (lbm_uint)mem;
+    r->ok = strcmp(status, "ok") == 0;
+    n ++;
+  }
+  fclose(fp);
+  return n;
+}
+
+static double change(double base, double now) {
+  if (base <= 0.0) return 0.0;
+  return 100.0 * (now - base) / base;
+}
+
+// The fastest run and the number of evaluation steps are checked against
+// the threshold. The fastest run is the least disturbed by the rest of the
+// system, and steps do not depend on the machine at all.
+static bool compare(bench_result_t *res, int n, bench_result_t *base, int base_n, double threshold) {
+  bool pass = true;
+  printf("%-32s %10s %10s %8s %12s %12s %8s\n",
+         "File", "Base (s)", "Now (s)", "Time %", "Base steps", "Now steps", "Steps %");
+  for (int i = 0; i < n; i ++) {
+    bench_result_t *b = NULL;
+    for (int j = 0; j < base_n; j ++) {
+      if (strcmp(base[j].name, res[i].name) == 0) {
+        b = &base[j];
+        break;
+      }
+    }
+    if (!b) {
+      printf("%-32s not in baseline\n", res[i].name);
+      continue;
+    }
+    double dt = change(b->wall_min, res[i].wall_min);
+    double ds = change((double)b->eval_steps, (double)res[i].eval_steps);
+    bool regressed = !res[i].ok || dt > threshold || ds > threshold;
+    printf("%-32s %10.4f %10.4f %+7.1f%% %12"PRI_UINT" %12"PRI_UINT" %+7.1f%% %s\n",
+           res[i].name, b->wall_min, res[i].wall_min, dt,
+           b->eval_steps, res[i].eval_steps, ds,
+           regressed ? "REGRESSION" : "");
+    if (regressed) pass = false;
+  }
+  return pass;
+}
+
+static void usage(char *prog) {
+  printf("Usage: %s [options] file.lisp ...\n", prog);
+  printf("  -n N     Number of runs per benchmark (default %d)\n", DEFAULT_NUM_RUNS);
+  printf("  -h N     Heap size in cells (default %d)\n", DEFAULT_HEAP_SIZE);
+  printf("  -t S     Timeout per run in seconds (default %d)\n", DEFAULT_TIMEOUT);
+  printf("  -o FILE  Write results as CSV to FILE (default stdout)\n");
+  printf("  -j FILE  Write results as JSON to FILE\n");
+  printf("  -b FILE  Compare against a CSV baseline\n");
+  printf("  -r PCT   Allowed regression in percent (default %.0f)\n", DEFAULT_THRESHOLD);
+}
+
+int main(int argc, char **argv) {
+  unsigned runs = DEFAULT_NUM_RUNS;
+  unsigned timeout = DEFAULT_TIMEOUT;
+  double threshold = DEFAULT_THRESHOLD;
+  char *csv_file = NULL;
+  char *json_file = NULL;
+  char *baseline_file = NULL;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:h:t:o:j:b:r:")) != -1) {
+    switch (c) {
+    case 'n': runs = (unsigned)atoi(optarg); break;
+    case 'h': heap_size = (lbm_uint)atoi(optarg); break;
+    case 't': timeout = (unsigned)atoi(optarg); break;
+    case 'o': csv_file = optarg; break;
+    case 'j': json_file = optarg; break;
+    case 'b': baseline_file = optarg; break;
+    case 'r': threshold = atof(optarg); break;
+    default:
+      usage(argv[0]);
+      return EXIT_ERROR;
+    }
+  }
+
+  int n = argc - optind;
+  if (n < 1 || runs < 1) {
+    usage(argv[0]);
+    return EXIT_ERROR;
+  }
+  if (n > MAX_BENCHMARKS) n = MAX_BENCHMARKS;
+
+  heap_storage = (lbm_cons_t*)malloc(sizeof(lbm_cons_t) * heap_size);
+  if (!heap_storage) return EXIT_ERROR;
+
+  bool all_ok = true;
+  for (int i = 0; i < n; i ++) {
+    char *file = argv[optind + i];
+    fprintf(stderr, "Running %s\n", file);
+    if (!run_benchmark(file, runs, timeout, &results[i])) {
+      fprintf(stderr, "Benchmark %s failed\n", file);
+      all_ok = false;
+    }
+  }
+
+  if (csv_file) {
+    FILE *fp = fopen(csv_file, "w");
+    if (!fp) return EXIT_ERROR;
+    write_csv(fp, results, n);
+    fclose(fp);
+  } else {
+    write_csv(stdout, results, n);
+  }
+
+  if (json_file) {
+    FILE *fp = fopen(json_file, "w");
+    if (!fp) return EXIT_ERROR;
+    write_json(fp, results, n);
+    fclose(fp);
+  }
+
+  int res = all_ok ? 0 : EXIT_ERROR;
+  if (baseline_file) {
+    int base_n = read_baseline(baseline_file, baseline);
+    if (base_n < 0) {
+      printf("Cannot read baseline %s\n", baseline_file);
+      return EXIT_ERROR;
+    }
+    if (!compare(results, n, baseline, base_n, threshold) && res == 0) {
+      res = EXIT_REGRESSION;
+    }
+  }
+
+  lbm_kill_eval();
+  pthread_join(lispbm_thd, NULL);
+  free(heap_storage);
+  return res;
+}
@@ -0,0 +1,35 @@
+
+(define img (img-buffer 'rgb565 320 240))
+
+(define bar (lambda (x y h color)
+  (progn
+    (img-rectangle img x y 24 100 0x202020 '(filled))
+    (img-rectangle img x (+ y (- 100 h)) 24 h color '(filled)))))
+
+(define frame (lambda (i)
+  (progn
+    (img-clear img 0x000000)
+    (img-rectangle img 0 0 320 24 0x1040a0 '(filled))
+    (img-rectangle img 4 30 312 206 0x404040 '(rounded 10))
+    ;; speed gauge
+    (img-circle img 90 130 80 0x101010 '(filled))
+    (img-arc img 90 130 76 135 45 0x30c030 '(thickness 8))
+    (img-circle img 90 130 12 0xc0c0c0 '(filled))
+    (img-triangle img 86 130 94 130 (+ 30 (mod (* i 7) 120)) 70 0xff3020 '(filled))
+    ;; battery and power bars
+    (bar 200 40 (mod (* i 13) 100) 0x30c030)
+    (bar 234 40 (mod (* i 17) 100) 0xc0a020)
+    (bar 268 40 (mod (* i 23) 100) 0xc03020)
+    ;; status lamps
+    (img-circle img 212 180 10 0x30c030 '(filled))
+    (img-circle img 246 180 10 0xc0a020 '(filled))
+    (img-circle img 280 180 10 0xc03020 '(filled))
+    (img-rectangle img 196 204 108 24 0x1040a0 '(filled) '(rounded 6))
+    (img-line img 0 236 319 236 0xffffff)
+    (img-line img 190 30 190 236 0xffffff))))
+
+(define run (lambda (i n)
+  (if (= i n) 't
+    (progn (frame i) (run (+ i 1) n)))))
+
+(run 0 200)
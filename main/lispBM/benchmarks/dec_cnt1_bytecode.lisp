@@ -0,0 +1,7 @@
+(define dec-cnt (lambda (x)
+  (if (= x 0) 0 (dec-cnt (- x 1)))
+  ))
+
+(bytecode-compile 'dec-cnt)
+
+(dec-cnt 100000)
@@ -0,0 +1,36 @@
+
+(define img (img-buffer 'rgb565 320 240))
+
+(define sprite (lambda (w h c)
+  (let ((s (img-buffer 'rgb565 w h)))
+    (progn
+      (img-clear s 0xff00ff)
+      (img-circle s (/ w 2) (/ h 2) (- (/ h 2) 1) c '(filled))
+      (img-rectangle s 2 (/ h 2) (- w 4) 4 0xffffff '(filled))
+      s))))
+
+(define ship (sprite 32 32 0x30c0f0))
+(define rock (sprite 24 24 0x806040))
+(define tile (let ((s (img-buffer 'rgb565 40 40)))
+               (progn (img-clear s 0x103010)
+                      (img-rectangle s 0 0 40 40 0x205020)
+                      s)))
+
+(define frame (lambda (i)
+  (progn
+    ;; background tiles, no transparency
+    (looprange ty 0 6
+      (looprange tx 0 8
+        (img-blit img tile (* tx 40) (* ty 40) -1)))
+    ;; sprites with a transparent color, some partly outside
+    (looprange k 0 12
+      (img-blit img rock (- (mod (* (+ i k) 29) 360) 20) (- (mod (* k 53) 260) 10) 0xff00ff))
+    (img-blit img ship (mod (* i 7) 300) 100 0xff00ff)
+    (img-blit img ship 140 (mod (* i 5) 220) 0xff00ff '(scale 1.5))
+    (img-blit img ship 240 60 0xff00ff (list 'rotate 16 16 (* i 3))))))
+
+(define run (lambda (i n)
+  (if (= i n) 't
+    (progn (frame i) (run (+ i 1) n)))))
+
+(run 0 100)
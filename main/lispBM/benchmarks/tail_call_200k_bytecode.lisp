@@ -0,0 +1,8 @@
+
+(define f (lambda (n)
+  (if (= n 0) ()
+    (f (- n 1)))))
+
+(bytecode-compile 'f)
+
+(f 200000)
@@ -1155,6 +1155,32 @@
                           
               )))
 
+(define built-in-bytecode-compile
+  (ref-entry "bytecode-compile"
+             (list
+              (para (list "`bytecode-compile` replaces the body of a globally defined function with bytecode"
+                          "that runs on a small virtual machine instead of being interpreted by the evaluator."
+                          "The form of a `bytecode-compile` application is `(bytecode-compile name)` where name is"
+                          "a quoted symbol bound to a function. The result is `t` if the function was compiled and"
+                          "`nil` if it uses something the compiler does not support, in which case it is left as it is."
+                          ))
+              (para (list "Only a subset of LispBM can be compiled: constants, variables, `quote`, `if`, `cond`, `let`, `progn`,"
+                          "`and`, `or`, arithmetic, comparisons and other built-in operations without side effects,"
+                          "and calls of the function to itself in tail position. Those calls become jumps in the bytecode."
+                          "A compiled function gives other threads a chance to run every 100 such calls."
+                          ))
+              (code '((defun sum-to (n acc) (if (= n 0) acc (sum-to (- n 1) (+ acc n))))
+                      (bytecode-compile 'sum-to)
+                      (sum-to 1000 0)
+                      ))
+              (para (list "**Note** that the tail calls of a compiled function refer to the function itself"
+                          "and not to whatever the name is bound to later."
+                          ))
+              (para (list "The code is checked every time it is run. If the bytecode in the body of the function"
+                          "has been modified into something that is not safe to run, the call fails with an `eval_error`."
+                          ))
+              end)))
+
 (define built-ins
   (section 2 "Built-in operations"
            (list 'hline
@@ -1167,6 +1193,7 @@
                  built-in-sym2u
                  built-in-u2sym
                  built-in-gc
+                 built-in-bytecode-compile
                  )))
 
 ;; Special forms
@@ -37,6 +37,17 @@
                       ))
               end)))
 
+(define num-free-blocks
+  (ref-entry "mem-num-free-blocks"
+             (list
+              (para (list "`mem-num-free-blocks` returns the number of separate free blocks"
+                          "in the LBM memory. Many free blocks together with a short"
+                          "`mem-longest-free` means that the memory is fragmented."
+                          ))
+              (code '((mem-num-free-blocks)
+                      ))
+              end)))
+
 (define memory-size
   (ref-entry "mem-size"
              (list
@@ -69,6 +80,7 @@
   (section 2 "Memory"
            (list num-free
                  longest-free
+                 num-free-blocks
                  memory-size
                  heap-state)))
 
@@ -28,6 +28,11 @@ extern "C" {
 #define GLOBAL_ENV_ROOTS 32
 #define GLOBAL_ENV_MASK  0x1F
 
+// Number of entries in the global lookup cache. Must be a power of two.
+#ifndef GLOBAL_ENV_CACHE_SIZE
+#define GLOBAL_ENV_CACHE_SIZE 64
+#endif
+
 //environment interface
 /** Initialize the global environment. This sets the global environment to NIL
  *
@@ -61,6 +66,12 @@ bool lbm_env_lookup_b(lbm_value *res, lbm_value sym, lbm_value env);
  * \return True on success or false otherwise.
  */
 bool lbm_global_env_lookup(lbm_value *res, lbm_value sym);
+/** Clear the global lookup cache. The cache refers to the key-value pairs
+ *  of the global environment and must be cleared whenever a pair is removed
+ *  from, or replaced in, the global environment. Changing the value of an
+ *  existing pair or adding new pairs does not require clearing the cache.
+ */
+void lbm_global_env_cache_clear(void);
 /** Lookup a value in from the global environment.
  *
  * \param sym The key to look for in the environment
@@ -64,9 +64,12 @@ typedef struct eval_context_s{
   lbm_value program;
   lbm_value curr_exp;
   lbm_value curr_env;
-  lbm_value *mailbox;    /* Message passing mailbox */
+  lbm_value *mailbox;    /* Message passing mailbox, a ring buffer */
   uint32_t  mailbox_size;
+  uint32_t  mailbox_head; /* Index of the oldest message */
   uint32_t  num_mail;    /* Number of messages in mailbox */
+  uint32_t  mail_scanned; /* Number of oldest messages that did not match mail_scan_pats in the receive that is in progress */
+  lbm_value mail_scan_pats;
   uint32_t  flags;
   lbm_value r;
   char *error_reason;
@@ -131,6 +134,10 @@ int lbm_eval_init(void);
  *   \param quota The new quota.
  */
 void lbm_set_eval_step_quota(uint32_t quota);
+/** Get the number of evaluation steps performed since lbm_eval_init.
+ * \return Number of evaluation steps.
+ */
+lbm_uint lbm_get_eval_steps(void);
 /** Initialize events
  * \param num_events The maximum number of unprocessed events.
  * \return true on success, false otherwise.
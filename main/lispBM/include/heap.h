@@ -33,6 +33,17 @@
 extern "C" {
 #endif
 
+// A minor GC is run when less than 1/LBM_GC_MINOR_FREE_DIV of the heap
+// is free and at least 1/LBM_GC_MINOR_YOUNG_DIV of the heap was
+// allocated since the last GC.
+#ifndef LBM_GC_MINOR_FREE_DIV
+#define LBM_GC_MINOR_FREE_DIV 8
+#endif
+
+#ifndef LBM_GC_MINOR_YOUNG_DIV
+#define LBM_GC_MINOR_YOUNG_DIV 8
+#endif
+
 /*
 Planning for a more space efficient heap representation.
 TODO: Need to find a good reference to read up on this.
@@ -226,6 +237,27 @@ typedef struct {
   lbm_uint gc_least_free;      // The smallest length of the freelist.
   lbm_uint gc_last_free;       // Number of elements on the freelist
                                // after most recent GC.
+
+  lbm_uint *gc_mark_bits;      // Mark bitmap, one bit per cell.
+  lbm_uint gc_sweep_ix;        // Next cell to sweep. Equal to heap_size
+                               // when no sweep is pending.
+  lbm_uint gc_sweep_budget;    // Cells swept per incremental step. 0 sweeps
+                               // the whole heap directly after marking.
+  lbm_uint gc_sweep_steps;     // Number of incremental sweep steps performed.
+  lbm_uint gc_time_last;       // Duration of the most recent GC pause.
+  lbm_uint gc_time_max;        // Longest GC pause.
+  lbm_uint gc_time_total;      // Sum of all GC pauses.
+
+  lbm_uint *gc_old_bits;       // Cells that survived a GC, one bit per
+                               // cell. NULL disables minor GC.
+  bool gc_minor;               // The GC being marked or swept is minor.
+  lbm_value *gc_remset;        // Old cells and arrays that were updated to
+                               // refer to young cells since the last GC.
+  lbm_uint gc_remset_num;      // Number of entries in gc_remset.
+  bool gc_remset_overflow;     // An update was not recorded, the next GC
+                               // must be a full GC.
+  lbm_uint gc_num_old;         // Number of old cells.
+  lbm_uint gc_num_minor;       // Number of minor GCs performed.
 } lbm_heap_state_t;
 
 extern lbm_heap_state_t lbm_heap_state;
@@ -290,6 +322,45 @@ static inline lbm_uint lbm_heap_num_free(void) {
   return lbm_heap_state.heap_size - lbm_heap_state.num_alloc;
 }
 
+/** Check if the sweep of the most recent GC is still in progress.
+ *
+ * \return true if there are heap cells left to sweep.
+ */
+static inline bool lbm_gc_sweep_pending(void) {
+  return lbm_heap_state.gc_sweep_ix < lbm_heap_state.heap_size;
+}
+
+/** Sweep until n cells are on the free-list or the pending sweep is done.
+ *
+ * \param n Number of cells needed on the free-list.
+ * \return true if n cells are available.
+ */
+bool lbm_gc_sweep_until(lbm_uint n);
+
+/** Check if it is time for a minor GC. That is when the heap is getting
+ *  full and enough cells were allocated since the last GC to make it
+ *  worthwhile. Only valid while no sweep is pending.
+ *
+ * \return true if a minor GC should be run.
+ */
+static inline bool lbm_gc_minor_due(void) {
+  lbm_heap_state_t *hs = &lbm_heap_state;
+  return (hs->gc_old_bits != NULL &&
+          !hs->gc_remset_overflow &&
+          hs->heap_size - hs->num_alloc < hs->heap_size / LBM_GC_MINOR_FREE_DIV &&
+          hs->num_alloc - hs->gc_num_old >= hs->heap_size / LBM_GC_MINOR_YOUNG_DIV);
+}
+
+/** Make sure that at least n cells are on the free-list, sweeping
+ *  more of the heap if a sweep is pending. Does not start a new GC.
+ *
+ * \param n Number of cells needed.
+ * \return true if n cells are available.
+ */
+static inline bool lbm_heap_ensure_free(lbm_uint n) {
+  return lbm_heap_num_free() >= n || lbm_gc_sweep_until(n);
+}
+
 /** Check how many lbm_cons_t cells are allocated.
  *
  * \return  Number of lbm_cons_t cells that are currently allocated.
@@ -590,6 +661,43 @@ void lbm_gc_mark_roots(lbm_uint *roots, lbm_uint num_roots);
  * \return 1
  */
 int lbm_gc_sweep_phase(void);
+/** Start an incremental sweep. Only the first budget cells are swept
+ *  directly, the rest of the heap is swept by lbm_gc_sweep_step,
+ *  lbm_gc_sweep_until or lbm_gc_sweep_finish. Starting a new mark
+ *  phase finishes a pending sweep first.
+ */
+void lbm_gc_sweep_start(void);
+/** Sweep at most budget cells of a pending sweep.
+ *
+ * \param budget Maximum number of cells to sweep.
+ * \return true if the sweep is done.
+ */
+bool lbm_gc_sweep_step(lbm_uint budget);
+/** Sweep the rest of the heap if a sweep is pending.
+ */
+void lbm_gc_sweep_finish(void);
+/** Start the mark phase of a GC. Cells that survived an earlier GC are
+ *  old. A minor GC treats old cells as marked and only traces young
+ *  cells, starting from the roots and from the old cells recorded by
+ *  lbm_gc_remember. Old cells are only recovered by a full GC. The
+ *  free-list must be cleared first.
+ *
+ * \param minor true for a minor GC. Falls back to a full GC if minor GC
+ *              is not available or an update was not recorded.
+ */
+void lbm_gc_mark_begin(bool minor);
+/** Record that v was stored into the cell or lisp array c. Use
+ *  lbm_heap_write_barrier rather than calling this directly.
+ *
+ * \param c Updated cons cell or lisp array.
+ * \param v Stored value.
+ */
+void lbm_gc_remember(lbm_value c, lbm_value v);
+/** Set the number of cells swept per incremental sweep step.
+ *
+ * \param budget Cells per step. 0 disables incremental sweeping.
+ */
+void lbm_gc_set_sweep_budget(lbm_uint budget);
 
 // Array functionality
 /** Allocate an bytearray in symbols and arrays memory (lispbm_memory.h)
@@ -813,6 +921,20 @@ static inline bool lbm_is_ptr(lbm_value x) {
   return (x & LBM_PTR_BIT);
 }
 
+/**
+ * Write barrier for minor GC. Must be called after storing v into an
+ * existing cons cell or lisp array c. Freshly allocated cells are young
+ * and do not need it.
+ * \param c Updated cons cell or lisp array.
+ * \param v Stored value.
+ */
+static inline void lbm_heap_write_barrier(lbm_value c, lbm_value v) {
+  if (lbm_heap_state.gc_old_bits &&
+      lbm_is_ptr(v) && !(v & LBM_PTR_TO_CONSTANT_BIT)) {
+    lbm_gc_remember(c, v);
+  }
+}
+
 /**
  * Check if a value is a Read/Writeable cons cell
  * \param x Value to check
@@ -0,0 +1,129 @@
+/*
+    Copyright 2024 Joel Svensson        svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file lbm_bytecode.h
+ *  Compiler from closures to bytecode and the virtual machine running it.
+ *
+ *  A compiled closure has the body ($bytecode params code consts) where
+ *  code is a byte array and consts is a lisp array of the constants and
+ *  global symbols the code refers to. The $bytecode special form runs the
+ *  code with the parameters loaded from the local environment.
+ *
+ *  Only a subset of LispBM can be compiled: constants, variables, quote,
+ *  if, cond, let, progn, and, or, the side-effect free fundamental
+ *  operations and calls of the closure to itself in tail position. Such
+ *  calls become jumps and the virtual machine only needs the registers
+ *  and operand stack that are reserved on the context stack on entry.
+ *
+ *  Code layout:
+ *    [num_params num_regs stack_size 0 instructions ...]
+ */
+
+#ifndef LBM_BYTECODE_H_
+#define LBM_BYTECODE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <heap.h>
+#include <eval_cps.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LBM_BC_HEADER_SIZE  4
+#define LBM_BC_MAX_CODE     512
+#define LBM_BC_MAX_CONSTS   64
+#define LBM_BC_MAX_REGS     32
+#define LBM_BC_MAX_STACK    32
+#define LBM_BC_MAX_NESTING  32
+
+#define LBM_BC_NUM_PARAMS(code)  ((code)[0])
+#define LBM_BC_NUM_REGS(code)    ((code)[1])
+#define LBM_BC_STACK_SIZE(code)  ((code)[2])
+
+// Results of lbm_bc_run
+#define LBM_BC_DONE     0  // res holds the result.
+#define LBM_BC_SUSPEND  1  // The quota ran out at a tail call. regs hold the new arguments.
+#define LBM_BC_MERROR   2  // Out of memory. Run GC and call lbm_bc_run again to retry.
+#define LBM_BC_ERROR    3  // res holds the error and err_at where it happened.
+
+typedef struct {
+  lbm_value name;
+  uint8_t   code[LBM_BC_MAX_CODE];
+  lbm_uint  code_size;
+  lbm_value consts[LBM_BC_MAX_CONSTS];
+  lbm_uint  num_consts;
+  lbm_value scope_sym[LBM_BC_MAX_REGS];
+  uint8_t   scope_reg[LBM_BC_MAX_REGS];
+  lbm_uint  scope_size;
+  lbm_uint  num_params;
+  lbm_uint  num_regs;
+  lbm_uint  depth;
+  lbm_uint  max_depth;
+  lbm_uint  nesting;
+  bool      ok;
+} lbm_bc_compiler_t;
+
+typedef struct {
+  uint8_t   *code;
+  lbm_value *consts;
+  lbm_value *regs;   // registers followed by the operand stack
+  lbm_value env;     // closure environment, searched before the global one
+  lbm_uint  pc;
+  lbm_uint  sp;      // index into regs of the first free operand slot
+  lbm_uint  quota;   // tail calls left before suspending
+  lbm_value res;
+  lbm_value err_at;
+} lbm_bc_state_t;
+
+/** Compile the body of a closure.
+ *
+ * \param c Compiler state. The result is left in the code and consts fields.
+ * \param name Global name of the closure. Tail calls to this name become jumps.
+ * \param params Parameter list of the closure.
+ * \param body Body of the closure.
+ * \return true if the closure could be compiled.
+ */
+bool lbm_bc_compile(lbm_bc_compiler_t *c, lbm_value name, lbm_value params, lbm_value body);
+/** Check that code can be run safely. Every register, constant and
+ * fundamental index must be valid, every jump must go forward to the start
+ * of an instruction, the operand stack must stay within the size in the
+ * header and the code may not run past its end. The code and constants
+ * of a compiled closure are ordinary arrays that can be modified, so this
+ * is done every time before the code is run.
+ *
+ * \param code The code, starting with the header.
+ * \param code_size Size of code in bytes.
+ * \param num_consts Number of constants available to the code.
+ * \return true if the code is safe to run.
+ */
+bool lbm_bc_verify(uint8_t *code, lbm_uint code_size, lbm_uint num_consts);
+/** Run bytecode until it returns, fails or has used up its quota of tail calls.
+ *
+ * \param s State of the virtual machine. Set pc to LBM_BC_HEADER_SIZE and
+ *          sp to the number of registers to start from the beginning.
+ *          The code must have passed lbm_bc_verify.
+ * \param ctx Context that the code runs in.
+ * \return One of LBM_BC_DONE, LBM_BC_SUSPEND, LBM_BC_MERROR or LBM_BC_ERROR.
+ */
+int lbm_bc_run(lbm_bc_state_t *s, eval_context_t *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -247,7 +247,8 @@
 #define SYM_MOVE_TO_FLASH       0x114
 #define SYM_LOOP                0x115
 #define SYM_TRAP                0x116
-#define SPECIAL_FORMS_END       0x116
+#define SYM_BYTECODE            0x117
+#define SPECIAL_FORMS_END       0x117
 
 #ifndef LBM64
 #define SPECIAL_FORMS_MASK        0xFFFFFF00
@@ -362,6 +363,7 @@
 #define SYM_SORT                  0x30014
 #define SYM_REST_ARGS             0x30015
 #define SYM_ROTATE                0x30016
+#define SYM_BYTECODE_COMPILE      0x30017
 
 #define SYMBOL_KIND(X)          ((X) >> 16)
 #define SYMBOL_KIND_SPECIAL     0
@@ -504,6 +506,8 @@
 #define ENC_SYM_REST_ARGS             ENC_SYM(SYM_REST_ARGS)
 #define ENC_SYM_ROTATE                ENC_SYM(SYM_ROTATE)
 #define ENC_SYM_TRAP                  ENC_SYM(SYM_TRAP)
+#define ENC_SYM_BYTECODE              ENC_SYM(SYM_BYTECODE)
+#define ENC_SYM_BYTECODE_COMPILE      ENC_SYM(SYM_BYTECODE_COMPILE)
 
 #define ENC_SYM_ADD           ENC_SYM(SYM_ADD)
 #define ENC_SYM_SUB           ENC_SYM(SYM_SUB)
@@ -62,6 +62,29 @@ typedef struct {
 #define UNFLATTEN_OK             0
 
 
+/** Set up the pool of flat value buffers used for events. Call after
+ * lbm_init as the pool lives in lbm_memory.
+ *
+ * \param num_bufs Number of buffers in the pool.
+ * \param buf_size Size of each buffer in bytes.
+ * \return true on success.
+ */
+bool lbm_flat_value_pool_init(lbm_uint num_bufs, lbm_uint buf_size);
+/** Start flattening into a buffer from the pool. Falls back to
+ * lbm_start_flatten if the value is too large or the pool is empty.
+ * The buffer must be released with lbm_flat_value_free_buf.
+ *
+ * \param v Flat value to set up.
+ * \param buffer_size Required buffer size in bytes.
+ * \return true on success.
+ */
+bool lbm_start_flatten_pooled(lbm_flat_value_t *v, size_t buffer_size);
+/** Release a flat value buffer, returning it to the pool if it came
+ * from there and to lbm_memory otherwise.
+ *
+ * \param buf Buffer to release.
+ */
+void lbm_flat_value_free_buf(uint8_t *buf);
 bool lbm_start_flatten(lbm_flat_value_t *v, size_t buffer_size);
 bool lbm_finish_flatten(lbm_flat_value_t *v);
 bool f_cons(lbm_flat_value_t *v);
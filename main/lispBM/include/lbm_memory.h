@@ -47,7 +47,9 @@
     0  1  2  3  4  5  6  7  8  9
   [11 00 00 00 00 10 01 11 00 00]
 
-  Favours allocation of small amounts of data.
+  Free words are kept as merged free blocks that store their size in
+  the first and last word. Blocks of 4 words or more are linked into
+  size-class bins, so an allocation does not have to scan the bitmap.
 
   Requirements:
    - Memory space is a multiple of 64Bytes.
@@ -142,10 +144,21 @@ lbm_uint lbm_memory_num_words(void);
  * \return The number of free words in the symbols and arrays memory.
  */
 lbm_uint lbm_memory_num_free(void);
+/** Smallest number of free words since lbm_memory_init.
+ *
+ * \return The low-water mark of free words in the symbols and arrays memory.
+ */
+lbm_uint lbm_memory_least_free(void);
 /** Find the length of the longest run of consecutire free indices
  *  in the LBM memory.
  */
 lbm_uint lbm_memory_longest_free(void);
+/** Number of separate free blocks in the LBM memory. Together with
+ *  lbm_memory_longest_free this gives a measure of fragmentation.
+ *
+ * \return Number of free blocks.
+ */
+lbm_uint lbm_memory_num_free_blocks(void);
 /** Allocate a number of words from the symbols and arrays memory.
  *
  * \param num_words Number of words to allocate.
@@ -21,7 +21,8 @@
  *
  *  The symbol table is implemented as a linked list in the arrays and symbols
  *  memory defined in lispbm_memory.h. So lbm_memory_init must be run before
- *  the symbol table is initialized and used.
+ *  the symbol table is initialized and used. Lookups go through a hash index
+ *  from name to symbol and a table from id to list entry for runtime symbols.
  *
  */
 
@@ -41,7 +42,8 @@ extern "C" {
 typedef void (*symrepr_name_iterator_fun)(const char *);
 
 
-/** Initialize the symbol table.
+/** Initialize the symbol table. Extensions are added to the name
+ *  index by lbm_extensions_init.
  *
  * \return 1
  */
@@ -51,6 +53,18 @@ int lbm_symrepr_init(void);
  * \param symrepr_name_iterator_fun function taking a string
  */
 void lbm_symrepr_name_iterator(symrepr_name_iterator_fun f);
+/** Add a name, id mapping that is not in the symbol list, such as an
+ *  extension, to the name lookup index.
+ *
+ * \param name Name string of the symbol. Must stay valid while the symbol exists.
+ * \param id Id of the symbol.
+ */
+void lbm_symrepr_index_symbol(char *name, lbm_uint id);
+/** Rebuild the name and id lookup indices from the special symbols, the
+ *  extension table and the symbol list. Use this if the symbol list or
+ *  the extension table has been changed without going through symrepr.
+ */
+void lbm_symrepr_rebuild_index(void);
 int lbm_add_symbol_base(char *name, lbm_uint *id, bool flash);
 /** Add a symbol to the symbol table. The symbol name string is copied to arrays and symbols memory.
  *
@@ -884,9 +884,14 @@ int main(int argc, char **argv) {
       printf("Marked: %"PRI_INT"\n", heap_state.gc_marked);
       printf("GC stack size: %"PRI_UINT"\n", lbm_get_gc_stack_size());
       printf("GC SP max: %"PRI_UINT"\n", lbm_get_gc_stack_max());
+      printf("GC sweep steps: %"PRI_UINT"\n", heap_state.gc_sweep_steps);
+      printf("GC pause last: %"PRI_UINT" us\n", heap_state.gc_time_last);
+      printf("GC pause max: %"PRI_UINT" us\n", heap_state.gc_time_max);
+      printf("Minor GC counter: %"PRI_UINT"\n", heap_state.gc_num_minor);
       printf("--(Symbol and Array memory)---------------------------------\n");
       printf("Memory size: %"PRI_UINT" Words\n", lbm_memory_num_words());
       printf("Memory free: %"PRI_UINT" Words\n", lbm_memory_num_free());
+      printf("Memory free blocks: %"PRI_UINT"\n", lbm_memory_num_free_blocks());
       printf("Allocated arrays: %"PRI_UINT"\n", heap_state.num_alloc_arrays);
       printf("Symbol table size RAM: %"PRI_UINT" Bytes\n", lbm_get_symbol_table_size());
       printf("Symbol names size RAM: %"PRI_UINT" Bytes\n", lbm_get_symbol_table_size_names());
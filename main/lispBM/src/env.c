@@ -26,10 +26,24 @@
 
 static lbm_value env_global[GLOBAL_ENV_ROOTS];
 
+// Direct mapped cache from runtime symbol to its key-value pair in the
+// global environment. The pairs are kept alive by the environment so
+// the cache is not a GC root.
+static lbm_value env_cache_key[GLOBAL_ENV_CACHE_SIZE];
+static lbm_value env_cache_binding[GLOBAL_ENV_CACHE_SIZE];
+
+void lbm_global_env_cache_clear(void) {
+  for (int i = 0; i < GLOBAL_ENV_CACHE_SIZE; i ++) {
+    env_cache_key[i] = ENC_SYM_NIL;
+    env_cache_binding[i] = ENC_SYM_NIL;
+  }
+}
+
 int lbm_init_env(void) {
   for (int i = 0; i < GLOBAL_ENV_ROOTS; i ++) {
     env_global[i] = ENC_SYM_NIL;
   }
+  lbm_global_env_cache_clear();
   return 1;
 }
 
@@ -75,6 +89,14 @@ bool lbm_env_lookup_b(lbm_value *res, lbm_value sym, lbm_value env) {
 
 bool lbm_global_env_lookup(lbm_value *res, lbm_value sym) {
   lbm_uint dec_sym = lbm_dec_sym(sym);
+  // Only runtime symbols are cached, so an empty entry (nil) never matches.
+  bool cache = dec_sym >= RUNTIME_SYMBOLS_START;
+  lbm_uint cache_ix = dec_sym & (GLOBAL_ENV_CACHE_SIZE - 1);
+  if (cache && env_cache_key[cache_ix] == sym) {
+    *res = lbm_ref_cell(env_cache_binding[cache_ix])->cdr;
+    return true;
+  }
+
   lbm_uint ix = dec_sym & GLOBAL_ENV_MASK;
   lbm_value curr = env_global[ix];
 
@@ -82,6 +104,10 @@ bool lbm_global_env_lookup(lbm_value *res, lbm_value sym) {
     lbm_value c = lbm_ref_cell(curr)->car;
     if ((lbm_ref_cell(c)->car) == sym) {
       *res = lbm_ref_cell(c)->cdr;
+      if (cache) {
+        env_cache_key[cache_ix] = sym;
+        env_cache_binding[cache_ix] = c;
+      }
       return true;
     }
     curr = lbm_ref_cell(curr)->cdr;
@@ -30,6 +30,7 @@
 #include "platform_mutex.h"
 #include "lbm_flat_value.h"
 #include "lbm_flags.h"
+#include "lbm_bytecode.h"
 
 #ifdef VISUALIZE_HEAP
 #include "heap_vis.h"
@@ -112,6 +113,9 @@ typedef enum {
 #define FB_OK             0
 #define FB_TYPE_ERROR    -1
 
+// Number of tail calls bytecode may do before it lets other contexts run.
+#define BYTECODE_TAIL_CALL_QUOTA 100
+
 const char* lbm_error_str_parse_eof = "End of parse stream.";
 const char* lbm_error_str_parse_dot = "Incorrect usage of '.'.";
 const char* lbm_error_str_parse_close = "Expected closing parenthesis.";
@@ -184,9 +188,12 @@ static lbm_value clean_cl_env_symbol = ENC_SYM_NIL;
 #endif
 
 static int gc(void);
+static int gc_incremental(void);
+static int gc_minor(void);
 static void error_ctx(lbm_value);
 static void error_at_ctx(lbm_value err_val, lbm_value at);
 static void enqueue_ctx(eval_context_queue_t *q, eval_context_t *ctx);
+static void enqueue_blocked_ctx(eval_context_t *ctx);
 static bool mailbox_add_mail(eval_context_t *ctx, lbm_value mail);
 
 // The currently executing context.
@@ -217,11 +224,16 @@ void lbm_request_gc(void) {
 
 static volatile uint32_t eval_steps_refill = EVAL_STEPS_QUOTA;
 static uint32_t eval_steps_quota = EVAL_STEPS_QUOTA;
+static lbm_uint eval_steps_total = 0;
 
 void lbm_set_eval_step_quota(uint32_t quota) {
   eval_steps_refill = quota;
 }
 
+lbm_uint lbm_get_eval_steps(void) {
+  return eval_steps_total;
+}
+
 static uint32_t          eval_cps_run_state = EVAL_CPS_STATE_DEAD;
 static volatile uint32_t eval_cps_next_state = EVAL_CPS_STATE_NONE;
 static volatile uint32_t eval_cps_next_state_arg = 0;
@@ -406,6 +418,7 @@ static bool              is_atomic = false;
 
 /* Process queues */
 static eval_context_queue_t blocked  = {NULL, NULL};
+static eval_context_queue_t sleeping = {NULL, NULL}; // ordered by wake-up time
 static eval_context_queue_t queue    = {NULL, NULL};
 
 /* one mutex for all queue operations */
@@ -450,13 +463,15 @@ static lbm_value cons_with_gc(lbm_value head, lbm_value tail, lbm_value remember
 #endif
   lbm_value res = lbm_heap_state.freelist;
   if (lbm_is_symbol_nil(res)) {
-    lbm_value roots[3] = {head, tail, remember};
-    lbm_gc_mark_roots(roots,3);
-    gc();
-    res = lbm_heap_state.freelist;
-    if (lbm_is_symbol_nil(res)) {
-      error_ctx(ENC_SYM_MERROR);
+    if (!lbm_gc_sweep_until(1)) {
+      lbm_value roots[3] = {head, tail, remember};
+      lbm_gc_mark_roots(roots,3);
+      gc_incremental();
+      if (!lbm_heap_ensure_free(1)) {
+        error_ctx(ENC_SYM_MERROR);
+      }
     }
+    res = lbm_heap_state.freelist;
   }
   lbm_uint heap_ix = lbm_dec_ptr(res);
   lbm_heap_state.freelist = lbm_heap_state.heap[heap_ix].cdr;
@@ -582,9 +597,9 @@ static lbm_value allocate_closure(lbm_value params, lbm_value body, lbm_value en
     error_ctx(ENC_SYM_MERROR);
   }
 #else
-  if (lbm_heap_num_free() < 4) {
-    gc();
-    if (lbm_heap_num_free() < 4) {
+  if (!lbm_heap_ensure_free(4)) {
+    gc_incremental();
+    if (!lbm_heap_ensure_free(4)) {
       error_ctx(ENC_SYM_MERROR);
     }
   }
@@ -613,12 +628,12 @@ static lbm_value allocate_closure(lbm_value params, lbm_value body, lbm_value en
 
 // Allocate a binding and attach it to a list (if so desired)
 static lbm_value allocate_binding(lbm_value key, lbm_value val, lbm_value the_cdr) {
-  if (lbm_heap_num_free() < 2) {
+  if (!lbm_heap_ensure_free(2)) {
     lbm_gc_mark_phase(key);
     lbm_gc_mark_phase(val);
     lbm_gc_mark_phase(the_cdr);
-    gc();
-    if (lbm_heap_num_free() < 2) {
+    gc_incremental();
+    if (!lbm_heap_ensure_free(2)) {
       error_ctx(ENC_SYM_MERROR);
     }
   }
@@ -689,7 +704,7 @@ static void block_current_ctx(uint32_t state, lbm_uint sleep_us,  bool do_cont)
   ctx_running->sleep_us = sleep_us;
   ctx_running->state  = state;
   ctx_running->app_cont = do_cont;
-  enqueue_ctx(&blocked, ctx_running);
+  enqueue_blocked_ctx(ctx_running);
   ctx_running = NULL;
 }
 
@@ -882,6 +897,7 @@ void lbm_running_iterator(ctx_fun f, void *arg1, void *arg2){
 void lbm_blocked_iterator(ctx_fun f, void *arg1, void *arg2){
   mutex_lock(&qmutex);
   queue_iterator_nm(&blocked, f, arg1, arg2);
+  queue_iterator_nm(&sleeping, f, arg1, arg2);
   mutex_unlock(&qmutex);
 }
 
@@ -905,6 +921,56 @@ static void enqueue_ctx(eval_context_queue_t *q, eval_context_t *ctx) {
   mutex_unlock(&qmutex);
 }
 
+// Time left until a sleeping context should wake up.
+// The timestamps are 32 bit and may have wrapped around.
+static lbm_uint ctx_time_left(eval_context_t *ctx, uint32_t t_now) {
+  lbm_uint t_diff = (uint32_t)(t_now - (uint32_t)ctx->timestamp);
+  return (t_diff >= ctx->sleep_us) ? 0 : ctx->sleep_us - t_diff;
+}
+
+// The sleeping queue is kept ordered by wake-up time so that waking
+// contexts up only has to look at the front of it. A new context is
+// inserted searching from the back, where contexts that sleep for
+// similar periods end up.
+static void enqueue_sleeping_nm(eval_context_t *ctx) {
+  uint32_t t_now = (uint32_t)ctx->timestamp;
+  eval_context_t *curr = sleeping.last;
+  while (curr && ctx_time_left(curr, t_now) > ctx->sleep_us) {
+    curr = curr->prev;
+  }
+  if (curr == NULL) {
+    ctx->prev = NULL;
+    ctx->next = sleeping.first;
+    if (sleeping.first) {
+      sleeping.first->prev = ctx;
+    } else {
+      sleeping.last = ctx;
+    }
+    sleeping.first = ctx;
+  } else {
+    ctx->prev = curr;
+    ctx->next = curr->next;
+    if (curr->next) {
+      curr->next->prev = ctx;
+    } else {
+      sleeping.last = ctx;
+    }
+    curr->next = ctx;
+  }
+}
+
+// Contexts that wake up by themselves after a timeout go into the
+// sleeping queue and the others into the blocked queue.
+static void enqueue_blocked_ctx(eval_context_t *ctx) {
+  mutex_lock(&qmutex);
+  if (LBM_IS_STATE_WAKE_UP_WAKABLE(ctx->state)) {
+    enqueue_sleeping_nm(ctx);
+  } else {
+    enqueue_ctx_nm(&blocked, ctx);
+  }
+  mutex_unlock(&qmutex);
+}
+
 static eval_context_t *lookup_ctx_nm(eval_context_queue_t *q, lbm_cid cid) {
   eval_context_t *curr;
   curr = q->first;
@@ -917,6 +983,18 @@ static eval_context_t *lookup_ctx_nm(eval_context_queue_t *q, lbm_cid cid) {
   return NULL;
 }
 
+// Look up a context in the blocked and the sleeping queues.
+// The queue it was found in is returned through q.
+static eval_context_t *lookup_blocked_ctx_nm(lbm_cid cid, eval_context_queue_t **q) {
+  eval_context_t *found = lookup_ctx_nm(&blocked, cid);
+  *q = &blocked;
+  if (found == NULL) {
+    found = lookup_ctx_nm(&sleeping, cid);
+    *q = &sleeping;
+  }
+  return found;
+}
+
 static bool drop_ctx_nm(eval_context_queue_t *q, eval_context_t *ctx) {
 
   bool res = false;
@@ -999,7 +1077,7 @@ void lbm_set_error_reason(char *error_str) {
 static void error_ctx_base(lbm_value err_val, bool has_at, lbm_value at, unsigned int row, unsigned int column) {
 
   if (ctx_running->flags & EVAL_CPS_CONTEXT_FLAG_TRAP) {
-    if (lbm_heap_num_free() < 3) {
+    if (!lbm_heap_ensure_free(3)) {
       gc();
     }
 
@@ -1093,7 +1171,7 @@ static eval_context_t *dequeue_ctx_nm(eval_context_queue_t *q) {
 }
 
 static void wake_up_ctxs_nm(void) {
-  lbm_uint t_now;
+  uint32_t t_now;
 
   if (timestamp_us_callback) {
     t_now = timestamp_us_callback();
@@ -1101,54 +1179,16 @@ static void wake_up_ctxs_nm(void) {
     t_now = 0;
   }
 
-  eval_context_queue_t *q = &blocked;
-  eval_context_t *curr = q->first;
-
-  while (curr != NULL) {
-    lbm_uint t_diff;
-    eval_context_t *next = curr->next;
-    if (LBM_IS_STATE_WAKE_UP_WAKABLE(curr->state)) {
-      if ( curr->timestamp > t_now) {
-        /* There was an overflow on the counter */
-#ifndef LBM64
-        t_diff = (0xFFFFFFFF - curr->timestamp) + t_now;
-#else
-        t_diff = (0xFFFFFFFFFFFFFFFF - curr->timestamp) + t_now;
-#endif
-      } else {
-        t_diff = t_now - curr->timestamp;
-      }
-
-      if (t_diff >= curr->sleep_us) {
-        eval_context_t *wake_ctx = curr;
-        if (curr == q->last) {
-          if (curr->prev) {
-            q->last = curr->prev;
-            q->last->next = NULL;
-          } else {
-            q->first = NULL;
-            q->last = NULL;
-          }
-        } else if (curr->prev == NULL) {
-          q->first = curr->next;
-          q->first->prev = NULL;
-        } else {
-          curr->prev->next = curr->next;
-          if (curr->next) {
-            curr->next->prev = curr->prev;
-          }
-        }
-        wake_ctx->next = NULL;
-        wake_ctx->prev = NULL;
-        if (LBM_IS_STATE_TIMEOUT(curr->state)) {
-          mailbox_add_mail(wake_ctx, ENC_SYM_TIMEOUT);
-          wake_ctx->r = ENC_SYM_TIMEOUT;
-        }
-        wake_ctx->state = LBM_THREAD_STATE_READY;
-        enqueue_ctx_nm(&queue, wake_ctx);
-      }
+  eval_context_t *wake_ctx;
+  while ((wake_ctx = sleeping.first) != NULL &&
+         ctx_time_left(wake_ctx, t_now) == 0) {
+    dequeue_ctx_nm(&sleeping);
+    if (LBM_IS_STATE_TIMEOUT(wake_ctx->state)) {
+      mailbox_add_mail(wake_ctx, ENC_SYM_TIMEOUT);
+      wake_ctx->r = ENC_SYM_TIMEOUT;
     }
-    curr = next;
+    wake_ctx->state = LBM_THREAD_STATE_READY;
+    enqueue_ctx_nm(&queue, wake_ctx);
   }
 }
 
@@ -1165,7 +1205,7 @@ static void yield_ctx(lbm_uint sleep_us) {
   }
   ctx_running->r = ENC_SYM_TRUE;
   ctx_running->app_cont = true;
-  enqueue_ctx(&blocked,ctx_running);
+  enqueue_blocked_ctx(ctx_running);
   ctx_running = NULL;
 }
 
@@ -1238,8 +1278,11 @@ static lbm_cid lbm_create_ctx_parent(lbm_value program, lbm_value env, lbm_uint
   ctx->error_reason = NULL;
   ctx->mailbox = mailbox;
   ctx->mailbox_size = EVAL_CPS_DEFAULT_MAILBOX_SIZE;
+  ctx->mailbox_head = 0;
   ctx->flags = context_flags;
   ctx->num_mail = 0;
+  ctx->mail_scanned = 0;
+  ctx->mail_scan_pats = ENC_SYM_NIL;
   ctx->app_cont = false;
   ctx->timestamp = 0;
   ctx->sleep_us = 0;
@@ -1275,6 +1318,13 @@ lbm_cid lbm_create_ctx(lbm_value program, lbm_value env, lbm_uint stack_size, ch
                                name);
 }
 
+// Message i, counting from the oldest.
+static inline lbm_value *mailbox_ref(eval_context_t *ctx, lbm_uint i) {
+  lbm_uint ix = ctx->mailbox_head + i;
+  if (ix >= ctx->mailbox_size) ix -= ctx->mailbox_size;
+  return &ctx->mailbox[ix];
+}
+
 bool lbm_mailbox_change_size(eval_context_t *ctx, lbm_uint new_size) {
 
   lbm_value *mailbox = NULL;
@@ -1287,21 +1337,40 @@ bool lbm_mailbox_change_size(eval_context_t *ctx, lbm_uint new_size) {
     return false;
   }
 
-  for (lbm_uint i = 0; i < ctx->num_mail; i ++ ) {
-    mailbox[i] = ctx->mailbox[i];
+  // Keep the newest messages if they do not all fit.
+  lbm_uint skip = 0;
+  if (ctx->num_mail > new_size) {
+    skip = ctx->num_mail - new_size;
+  }
+  for (lbm_uint i = skip; i < ctx->num_mail; i ++ ) {
+    mailbox[i - skip] = *mailbox_ref(ctx, i);
   }
   lbm_memory_free(ctx->mailbox);
   ctx->mailbox = mailbox;
   ctx->mailbox_size = (uint32_t)new_size;
+  ctx->mailbox_head = 0;
+  ctx->num_mail -= (uint32_t)skip;
+  ctx->mail_scanned = 0;
+  ctx->mail_scan_pats = ENC_SYM_NIL;
   return true;
 }
 
 static void mailbox_remove_mail(eval_context_t *ctx, lbm_uint ix) {
 
-  for (lbm_uint i = ix; i < ctx->num_mail-1; i ++) {
-    ctx->mailbox[i] = ctx->mailbox[i+1];
+  // Close the gap from the side with fewer messages.
+  if (ix < ctx->num_mail / 2) {
+    for (lbm_uint i = ix; i > 0; i --) {
+      *mailbox_ref(ctx, i) = *mailbox_ref(ctx, i-1);
+    }
+    ctx->mailbox_head ++;
+    if (ctx->mailbox_head >= ctx->mailbox_size) ctx->mailbox_head = 0;
+  } else {
+    for (lbm_uint i = ix; i < ctx->num_mail-1; i ++) {
+      *mailbox_ref(ctx, i) = *mailbox_ref(ctx, i+1);
+    }
   }
   ctx->num_mail --;
+  if (ix < ctx->mail_scanned) ctx->mail_scanned --;
 }
 
 static bool mailbox_add_mail(eval_context_t *ctx, lbm_value mail) {
@@ -1310,7 +1379,7 @@ static bool mailbox_add_mail(eval_context_t *ctx, lbm_value mail) {
     mailbox_remove_mail(ctx, 0);
   }
 
-  ctx->mailbox[ctx->num_mail] = mail;
+  *mailbox_ref(ctx, ctx->num_mail) = mail;
   ctx->num_mail ++;
   return true;
 }
@@ -1343,10 +1412,11 @@ bool lbm_unblock_ctx_r(lbm_cid cid) {
   mutex_lock(&blocking_extension_mutex);
   bool r = false;
   eval_context_t *found = NULL;
+  eval_context_queue_t *q;
   mutex_lock(&qmutex);
-  found = lookup_ctx_nm(&blocked, cid);
+  found = lookup_blocked_ctx_nm(cid, &q);
   if (found && (LBM_IS_STATE_UNBLOCKABLE(found->state))) {
-    drop_ctx_nm(&blocked,found);
+    drop_ctx_nm(q,found);
     found->state = LBM_THREAD_STATE_READY;
     enqueue_ctx_nm(&queue,found);
     r = true;
@@ -1361,10 +1431,11 @@ bool lbm_unblock_ctx_unboxed(lbm_cid cid, lbm_value unboxed) {
   mutex_lock(&blocking_extension_mutex);
   bool r = false;
   eval_context_t *found = NULL;
+  eval_context_queue_t *q;
   mutex_lock(&qmutex);
-  found = lookup_ctx_nm(&blocked, cid);
+  found = lookup_blocked_ctx_nm(cid, &q);
   if (found && (LBM_IS_STATE_UNBLOCKABLE(found->state))) {
-    drop_ctx_nm(&blocked,found);
+    drop_ctx_nm(q,found);
     found->r = unboxed;
     if (lbm_is_error(unboxed)) {
       get_stack_ptr(found, 1)[0] = TERMINATE; // replace TOS
@@ -1412,9 +1483,10 @@ void lbm_undo_block_ctx_from_extension(void) {
 lbm_value lbm_find_receiver_and_send(lbm_cid cid, lbm_value msg) {
   mutex_lock(&qmutex);
   eval_context_t *found = NULL;
+  eval_context_queue_t *q;
   bool found_blocked = false;
 
-  found = lookup_ctx_nm(&blocked, cid);
+  found = lookup_blocked_ctx_nm(cid, &q);
   if (found) found_blocked = true;
 
   if (found == NULL) {
@@ -1428,7 +1500,7 @@ lbm_value lbm_find_receiver_and_send(lbm_cid cid, lbm_value msg) {
     }
 
     if (found_blocked && LBM_IS_STATE_RECV(found->state)) {
-      drop_ctx_nm(&blocked,found);
+      drop_ctx_nm(q,found);
       found->state = LBM_THREAD_STATE_READY;
       enqueue_ctx_nm(&queue,found);
     }
@@ -1500,30 +1572,45 @@ static bool match(lbm_value p, lbm_value e, lbm_value *env, bool *gc) {
 // Find match is not very picky about syntax.
 // A completely malformed recv form is most likely to
 // just return no_match.
-static int find_match(lbm_value plist, lbm_value *earr, lbm_uint num, lbm_value *e, lbm_value *env) {
+// Messages before start are known not to match and are skipped.
+static int find_match(lbm_value plist, eval_context_t *ctx, lbm_uint start, lbm_value *e, lbm_value *env) {
 
   // A pattern list is a list of pattern, expression lists.
   // ( (p1 e1) (p2 e2) ... (pn en))
   lbm_value curr_p = plist;
-  int n = 0;
   bool gc = false;
-  for (int i = 0; i < (int)num; i ++ ) {
-    lbm_value curr_e = earr[i];
+  for (lbm_uint i = start; i < ctx->num_mail; i ++ ) {
+    lbm_value curr_e = *mailbox_ref(ctx, i);
+    lbm_value head_e = lbm_is_cons(curr_e) ? get_car(curr_e) : ENC_SYM_NIL;
     while (!lbm_is_symbol_nil(curr_p)) {
       lbm_value me = get_car(curr_p);
-      if (match(get_car(me), curr_e, env, &gc)) {
-        if (gc) return FM_NEED_GC;
+      lbm_value p = get_car(me);
+      curr_p = get_cdr(curr_p);
+      // Fast path for patterns keyed on a leading symbol, such as
+      // (event-can-sid (? id) (? data)).
+      if (lbm_is_cons(p)) {
+        lbm_value head_p = get_car(p);
+        if (lbm_is_symbol(head_p) &&
+            head_p != head_e &&
+            head_p != ENC_SYM_DONTCARE &&
+            head_p != ENC_SYM_MATCH_ANY) {
+          continue;
+        }
+      }
+      bool m = match(p, curr_e, env, &gc);
+      // A failed allocation can make a matching message look like a
+      // non-match, so the scan is redone after GC.
+      if (gc) return FM_NEED_GC;
+      if (m) {
         *e = get_cadr(me);
 
         if (!lbm_is_symbol_nil(get_cadr(get_cdr(me)))) {
           return FM_PATTERN_ERROR;
         }
-        return n;
+        return (int)i;
       }
-      curr_p = get_cdr(curr_p);
     }
     curr_p = plist;       /* search all patterns against next exp */
-    n ++;
   }
 
   return FM_NO_MATCH;
@@ -1535,23 +1622,41 @@ static int find_match(lbm_value plist, lbm_value *earr, lbm_uint num, lbm_value
 static void mark_context(eval_context_t *ctx, void *arg1, void *arg2) {
   (void) arg1;
   (void) arg2;
-  lbm_value roots[3] = {ctx->curr_exp, ctx->program, ctx->r };
+  lbm_value roots[4] = {ctx->curr_exp, ctx->program, ctx->r, ctx->mail_scan_pats };
   lbm_gc_mark_env(ctx->curr_env);
-  lbm_gc_mark_roots(roots, 3);
-  lbm_gc_mark_roots(ctx->mailbox, ctx->num_mail);
+  lbm_gc_mark_roots(roots, 4);
+  // The messages may wrap around the end of the mailbox.
+  lbm_uint n = ctx->mailbox_size - ctx->mailbox_head;
+  if (ctx->num_mail <= n) {
+    lbm_gc_mark_roots(&ctx->mailbox[ctx->mailbox_head], ctx->num_mail);
+  } else {
+    lbm_gc_mark_roots(&ctx->mailbox[ctx->mailbox_head], n);
+    lbm_gc_mark_roots(ctx->mailbox, ctx->num_mail - n);
+  }
   lbm_gc_mark_aux(ctx->K.data, ctx->K.sp);
 }
 
-static int gc(void) {
+// With incremental set, only the first part of the heap is swept before
+// returning and the rest is swept on allocation or between evaluation
+// quotas. This keeps the pause proportional to live data plus the sweep
+// budget rather than to the heap size.
+// A minor GC only marks cells allocated since the previous GC, see
+// lbm_gc_mark_begin.
+static int gc_run(bool incremental, bool minor) {
   if (ctx_running) {
     ctx_running->state = ctx_running->state | LBM_THREAD_STATE_GC_BIT;
   }
 
+  uint32_t t_start = timestamp_us_callback();
+
   gc_requested = false;
+  // A new mark phase needs the sweep of the previous one to be done.
+  lbm_gc_sweep_finish();
   lbm_gc_state_inc();
 
   // The freelist should generally be NIL when GC runs.
   lbm_nil_freelist();
+  lbm_gc_mark_begin(minor);
   lbm_value *env = lbm_get_global_env();
   for (int i = 0; i < GLOBAL_ENV_ROOTS; i ++) {
     lbm_gc_mark_env(env[i]);
@@ -1562,6 +1667,7 @@ static int gc(void) {
                        // while doing GC cannot possibly be good.
   queue_iterator_nm(&queue, mark_context, NULL, NULL);
   queue_iterator_nm(&blocked, mark_context, NULL, NULL);
+  queue_iterator_nm(&sleeping, mark_context, NULL, NULL);
 
   if (ctx_running) {
     mark_context(ctx_running, NULL, NULL);
@@ -1572,8 +1678,13 @@ static int gc(void) {
   heap_vis_gen_image();
 #endif
 
-  int r = lbm_gc_sweep_phase();
-  lbm_heap_new_freelist_length();
+  int r = 1;
+  if (incremental) {
+    lbm_gc_sweep_start();
+  } else {
+    r = lbm_gc_sweep_phase();
+  }
+  lbm_heap_new_gc_time(timestamp_us_callback() - t_start);
 
   if (ctx_running) {
     ctx_running->state = ctx_running->state & ~LBM_THREAD_STATE_GC_BIT;
@@ -1581,6 +1692,24 @@ static int gc(void) {
   return r;
 }
 
+static int gc(void) {
+  return gc_run(false, false);
+}
+
+// Used where GC is triggered by the free-list running out of cells.
+// The caller only needs a few cells to continue, so the sweep is left
+// pending and continued through lbm_heap_ensure_free.
+static int gc_incremental(void) {
+  return gc_run(true, false);
+}
+
+// Run between evaluation quotas, before the free-list runs out. Nothing
+// but the contexts refers to heap cells then, so no extra roots are
+// needed. A GC triggered by a failed allocation is always a full GC.
+static int gc_minor(void) {
+  return gc_run(true, true);
+}
+
 int lbm_perform_gc(void) {
   return gc();
 }
@@ -1998,6 +2127,111 @@ static void eval_trap(eval_context_t *ctx) {
   ctx->curr_exp = expr;
 }
 
+/* ($bytecode params code consts)
+ *
+ * Body of a closure compiled by bytecode-compile. The closure application
+ * has bound the parameters on top of the closure environment. The registers
+ * and operand stack of the code are reserved on the context stack.
+ */
+static void eval_bytecode(eval_context_t *ctx) {
+  lbm_value parts[4];
+  extract_n(ctx->curr_exp, parts, 4);
+  if (!lbm_is_array_r(parts[2]) || !lbm_is_lisp_array_r(parts[3])) {
+    error_ctx(ENC_SYM_EERROR);
+  }
+  lbm_array_header_t *code_arr = assume_array(parts[2]);
+  lbm_array_header_t *consts_arr = assume_array(parts[3]);
+  uint8_t *code = (uint8_t*)code_arr->data;
+  // The arrays are reachable from lisp and may have been modified.
+  if (!lbm_bc_verify(code, code_arr->size, consts_arr->size / sizeof(lbm_value))) {
+    error_ctx(ENC_SYM_EERROR);
+  }
+  lbm_value params = parts[1];
+  lbm_uint num_params = LBM_BC_NUM_PARAMS(code);
+  lbm_uint num_regs = LBM_BC_NUM_REGS(code);
+  lbm_uint n = num_regs + LBM_BC_STACK_SIZE(code);
+  lbm_value *regs = stack_reserve(ctx, (unsigned int)n);
+  for (lbm_uint i = 0; i < n; i ++) {
+    regs[i] = ENC_SYM_NIL;
+  }
+
+  lbm_value env = ctx->curr_env;
+  lbm_value curr = params;
+  for (lbm_uint i = 0; i < num_params; i ++) {
+    lbm_value p = get_car(curr);
+    if (!lbm_env_lookup_b(&regs[i], p, env)) {
+      error_at_ctx(ENC_SYM_NOT_FOUND, p);
+    }
+    curr = get_cdr(curr);
+  }
+
+  // Find the closure environment under the parameter bindings so that
+  // a suspended call does not grow the environment. If the bindings are
+  // not laid out as by a closure application, env is used as is.
+  lbm_value base = env;
+  if (get_car(get_car(base)) == ENC_SYM_REST_ARGS) {
+    base = get_cdr(base);
+  }
+  for (lbm_uint i = num_params; i > 0; i --) {
+    if (!lbm_is_cons(base) ||
+        get_car(get_car(base)) != lbm_index_list(params, (int32_t)(i - 1))) {
+      base = env;
+      break;
+    }
+    base = get_cdr(base);
+  }
+
+  lbm_bc_state_t s;
+  s.code = code;
+  s.consts = (lbm_value*)consts_arr->data;
+  s.regs = regs;
+  s.env = base;
+  s.pc = LBM_BC_HEADER_SIZE;
+  s.sp = num_regs;
+  s.quota = BYTECODE_TAIL_CALL_QUOTA;
+
+  int r = lbm_bc_run(&s, ctx);
+  while (r == LBM_BC_MERROR) {
+    // The failed instruction is run again after GC. If it fails again
+    // without anything else having been done, memory is exhausted.
+    lbm_uint pc = s.pc;
+    lbm_uint quota = s.quota;
+    gc();
+    r = lbm_bc_run(&s, ctx);
+    if (r == LBM_BC_MERROR && s.pc == pc && s.quota == quota) {
+      error_ctx(ENC_SYM_MERROR);
+    }
+  }
+
+  switch (r) {
+  case LBM_BC_DONE:
+    lbm_stack_drop(&ctx->K, n);
+    ctx->r = s.res;
+    ctx->app_cont = true;
+    break;
+  case LBM_BC_SUSPEND: {
+    // Rebind the parameters and evaluate the body again after
+    // the other contexts have had their turn.
+    if (!lbm_heap_ensure_free(2 * num_params)) {
+      gc();
+      if (!lbm_heap_ensure_free(2 * num_params)) {
+        error_ctx(ENC_SYM_MERROR);
+      }
+    }
+    lbm_value new_env = base;
+    curr = params;
+    for (lbm_uint i = 0; i < num_params; i ++) {
+      new_env = allocate_binding(get_car(curr), regs[i], new_env);
+      curr = get_cdr(curr);
+    }
+    lbm_stack_drop(&ctx->K, n);
+    ctx->curr_env = new_env;
+  } break;
+  default:
+    error_at_ctx(s.res, s.err_at);
+  }
+}
+
 // (let list-of-binding s
 //      body-exp)
 static void eval_let(eval_context_t *ctx) {
@@ -2075,8 +2309,12 @@ static void receive_base(eval_context_t *ctx, lbm_value pats, float timeout_time
        block_current_ctx(LBM_THREAD_STATE_RECV_BL,0,false);
      }
   } else {
-    lbm_value *msgs = ctx->mailbox;
-    lbm_uint  num   = ctx->num_mail;
+    // Messages that were already tried against the same
+    // patterns are not tried again.
+    lbm_uint start = 0;
+    if (pats == ctx->mail_scan_pats) {
+      start = ctx->mail_scanned;
+    }
 
     if (lbm_is_symbol_nil(pats)) {
       /* A receive statement without any patterns */
@@ -2086,11 +2324,11 @@ static void receive_base(eval_context_t *ctx, lbm_value pats, float timeout_time
       /* The common case */
       lbm_value e;
       lbm_value new_env = ctx->curr_env;
-      int n = find_match(pats, msgs, num, &e, &new_env);
+      int n = find_match(pats, ctx, start, &e, &new_env);
       if (n == FM_NEED_GC) {
         gc();
         new_env = ctx->curr_env;
-        n = find_match(pats, msgs, num, &e, &new_env);
+        n = find_match(pats, ctx, start, &e, &new_env);
         if (n == FM_NEED_GC) {
           error_ctx(ENC_SYM_MERROR);
         }
@@ -2100,9 +2338,16 @@ static void receive_base(eval_context_t *ctx, lbm_value pats, float timeout_time
         error_at_ctx(ENC_SYM_EERROR,pats);
       } else if (n >= 0 ) { /* Match */
         mailbox_remove_mail(ctx, (lbm_uint)n);
+        // The receive is done, so the cursor is not kept for the next one.
+        ctx->mail_scan_pats = ENC_SYM_NIL;
+        ctx->mail_scanned = 0;
         ctx->curr_env = new_env;
         ctx->curr_exp = e;
       } else { /* No match  go back to sleep */
+        // Only a clean scan gets here, so all messages are known not to
+        // match and are skipped when the receive is retried.
+        ctx->mail_scan_pats = pats;
+        ctx->mail_scanned = ctx->num_mail;
         ctx->r = ENC_SYM_NO_MATCH;
         if (timeout) {
           block_current_ctx(LBM_THREAD_STATE_RECV_TO,S_TO_US(timeout_time),false);
@@ -2280,20 +2525,24 @@ static void apply_read_base(lbm_value *args, lbm_uint nargs, eval_context_t *ctx
     } else {
       error_ctx(ENC_SYM_EERROR);
     }
+    lbm_value src = args[0];
     lbm_value *sptr = get_stack_ptr(ctx, 2);
 
+    // The string channel reads directly from the array, so the array
+    // is kept on the stack until reading is done.
+    sptr[0] = src;
     // If we are inside a reader, its settings are stored.
-    sptr[0] = lbm_enc_u(ctx->flags);  // flags stored.
-    sptr[1] = chan;
-    lbm_value  *rptr = stack_reserve(ctx,2);
+    sptr[1] = lbm_enc_u(ctx->flags);  // flags stored.
+    lbm_value  *rptr = stack_reserve(ctx,3);
+    rptr[0] = chan;
     if (!program && !incremental) {
-      rptr[0] = READING_EXPRESSION;
+      rptr[1] = READING_EXPRESSION;
     } else if (program && !incremental) {
-      rptr[0] = READING_PROGRAM;
+      rptr[1] = READING_PROGRAM;
     } else if (program && incremental) {
-      rptr[0] = READING_PROGRAM_INCREMENTALLY;
+      rptr[1] = READING_PROGRAM_INCREMENTALLY;
     }  // the last combo is illegal
-    rptr[1] = READ_DONE;
+    rptr[2] = READ_DONE;
 
     // Each reader starts in a fresh situation
     ctx->flags &= ~EVAL_CPS_CONTEXT_READER_FLAGS_MASK;
@@ -2648,9 +2897,10 @@ static void apply_kill(lbm_value *args, lbm_uint nargs, eval_context_t *ctx) {
     }
     mutex_lock(&qmutex);
     eval_context_t *found = NULL;
-    found = lookup_ctx_nm(&blocked, cid);
+    eval_context_queue_t *q;
+    found = lookup_blocked_ctx_nm(cid, &q);
     if (found)
-      drop_ctx_nm(&blocked, found);
+      drop_ctx_nm(q, found);
     else
       found = lookup_ctx_nm(&queue, cid);
     if (found)
@@ -2906,6 +3156,86 @@ static void apply_rotate(lbm_value *args, lbm_uint nargs, eval_context_t *ctx) {
   error_ctx(ENC_SYM_EERROR);
 }
 
+/* (bytecode-compile name)
+ *
+ * Replace the closure bound to the global name with one whose body is
+ * bytecode. Returns nil and leaves the closure as it is if the body uses
+ * something the compiler does not support.
+ */
+static void apply_bytecode_compile(lbm_value *args, lbm_uint nargs, eval_context_t *ctx) {
+  if (nargs != 1 || !lbm_is_symbol(args[0])) {
+    error_at_ctx(ENC_SYM_TERROR, ENC_SYM_BYTECODE_COMPILE);
+  }
+  lbm_value name = args[0];
+  lbm_value fun;
+  ctx->r = ENC_SYM_NIL;
+  if (lbm_global_env_lookup(&fun, name) &&
+      lbm_is_closure(fun) &&
+      get_car(get_cadr(get_cdr(fun))) != ENC_SYM_BYTECODE) {
+    lbm_value cl[3];
+    extract_n(get_cdr(fun), cl, 3);
+    // The closure may be applied under another name where the global
+    // name is bound to something else.
+    lbm_value tmp;
+    if (lbm_env_lookup_b(&tmp, name, cl[CLO_ENV])) {
+      name = ENC_SYM_NIL;
+    }
+    lbm_value *sptr = stack_reserve(ctx, 3);
+    sptr[0] = fun;
+    sptr[1] = ENC_SYM_NIL;
+    sptr[2] = ENC_SYM_NIL;
+
+    lbm_bc_compiler_t *c = (lbm_bc_compiler_t*)lbm_malloc(sizeof(lbm_bc_compiler_t));
+    if (!c) {
+      gc();
+      c = (lbm_bc_compiler_t*)lbm_malloc(sizeof(lbm_bc_compiler_t));
+      if (!c) error_ctx(ENC_SYM_MERROR);
+    }
+    if (lbm_bc_compile(c, name, cl[CLO_PARAMS], cl[CLO_BODY])) {
+      lbm_value consts;
+      if (!lbm_heap_allocate_lisp_array(&consts, c->num_consts)) {
+        gc();
+        if (!lbm_heap_allocate_lisp_array(&consts, c->num_consts)) {
+          lbm_free(c);
+          error_ctx(ENC_SYM_MERROR);
+        }
+      }
+      if (c->num_consts > 0) {
+        memcpy(assume_array(consts)->data, c->consts, c->num_consts * sizeof(lbm_value));
+      }
+      sptr[1] = consts;
+      lbm_value code;
+      if (!lbm_heap_allocate_array(&code, c->code_size)) {
+        gc();
+        if (!lbm_heap_allocate_array(&code, c->code_size)) {
+          lbm_free(c);
+          error_ctx(ENC_SYM_MERROR);
+        }
+      }
+      memcpy(assume_array(code)->data, c->code, c->code_size);
+      sptr[2] = code;
+      lbm_free(c);
+
+      lbm_value body;
+      WITH_GC(body, lbm_heap_allocate_list_init(4,
+                                                ENC_SYM_BYTECODE,
+                                                cl[CLO_PARAMS],
+                                                code,
+                                                consts));
+      sptr[1] = body;
+      lbm_value closure = allocate_closure(cl[CLO_PARAMS], body, cl[CLO_ENV]);
+      lbm_uint ix = lbm_dec_sym(args[0]) & GLOBAL_ENV_MASK;
+      lbm_env_modify_binding(lbm_get_global_env()[ix], args[0], closure);
+      ctx->r = ENC_SYM_TRUE;
+    } else {
+      lbm_free(c);
+    }
+    lbm_stack_drop(&ctx->K, 3);
+  }
+  lbm_stack_drop(&ctx->K, nargs+1);
+  ctx->app_cont = true;
+}
+
 /***************************************************/
 /* Application lookup table                        */
 
@@ -2935,6 +3265,7 @@ static const apply_fun fun_table[] =
    apply_sort,
    apply_rest_args,
    apply_rotate,
+   apply_bytecode_compile,
   };
 
 /***************************************************/
@@ -3052,12 +3383,11 @@ static void cont_closure_args_rest(eval_context_t *ctx) {
   lbm_value last    = (lbm_value)sptr[4];
   lbm_cons_t* heap = lbm_heap_state.heap;
 
-  lbm_value binding = lbm_heap_state.freelist;
-  if (binding == ENC_SYM_NIL) {
-    gc();
-    binding = lbm_heap_state.freelist;
-    if (binding == ENC_SYM_NIL) error_ctx(ENC_SYM_MERROR);
+  if (!lbm_heap_ensure_free(1)) {
+    gc_incremental();
+    if (!lbm_heap_ensure_free(1)) error_ctx(ENC_SYM_MERROR);
   }
+  lbm_value binding = lbm_heap_state.freelist;
   lbm_uint binding_ix = lbm_dec_ptr(binding);
   lbm_heap_state.freelist = heap[binding_ix].cdr;
   lbm_heap_state.num_alloc += 1;
@@ -4200,6 +4530,7 @@ static void cont_read_done(eval_context_t *ctx) {
   lbm_value f_val;
   lbm_value reader_mode;
   lbm_pop_3(&ctx->K, &reader_mode, &stream ,&f_val);
+  lbm_stack_drop(&ctx->K, 1); // source kept alive while reading
 
   uint32_t flags = lbm_dec_as_u32(f_val);
   ctx->flags &= ~EVAL_CPS_CONTEXT_READER_FLAGS_MASK;
@@ -4944,7 +5275,8 @@ static const evaluator_fun evaluators[] =
    eval_setq,
    eval_move_to_flash,
    eval_loop,
-   eval_trap
+   eval_trap,
+   eval_bytecode
   };
 
 
@@ -5039,11 +5371,12 @@ uint32_t lbm_get_eval_state(void) {
 // Not sure this is good behavior.
 static void handle_event_unblock_ctx(lbm_cid cid, lbm_value v) {
   eval_context_t *found = NULL;
+  eval_context_queue_t *q;
   mutex_lock(&qmutex);
 
-  found = lookup_ctx_nm(&blocked, cid);
+  found = lookup_blocked_ctx_nm(cid, &q);
   if (found && LBM_IS_STATE_UNBLOCKABLE(found->state)){
-    drop_ctx_nm(&blocked,found);
+    drop_ctx_nm(q,found);
     if (lbm_is_error(v)) {
       get_stack_ptr(found, 1)[0] = TERMINATE; // replace TOS
       found->app_cont = true;
@@ -5079,7 +5412,7 @@ static lbm_value get_event_value(lbm_event_t *e) {
       v = ENC_SYM_EERROR;
     }
     // Free the flat value buffer. GC is unaware of its existence.
-    lbm_free(fv.buf);
+    lbm_flat_value_free_buf(fv.buf);
   } else {
     v = (lbm_value)e->buf_ptr;
   }
@@ -5137,6 +5470,8 @@ void lbm_run_eval(void){
           is_atomic = false;
           blocked.first = NULL;
           blocked.last = NULL;
+          sleeping.first = NULL;
+          sleeping.last = NULL;
           queue.first = NULL;
           queue.last = NULL;
           ctx_running = NULL;
@@ -5151,7 +5486,7 @@ void lbm_run_eval(void){
         continue;
       case EVAL_CPS_STATE_PAUSED:
         if (eval_cps_run_state != EVAL_CPS_STATE_PAUSED) {
-          if (lbm_heap_num_free() < eval_cps_next_state_arg) {
+          if (!lbm_heap_ensure_free(eval_cps_next_state_arg)) {
             gc();
           }
           eval_cps_next_state_arg = 0;
@@ -5171,6 +5506,7 @@ void lbm_run_eval(void){
     while (true) {
       if (eval_steps_quota && ctx_running) {
         eval_steps_quota--;
+        eval_steps_total++;
         evaluation_step();
       } else {
         if (eval_cps_state_changed) break;
@@ -5178,6 +5514,10 @@ void lbm_run_eval(void){
         if (!is_atomic) {
           if (gc_requested) {
             gc();
+          } else if (lbm_gc_sweep_pending()) {
+            lbm_gc_sweep_step(lbm_heap_state.gc_sweep_budget);
+          } else if (lbm_gc_minor_due()) {
+            gc_minor();
           }
           process_events();
           mutex_lock(&qmutex);
@@ -5227,9 +5567,12 @@ int lbm_eval_init() {
 
   blocked.first = NULL;
   blocked.last = NULL;
+  sleeping.first = NULL;
+  sleeping.last = NULL;
   queue.first = NULL;
   queue.last = NULL;
   ctx_running = NULL;
+  eval_steps_total = 0;
 
   eval_cps_run_state = EVAL_CPS_STATE_RUNNING;
 
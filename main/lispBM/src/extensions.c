@@ -52,6 +52,9 @@ int lbm_extensions_init(lbm_extension_t *extension_storage, lbm_uint extension_s
   next_extension_ix = 0;
   ext_max = (lbm_uint)extension_storage_size;
 
+  // Drop extensions of an earlier table from the symbol index.
+  lbm_symrepr_rebuild_index();
+
   return 1;
 }
 
@@ -113,6 +116,7 @@ bool lbm_add_extension(char *sym_str, extension_fptr ext) {
     lbm_uint sym_ix = next_extension_ix ++;
     extension_table[sym_ix].name = sym_str;
     extension_table[sym_ix].fptr = ext;
+    lbm_symrepr_index_symbol(sym_str, EXTENSION_SYMBOLS_START + sym_ix);
     ext_num ++;
     return true;
   }
@@ -125,6 +125,8 @@ static lbm_uint symbol_repeat_type = 0;
 static lbm_uint symbol_down = 0;
 static lbm_uint symbol_up = 0;
 
+static lbm_uint symbol_full = 0;
+
 static color_format_t sym_to_color_format(lbm_value v) {
   lbm_uint s = lbm_dec_sym(v);
   if (s == symbol_indexed2) return indexed2;
@@ -163,6 +165,178 @@ static uint32_t image_dims_to_size_bytes(color_format_t fmt, uint16_t width, uin
   }
 }
 
+// Render tracking
+//
+// disp-render keeps a hash for each block of RENDER_BLOCK_W x RENDER_BLOCK_H
+// pixels of the last few images it sent. When an image of the same size,
+// format and colors is rendered at the same position again, only the
+// bounding rectangle of the blocks whose hash changed is sent. The state
+// lives here and not in the image, so writes with bufset and friends,
+// copies of images and different images rendered at the same place are
+// all picked up. A change that keeps the hash of a block the same is
+// missed, 'full is there for when that matters. The areas of the entries
+// never overlap, as a render drops every other entry it draws over.
+
+#define RENDER_TRACK_NUM 8
+#define RENDER_BLOCK_W   32
+#define RENDER_BLOCK_H   8
+
+typedef struct {
+  uint16_t x0; // inclusive, empty when x0 > x1
+  uint16_t y0;
+  uint16_t x1;
+  uint16_t y1;
+} image_rect_t;
+
+typedef struct {
+  uint32_t *hash; // NULL when the entry is unused
+  uint16_t x;
+  uint16_t y;
+  uint16_t width;
+  uint16_t height;
+  color_format_t fmt;
+  uint32_t palette;
+  uint32_t last_use;
+} render_track_t;
+
+static render_track_t render_track[RENDER_TRACK_NUM];
+static uint32_t render_track_cnt = 0;
+
+static inline void rect_clear(image_rect_t *r) {
+  r->x0 = 0xFFFF;
+  r->y0 = 0xFFFF;
+  r->x1 = 0;
+  r->y1 = 0;
+}
+
+static inline bool rect_is_empty(image_rect_t *r) {
+  return r->x0 > r->x1;
+}
+
+static inline void rect_add(image_rect_t *r, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
+  if (x0 < r->x0) r->x0 = x0;
+  if (y0 < r->y0) r->y0 = y0;
+  if (x1 > r->x1) r->x1 = x1;
+  if (y1 > r->y1) r->y1 = y1;
+}
+
+static void render_track_free(render_track_t *t) {
+  if (t->hash) {
+    lbm_free(t->hash);
+    t->hash = NULL;
+  }
+}
+
+// Forget what is on the display, for when it changes outside of disp-render.
+static void render_track_reset(void) {
+  for (int i = 0; i < RENDER_TRACK_NUM; i++) {
+    render_track_free(&render_track[i]);
+  }
+}
+
+// Drop the entries overlapping the given screen area, except keep.
+static void render_track_invalidate(uint16_t x, uint16_t y, uint16_t w, uint16_t h, render_track_t *keep) {
+  for (int i = 0; i < RENDER_TRACK_NUM; i++) {
+    render_track_t *t = &render_track[i];
+    if (t == keep || !t->hash) {
+      continue;
+    }
+    if ((uint32_t)t->x < (uint32_t)x + w && (uint32_t)x < (uint32_t)t->x + t->width &&
+        (uint32_t)t->y < (uint32_t)y + h && (uint32_t)y < (uint32_t)t->y + t->height) {
+      render_track_free(t);
+    }
+  }
+}
+
+static render_track_t *render_track_find(image_buffer_t *img, uint16_t x, uint16_t y, uint32_t palette) {
+  for (int i = 0; i < RENDER_TRACK_NUM; i++) {
+    render_track_t *t = &render_track[i];
+    if (t->hash && t->x == x && t->y == y &&
+        t->width == img->width && t->height == img->height &&
+        t->fmt == img->fmt && t->palette == palette) {
+      return t;
+    }
+  }
+  return NULL;
+}
+
+// An unused entry, or the least recently used one after freeing it.
+static render_track_t *render_track_slot(void) {
+  render_track_t *oldest = &render_track[0];
+  for (int i = 0; i < RENDER_TRACK_NUM; i++) {
+    render_track_t *t = &render_track[i];
+    if (!t->hash) {
+      return t;
+    }
+    if ((render_track_cnt - t->last_use) > (render_track_cnt - oldest->last_use)) {
+      oldest = t;
+    }
+  }
+  render_track_free(oldest);
+  return oldest;
+}
+
+static inline uint32_t hash_step(uint32_t h, uint32_t v) {
+  h ^= v;
+  h = (h << 5) | (h >> 27);
+  return h * 16777619u;
+}
+
+static uint32_t hash_bytes(uint32_t h, const uint8_t *p, uint32_t len) {
+  while (len >= 4) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    h = hash_step(h, v);
+    p += 4;
+    len -= 4;
+  }
+  while (len > 0) {
+    h = hash_step(h, *p);
+    p++;
+    len--;
+  }
+  return h;
+}
+
+static inline uint32_t render_blocks_x(image_buffer_t *img) {
+  return ((uint32_t)img->width + RENDER_BLOCK_W - 1) / RENDER_BLOCK_W;
+}
+
+static inline uint32_t render_blocks_y(image_buffer_t *img) {
+  return ((uint32_t)img->height + RENDER_BLOCK_H - 1) / RENDER_BLOCK_H;
+}
+
+// Hash every block of img into hash. For indexed formats the bytes at the
+// edges of a block are shared with the neighbours, which only means that a
+// change there marks both blocks.
+static void render_hash_blocks(image_buffer_t *img, uint32_t *hash) {
+  uint32_t bx_num = render_blocks_x(img);
+  uint32_t by_num = render_blocks_y(img);
+  uint32_t bits = (uint32_t)img->fmt;
+
+  for (uint32_t by = 0; by < by_num; by++) {
+    uint32_t *row_hash = hash + by * bx_num;
+    for (uint32_t bx = 0; bx < bx_num; bx++) {
+      row_hash[bx] = 2166136261u;
+    }
+
+    uint32_t y_end = (by + 1) * RENDER_BLOCK_H;
+    if (y_end > img->height) y_end = img->height;
+
+    for (uint32_t y = by * RENDER_BLOCK_H; y < y_end; y++) {
+      uint32_t row = y * img->width;
+      for (uint32_t bx = 0; bx < bx_num; bx++) {
+        uint32_t x0 = bx * RENDER_BLOCK_W;
+        uint32_t x1 = x0 + RENDER_BLOCK_W;
+        if (x1 > img->width) x1 = img->width;
+        uint32_t b0 = ((row + x0) * bits) / 8;
+        uint32_t b1 = ((row + x1) * bits + 7) / 8;
+        row_hash[bx] = hash_bytes(row_hash[bx], img->data + b0, b1 - b0);
+      }
+    }
+  }
+}
+
 static lbm_value image_buffer_lift(uint8_t *buf, color_format_t fmt, uint16_t width, uint16_t height) {
   lbm_value res = ENC_SYM_MERROR;
   lbm_uint size = image_dims_to_size_bytes(fmt, width, height);
@@ -268,7 +442,7 @@ static lbm_value image_buffer_allocate_dm(lbm_uint *dm, color_format_t fmt, uint
   buf[1] = (uint8_t)width;
   buf[2] = (uint8_t)(height >> 8);
   buf[3] = (uint8_t)height;
-  buf[4] = color_format_to_byte(fmt);  
+  buf[4] = color_format_to_byte(fmt);
   return res;
 }
 
@@ -290,6 +464,7 @@ static bool register_symbols(void) {
 
   res = res && lbm_add_symbol_const("thickness", &symbol_thickness);
   res = res && lbm_add_symbol_const("filled", &symbol_filled);
+  res = res && lbm_add_symbol_const("full", &symbol_full);
   res = res && lbm_add_symbol_const("rounded", &symbol_rounded);
   res = res && lbm_add_symbol_const("dotted", &symbol_dotted);
   res = res && lbm_add_symbol_const("scale", &symbol_scale);
@@ -405,12 +580,25 @@ static uint32_t  rgb565to888(uint16_t rgb) {
   return res_rgb888;
 }
 
+// Fill dst up to total bytes with copies of its first pattern_len bytes,
+// which must already be in place. Each memcpy doubles the filled part.
+static void fill_repeat(uint8_t *dst, uint32_t pattern_len, uint32_t total) {
+  uint32_t filled = pattern_len;
+  while (filled < total) {
+    uint32_t n = filled;
+    if (n > total - filled) n = total - filled;
+    memcpy(dst + filled, dst, n);
+    filled += n;
+  }
+}
+
 void image_buffer_clear(image_buffer_t *img, uint32_t cc) {
   color_format_t fmt = img->fmt;
   uint32_t w = img->width;
   uint32_t h = img->height;
   uint32_t img_size = w * h;
   uint8_t *data = img->data;
+  if (img_size == 0) return;
   switch (fmt) {
   case indexed2: {
     uint32_t bytes = (img_size / 8) + (img_size % 8 ? 1 : 0);
@@ -438,20 +626,16 @@ void image_buffer_clear(image_buffer_t *img, uint32_t cc) {
     break;
   case rgb565: {
     uint16_t c = rgb888to565(cc);
-    uint8_t *dp = (uint8_t*)data;
-    for (unsigned int i = 0; i < img_size/2; i +=2) {
-      dp[i] = (uint8_t)(c >> 8);
-      dp[i+1] = (uint8_t)c;
-    }
+    data[0] = (uint8_t)(c >> 8);
+    data[1] = (uint8_t)c;
+    fill_repeat(data, 2, img_size * 2);
   }
     break;
   case rgb888: {
-    uint8_t *dp = (uint8_t*)data;
-    for (unsigned int i = 0; i < img_size * 3; i+= 3) {
-      dp[i]   = (uint8_t)(cc >> 16);
-      dp[i+1] = (uint8_t)(cc >> 8);
-      dp[i+2] = (uint8_t)cc;
-    }
+    data[0] = (uint8_t)(cc >> 16);
+    data[1] = (uint8_t)(cc >> 8);
+    data[2] = (uint8_t)cc;
+    fill_repeat(data, 3, img_size * 3);
   }
     break;
   default:
@@ -576,15 +760,134 @@ static uint32_t getpixel(image_buffer_t* img, int x_i, int y_i) {
   return 0;
 }
 
+// Span kernels
+//
+// Fill primitives draw horizontal runs of pixels. The color is converted
+// to the pixel format once per run and the run is written with memset or
+// memcpy instead of going through putpixel for every pixel.
+
+// Color c converted to how it is stored in an image of format fmt.
+static uint32_t native_color(color_format_t fmt, uint32_t c) {
+  switch (fmt) {
+  case indexed2:  return c ? 1 : 0;
+  case indexed4:  return c & 0x3;
+  case indexed16: return c & 0xF;
+  case rgb332:    return rgb888to332(c);
+  case rgb565:    return rgb888to565(c);
+  default:        return c;
+  }
+}
+
+// Pixels pos to pos + len - 1 of an image with bpp bits per pixel.
+// Partial bytes at the ends are masked and the bytes between are set
+// with memset.
+static void fill_span_indexed(uint8_t *data, uint32_t pos, uint32_t len, uint32_t bpp, uint32_t c) {
+  uint32_t ppb = 8 / bpp;
+  uint32_t mask = ((uint32_t)1 << bpp) - 1;
+  uint32_t end = pos + len;
+
+  while ((pos % ppb) != 0 && pos < end) {
+    uint32_t shift = (ppb - 1 - (pos % ppb)) * bpp;
+    data[pos / ppb] = (uint8_t)((data[pos / ppb] & ~(mask << shift)) | (c << shift));
+    pos ++;
+  }
+
+  uint32_t bytes = (end - pos) / ppb;
+  memset(data + pos / ppb, (uint8_t)(c * (0xFF / mask)), bytes);
+  pos += bytes * ppb;
+
+  while (pos < end) {
+    uint32_t shift = (ppb - 1 - (pos % ppb)) * bpp;
+    data[pos / ppb] = (uint8_t)((data[pos / ppb] & ~(mask << shift)) | (c << shift));
+    pos ++;
+  }
+}
+
+// Fill len pixels from x, y with a color from native_color. The span
+// must be inside the image.
+static void fill_span(image_buffer_t *img, int x, int y, int len, uint32_t c) {
+  uint8_t *data = img->data;
+  uint32_t pos = (uint32_t)y * img->width + (uint32_t)x;
+  uint32_t n = (uint32_t)len;
+
+  switch (img->fmt) {
+  case indexed2:
+    fill_span_indexed(data, pos, n, 1, c);
+    break;
+  case indexed4:
+    fill_span_indexed(data, pos, n, 2, c);
+    break;
+  case indexed16:
+    fill_span_indexed(data, pos, n, 4, c);
+    break;
+  case rgb332:
+    memset(data + pos, (uint8_t)c, n);
+    break;
+  case rgb565: {
+    uint8_t *dp = data + pos * 2;
+    dp[0] = (uint8_t)(c >> 8);
+    dp[1] = (uint8_t)c;
+    fill_repeat(dp, 2, n * 2);
+  } break;
+  case rgb888: {
+    uint8_t *dp = data + pos * 3;
+    dp[0] = (uint8_t)(c >> 16);
+    dp[1] = (uint8_t)(c >> 8);
+    dp[2] = (uint8_t)c;
+    fill_repeat(dp, 3, n * 3);
+  } break;
+  default:
+    break;
+  }
+}
+
+// Clip a horizontal span to the image. Returns false if nothing is left.
+static bool clip_span(image_buffer_t *img, int *x, int y, int *len) {
+  if (y < 0 || y >= img->height) return false;
+  if (*x < 0) {
+    *len += *x;
+    *x = 0;
+  }
+  if (*x + *len > img->width) {
+    *len = img->width - *x;
+  }
+  return *len > 0;
+}
+
 static void h_line(image_buffer_t* img, int x, int y, int len, uint32_t c) {
-  for (int i = 0; i < len; i ++) {
-    putpixel(img, x+i, y, c);
+  if (clip_span(img, &x, y, &len)) {
+    fill_span(img, x, y, len, native_color(img->fmt, c));
   }
 }
 
 static void v_line(image_buffer_t* img, int x, int y, int len, uint32_t c) {
+  if (x < 0 || x >= img->width) return;
+  if (y < 0) {
+    len += y;
+    y = 0;
+  }
+  if (y + len > img->height) {
+    len = img->height - y;
+  }
+  uint32_t nc = native_color(img->fmt, c);
   for (int i = 0; i < len; i ++) {
-    putpixel(img, x, y+i, c);
+    fill_span(img, x, y + i, 1, nc);
+  }
+}
+
+static void fill_rectangle(image_buffer_t *img, int x, int y, int width, int height, uint32_t c) {
+  if (y < 0) {
+    height += y;
+    y = 0;
+  }
+  if (y + height > img->height) {
+    height = img->height - y;
+  }
+  if (height <= 0 || !clip_span(img, &x, y, &width)) return;
+
+  uint32_t nc = native_color(img->fmt, c);
+  for (int i = y; i < y + height; i ++) {
+    fill_span(img, x, i, width, nc);
   }
 }
 
@@ -629,24 +932,16 @@ static void fill_circle(image_buffer_t *img, int x, int y, int radius, uint32_t
 
   default: {
     int r_sq = radius * radius;
+    // Half width of the row, adjusted incrementally from the row above.
+    int x_r = 0;
     for (int y1 = -radius; y1 <= radius; y1++) {
-      for (int x1 = -radius; x1 <= radius; x1++) {
-        if (x1 * x1 + y1 * y1 <= r_sq) {
-          // Compute the start and end position for x axis
-          int x_left = x1;
-          while ((x1 + 1) <= radius && ((x1 + 1) * (x1 + 1) + y1 * y1) <= r_sq) {
-            x1++;
-          }
-          int x_right = x1;
-
-          // Draw line at this level y
-          int length = x_right - x_left + 1;
-          h_line(img, x + x_left, y + y1, length, color);
-
-          // Break out of innter loop for this level y
-          break;
-        }
+      while ((x_r + 1) * (x_r + 1) + y1 * y1 <= r_sq) {
+        x_r++;
       }
+      while (x_r * x_r + y1 * y1 > r_sq) {
+        x_r--;
+      }
+      h_line(img, x - x_r, y + y1, 2 * x_r + 1, color);
     }
   } break;
   }
@@ -839,9 +1134,7 @@ static void rectangle(image_buffer_t *img, int x, int y, int width, int height,
   thickness /= 2;
 
   if (fill) {
-    for (int i = y; i < (y + height);i++) {
-      h_line(img, x, i, width, color);
-    }
+    fill_rectangle(img, x, y, width, height, color);
   } else {
     if (thickness <= 0 && dot1 == 0) {
       h_line(img, x, y, width, color);
@@ -868,6 +1161,16 @@ static void rectangle(image_buffer_t *img, int x, int y, int width, int height,
 #define NMIN(a, b) ((a) < (b) ? (a) : (b))
 #define NMAX(a, b) ((a) > (b) ? (a) : (b))
 
+static bool in_triangle(int x, int y, int x0, int y0,
+                        int x1, int y1, int x2, int y2) {
+  int w0 = point_past_line(x, y, x1, y1, x2, y2);
+  int w1 = point_past_line(x, y, x2, y2, x0, y0);
+  int w2 = point_past_line(x, y, x0, y0, x1, y1);
+
+  return (w0 >= 0 && w1 >= 0 && w2 >= 0)
+    || (w0 <= 0 && w1 <= 0 && w2 <= 0);
+}
+
 static void fill_triangle(image_buffer_t *img, int x0, int y0,
                           int x1, int y1, int x2, int y2, uint32_t color) {
   int x_min = NMIN(x0, NMIN(x1, x2));
@@ -875,17 +1178,26 @@ static void fill_triangle(image_buffer_t *img, int x0, int y0,
   int y_min = NMIN(y0, NMIN(y1, y2));
   int y_max = NMAX(y0, NMAX(y1, y2));
 
+  x_min = NMAX(x_min, 0);
+  x_max = NMIN(x_max, img->width - 1);
+  y_min = NMAX(y_min, 0);
+  y_max = NMIN(y_max, img->height - 1);
+
+  uint32_t nc = native_color(img->fmt, color);
+
+  // The inside of a triangle is convex, so it is one span on each row.
+  // Search for its ends from both sides and fill what is between.
   for (int y = y_min;y <= y_max;y++) {
-    for (int x = x_min;x <= x_max;x++) {
-      int w0 = point_past_line(x, y, x1, y1, x2, y2);
-      int w1 = point_past_line(x, y, x2, y2, x0, y0);
-      int w2 = point_past_line(x, y, x0, y0, x1, y1);
-
-      if ((w0 >= 0 && w1 >= 0 && w2 >= 0)
-          || (w0 <= 0 && w1 <= 0 && w2 <= 0)) {
-        putpixel(img, x, y, color);
-      }
+    int left = x_min;
+    while (left <= x_max && !in_triangle(left, y, x0, y0, x1, y1, x2, y2)) {
+      left++;
     }
+    if (left > x_max) continue;
+    int right = x_max;
+    while (right > left && !in_triangle(right, y, x0, y0, x1, y1, x2, y2)) {
+      right--;
+    }
+    fill_span(img, left, y, right - left + 1, nc);
   }
 }
 
@@ -1716,6 +2028,141 @@ static void img_putc(image_buffer_t *img, int x, int y, uint32_t *colors, int nu
   }
 }
 
+// Color as returned by getpixel for a pixel stored as n.
+static uint32_t color_from_native(color_format_t fmt, uint32_t n) {
+  switch (fmt) {
+  case rgb332: return rgb332to888((uint8_t)n);
+  case rgb565: return rgb565to888((uint16_t)n);
+  default:     return n;
+  }
+}
+
+static inline uint32_t get_index(const uint8_t *data, uint32_t pos, int bits) {
+  uint32_t bit = pos * (uint32_t)bits;
+  return (uint32_t)(data[bit >> 3] >> (8 - bits - (int)(bit & 7))) & ((1u << bits) - 1);
+}
+
+static inline void set_index(uint8_t *data, uint32_t pos, int bits, uint32_t c) {
+  uint32_t bit = pos * (uint32_t)bits;
+  int shift = 8 - bits - (int)(bit & 7);
+  uint8_t mask = (uint8_t)(((1u << bits) - 1) << shift);
+  data[bit >> 3] = (uint8_t)((data[bit >> 3] & ~mask) | ((c << shift) & mask));
+}
+
+static inline uint32_t read_native(const uint8_t *p, int bytes) {
+  switch (bytes) {
+  case 1:  return p[0];
+  case 2:  return (uint32_t)p[0] << 8 | p[1];
+  default: return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+  }
+}
+
+// Copy len pixels of a byte aligned format, skipping the ones stored as
+// tc_native. The runs between transparent pixels are copied with memmove.
+static void blit_row_bytes(uint8_t *dst, const uint8_t *src, int len, int bytes,
+                           bool has_tc, uint32_t tc_native) {
+  if (!has_tc) {
+    memmove(dst, src, (size_t)(len * bytes));
+    return;
+  }
+
+  int run = 0;
+  for (int k = 0; k < len; k++) {
+    if (read_native(src + k * bytes, bytes) == tc_native) {
+      if (k > run) {
+        memmove(dst + run * bytes, src + run * bytes, (size_t)((k - run) * bytes));
+      }
+      run = k + 1;
+    }
+  }
+  if (len > run) {
+    memmove(dst + run * bytes, src + run * bytes, (size_t)((len - run) * bytes));
+  }
+}
+
+// Copy len indexed pixels starting at pixel dst_pos and src_pos. When both
+// start at the same position within a byte the whole bytes in the middle
+// are copied at once.
+static void blit_row_indexed(uint8_t *dst, uint32_t dst_pos, const uint8_t *src, uint32_t src_pos,
+                             int len, int bits, bool has_tc, uint32_t tc_native) {
+  uint32_t ppb = 8 / (uint32_t)bits;
+
+  if (!has_tc && (dst_pos % ppb) == (src_pos % ppb)) {
+    while (len > 0 && (dst_pos % ppb) != 0) {
+      set_index(dst, dst_pos++, bits, get_index(src, src_pos++, bits));
+      len--;
+    }
+    uint32_t n = (uint32_t)len / ppb;
+    memmove(dst + dst_pos / ppb, src + src_pos / ppb, n);
+    dst_pos += n * ppb;
+    src_pos += n * ppb;
+    len -= (int)(n * ppb);
+  }
+
+  for (; len > 0; len--) {
+    uint32_t c = get_index(src, src_pos++, bits);
+    if (!has_tc || c != tc_native) {
+      set_index(dst, dst_pos, bits, c);
+    }
+    dst_pos++;
+  }
+}
+
+// Blit without rotation or scaling. The visible part of the source is
+// worked out once and images of the same format are copied row by row
+// without converting the pixels.
+static void blit_copy(image_buffer_t *img_dest, image_buffer_t *img_src,
+                      int x, int y, int32_t transparent_color) {
+  int src_w = img_src->width;
+  int src_h = img_src->height;
+
+  int i0 = x > 0 ? x : 0;
+  int j0 = y > 0 ? y : 0;
+  int i1 = x + src_w < img_dest->width ? x + src_w : img_dest->width;
+  int j1 = y + src_h < img_dest->height ? y + src_h : img_dest->height;
+
+  if (i0 >= i1 || j0 >= j1) {
+    return;
+  }
+
+  color_format_t fmt = img_dest->fmt;
+
+  if (img_src->fmt != fmt) {
+    for (int j = j0; j < j1; j++) {
+      for (int i = i0; i < i1; i++) {
+        uint32_t p = getpixel(img_src, i - x, j - y);
+        if (p != (uint32_t) transparent_color) {
+          putpixel(img_dest, i, j, p);
+        }
+      }
+    }
+    return;
+  }
+
+  // A negative transparent color means none. Otherwise it can only match
+  // if it survives the round trip through the pixel format, like the
+  // colors getpixel returns.
+  uint32_t tc_native = native_color(fmt, (uint32_t)transparent_color);
+  bool has_tc = transparent_color >= 0 &&
+      color_from_native(fmt, tc_native) == (uint32_t)transparent_color;
+  int len = i1 - i0;
+
+  for (int j = j0; j < j1; j++) {
+    uint32_t src_pos = (uint32_t)(j - y) * (uint32_t)src_w + (uint32_t)(i0 - x);
+    uint32_t dst_pos = (uint32_t)j * img_dest->width + (uint32_t)i0;
+
+    if (fmt >= rgb332) {
+      int bytes = (int)fmt / 8;
+      blit_row_bytes(img_dest->data + dst_pos * (uint32_t)bytes,
+                     img_src->data + src_pos * (uint32_t)bytes,
+                     len, bytes, has_tc, tc_native);
+    } else {
+      blit_row_indexed(img_dest->data, dst_pos, img_src->data, src_pos,
+                       len, (int)fmt, has_tc, tc_native);
+    }
+  }
+}
+
 static void blit_rot_scale(
                            image_buffer_t *img_dest,
                            image_buffer_t *img_src,
@@ -1735,58 +2182,48 @@ static void blit_rot_scale(
   int des_x_end = (des_x_start + des_w);
   int des_y_end = (des_y_start + des_h);
 
-  if (des_x_start < 0) des_x_start = 0;
-  if (des_x_end > des_w) des_x_end = des_w;
-  if (des_y_start < 0) des_y_start = 0;
-  if (des_y_end > des_h) des_y_end = des_h;
-
   if (rot == 0.0 && scale == 1.0) {
-    if (x > 0) des_x_start += x;
-    if (y > 0) des_y_start += y;
-    if ((des_x_end - x) > src_w) des_x_end = src_w + x;
-    if ((des_y_end - y) > src_h) des_y_end = src_h + y;
-
-    for (int j = des_y_start; j < des_y_end; j++) {
-      for (int i = des_x_start; i < des_x_end; i++) {
-        int px = i - x;
-        int py = j - y;
-
-        if (px >= 0 && px < src_w && py >= 0 && py < src_h) {
-          uint32_t p = getpixel(img_src, px, py);
-
-          if (p != (uint32_t) transparent_color) {
-            putpixel(img_dest, i, j, p);
-          }
-        }
-      }
-    }
+    blit_copy(img_dest, img_src, x, y, transparent_color);
   } else if (rot == 0.0) {
-    xr *= scale;
-    yr *= scale;
-
     const int fp_scale = 1000;
 
-    int xr_i = (int)xr;
-    int yr_i = (int)yr;
     int scale_i = (int)(scale * (float) fp_scale);
+    if (scale_i == 0) {
+      return;
+    }
+
+    // Without rotation the source column only depends on the destination
+    // column and the source row on the destination row. Both grow with the
+    // destination coordinate for positive scales, so everything before
+    // the first source pixel can be skipped and the loops can stop at the
+    // last one.
+    bool grows = scale_i > 0;
+    if (grows) {
+      int skip = scale_i / fp_scale + 1;
+      if (des_x_start < x - skip) des_x_start = x - skip;
+      if (des_y_start < y - skip) des_y_start = y - skip;
+    }
 
     for (int j = des_y_start; j < des_y_end; j++) {
-      for (int i = des_x_start; i < des_x_end; i++) {
-        int px = (i - x - xr_i) * fp_scale;
-        int py = (j - y - yr_i) * fp_scale;
+      int py = ((j - y) * fp_scale) / scale_i;
+
+      if (py < 0 || py >= src_h) {
+        if (grows && py >= src_h) break;
+        continue;
+      }
 
-        px += xr_i * fp_scale;
-        py += yr_i * fp_scale;
+      for (int i = des_x_start; i < des_x_end; i++) {
+        int px = ((i - x) * fp_scale) / scale_i;
 
-        px /= scale_i;
-        py /= scale_i;
+        if (px < 0 || px >= src_w) {
+          if (grows && px >= src_w) break;
+          continue;
+        }
 
-        if (px >= 0 && px < src_w && py >= 0 && py < src_h) {
-          uint32_t p = getpixel(img_src, px, py);
+        uint32_t p = getpixel(img_src, px, py);
 
-          if (p != (uint32_t) transparent_color) {
-            putpixel(img_dest, i, j, p);
-          }
+        if (p != (uint32_t) transparent_color) {
+          putpixel(img_dest, i, j, p);
         }
       }
     }
@@ -1804,17 +2241,21 @@ static void blit_rot_scale(
     int xr_i = (int)xr;
     int yr_i = (int)yr;
     int scale_i = (int)(scale * (float) fp_scale);
+    if (scale_i == 0) {
+      return;
+    }
 
+    // The source coordinates (times scale_i) change by a constant amount
+    // for every step along a destination row.
     for (int j = des_y_start; j < des_y_end; j++) {
-      for (int i = des_x_start; i < des_x_end; i++) {
-        int px = (i - x - xr_i) * cr_i + (j - y - yr_i) * sr_i;
-        int py = -(i - x - xr_i) * sr_i + (j - y - yr_i) * cr_i;
+      int dx = des_x_start - x - xr_i;
+      int dy = j - y - yr_i;
+      int nx = dx * cr_i + dy * sr_i + xr_i * fp_scale;
+      int ny = -dx * sr_i + dy * cr_i + yr_i * fp_scale;
 
-        px += xr_i * fp_scale;
-        py += yr_i * fp_scale;
-
-        px /= scale_i;
-        py /= scale_i;
+      for (int i = des_x_start; i < des_x_end; i++, nx += cr_i, ny -= sr_i) {
+        int px = nx / scale_i;
+        int py = ny / scale_i;
 
         if (px >= 0 && px < src_w && py >= 0 && py < src_h) {
           uint32_t p = getpixel(img_src, px, py);
@@ -2682,6 +3123,7 @@ static lbm_value ext_disp_reset(lbm_value *args, lbm_uint argn) {
   }
 
   disp_reset();
+  render_track_reset();
 
   return ENC_SYM_TRUE;
 }
@@ -2707,17 +3149,79 @@ static lbm_value ext_disp_clear(lbm_value *args, lbm_uint argn) {
   }
 
   disp_clear(clear_color);
+  render_track_reset();
 
   return ENC_SYM_TRUE;
 }
 
+static uint32_t palette_hash(color_t *colors, int num) {
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < num; i++) {
+    h ^= (uint32_t)colors[i].color1;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// Render the part of img inside r. Falls back to rendering all of img if
+// there is no memory for a copy of the region.
+static bool render_region(image_buffer_t *img, image_rect_t *r, uint16_t x, uint16_t y, color_t *colors) {
+  uint16_t w = (uint16_t)(r->x1 - r->x0 + 1);
+  uint16_t h = (uint16_t)(r->y1 - r->y0 + 1);
+
+  if (w == img->width && h == img->height) {
+    return disp_render_image(img, x, y, colors);
+  }
+
+  // Renderers may look at the header through mem_base.
+  uint32_t size_bytes = image_dims_to_size_bytes(img->fmt, w, h);
+  uint8_t *buf = lbm_malloc(IMAGE_BUFFER_HEADER_SIZE + size_bytes);
+  if (!buf) {
+    return disp_render_image(img, x, y, colors);
+  }
+  buf[0] = (uint8_t)(w >> 8);
+  buf[1] = (uint8_t)w;
+  buf[2] = (uint8_t)(h >> 8);
+  buf[3] = (uint8_t)h;
+  buf[4] = color_format_to_byte(img->fmt);
+  uint8_t *data = image_buffer_data(buf);
+
+  image_buffer_t sub;
+  sub.width = w;
+  sub.height = h;
+  sub.fmt = img->fmt;
+  sub.mem_base = buf;
+  sub.data = data;
+
+  if (img->fmt >= rgb332) {
+    uint32_t bpp = (uint32_t)img->fmt / 8;
+    for (uint16_t j = 0; j < h; j++) {
+      memcpy(data + (uint32_t)j * w * bpp,
+             img->data + ((uint32_t)(r->y0 + j) * img->width + r->x0) * bpp,
+             (uint32_t)w * bpp);
+    }
+  } else {
+    memset(data, 0, size_bytes);
+    for (uint16_t j = 0; j < h; j++) {
+      for (uint16_t i = 0; i < w; i++) {
+        putpixel(&sub, i, j, getpixel(img, r->x0 + i, r->y0 + j));
+      }
+    }
+  }
+
+  bool res = disp_render_image(&sub, (uint16_t)(x + r->x0), (uint16_t)(y + r->y0), colors);
+  lbm_free(buf);
+  return res;
+}
+
 static lbm_value ext_disp_render(lbm_value *args, lbm_uint argn) {
   if (disp_render_image == NULL) {
     lbm_set_error_reason(msg_not_supported);
     return ENC_SYM_EERROR;
   }
 
-  if ((argn != 3 && argn != 4) ||
+  if (argn < 3 || argn > 5 ||
       !array_is_image_buffer(args[0]) ||
       !lbm_is_number(args[1]) ||
       !lbm_is_number(args[2])) {
@@ -2736,27 +3240,105 @@ static lbm_value ext_disp_render(lbm_value *args, lbm_uint argn) {
   color_t colors[16];
   memset(colors, 0, sizeof(color_t) * 16);
 
-  if (argn == 4 && lbm_is_list(args[3])) {
-    int i = 0;
-    lbm_value curr = args[3];
-    while (lbm_is_cons(curr) && i < 16) {
-      lbm_value arg = lbm_car(curr);
+  bool full = false;
+  bool regular = true;
+
+  for (lbm_uint a = 3; a < argn; a++) {
+    if (lbm_is_symbol(args[a]) && lbm_dec_sym(args[a]) == symbol_full) {
+      full = true;
+    } else if (lbm_is_list(args[a])) {
+      int i = 0;
+      lbm_value curr = args[a];
+      while (lbm_is_cons(curr) && i < 16) {
+        lbm_value arg = lbm_car(curr);
+
+        if (lbm_is_number(arg)) {
+          colors[i].color1 = (int)lbm_dec_as_u32(arg);
+        } else if (display_is_color(arg)) {
+          colors[i] = *((color_t*)lbm_get_custom_value(arg));
+          // Gradients depend on the screen position.
+          if (colors[i].type != COLOR_REGULAR) {
+            regular = false;
+          }
+        } else {
+          return ENC_SYM_TERROR;
+        }
 
-      if (lbm_is_number(arg)) {
-        colors[i].color1 = (int)lbm_dec_as_u32(arg);
-      } else if (display_is_color(arg)) {
-        colors[i] = *((color_t*)lbm_get_custom_value(arg));
-      } else {
-        return ENC_SYM_TERROR;
+        curr = lbm_cdr(curr);
+        i++;
       }
+    } else {
+      return ENC_SYM_TERROR;
+    }
+  }
 
-      curr = lbm_cdr(curr);
-      i++;
+  uint16_t x = (uint16_t)lbm_dec_as_u32(args[1]);
+  uint16_t y = (uint16_t)lbm_dec_as_u32(args[2]);
+  uint32_t palette = palette_hash(colors, 16);
+
+  // Gradients depend on the screen position, so their images are not
+  // tracked. If there is no memory for the hashes the image is rendered in
+  // full and not tracked either.
+  uint32_t *hash = NULL;
+  if (regular) {
+    hash = lbm_malloc(render_blocks_x(&img_buf) * render_blocks_y(&img_buf) * sizeof(uint32_t));
+    if (hash) {
+      render_hash_blocks(&img_buf, hash);
+    }
+  }
+
+  render_track_t *t = hash ? render_track_find(&img_buf, x, y, palette) : NULL;
+
+  bool render_res = true;
+  if (t && !full) {
+    uint32_t bx_num = render_blocks_x(&img_buf);
+    uint32_t by_num = render_blocks_y(&img_buf);
+    image_rect_t changed;
+    rect_clear(&changed);
+    for (uint32_t by = 0; by < by_num; by++) {
+      for (uint32_t bx = 0; bx < bx_num; bx++) {
+        uint32_t i = by * bx_num + bx;
+        if (hash[i] != t->hash[i]) {
+          uint32_t x1 = (bx + 1) * RENDER_BLOCK_W;
+          uint32_t y1 = (by + 1) * RENDER_BLOCK_H;
+          if (x1 > img_buf.width) x1 = img_buf.width;
+          if (y1 > img_buf.height) y1 = img_buf.height;
+          rect_add(&changed, (uint16_t)(bx * RENDER_BLOCK_W), (uint16_t)(by * RENDER_BLOCK_H),
+                   (uint16_t)(x1 - 1), (uint16_t)(y1 - 1));
+        }
+      }
     }
+    if (!rect_is_empty(&changed)) {
+      render_res = render_region(&img_buf, &changed, x, y, colors);
+    }
+  } else {
+    // img_buf is a stack allocated image_buffer_t.
+    render_res = disp_render_image(&img_buf, x, y, colors);
   }
 
-  // img_buf is a stack allocated image_buffer_t.
-  bool render_res = disp_render_image(&img_buf, (uint16_t)lbm_dec_as_u32(args[1]), (uint16_t)lbm_dec_as_u32(args[2]), colors);
+  render_track_invalidate(x, y, img_buf.width, img_buf.height, t);
+
+  if (render_res && hash) {
+    if (!t) {
+      t = render_track_slot();
+      t->x = x;
+      t->y = y;
+      t->width = img_buf.width;
+      t->height = img_buf.height;
+      t->fmt = img_buf.fmt;
+      t->palette = palette;
+    }
+    render_track_free(t);
+    t->hash = hash;
+    t->last_use = ++render_track_cnt;
+  } else {
+    if (t) {
+      render_track_free(t);
+    }
+    if (hash) {
+      lbm_free(hash);
+    }
+  }
 
   if (!render_res) {
     lbm_set_error_reason("Could not render image. Check if the format and location is compatible with the display.");
@@ -2839,6 +3421,7 @@ static lbm_value ext_disp_render_jpg(lbm_value *args, lbm_uint argn) {
   jd_prepare(&jd, jpg_input_func, jdwork, sz_work + IMAGE_BUFFER_HEADER_SIZE, &iodev);
   jd_decomp(&jd, jpg_output_func, 0);
   lbm_free(jdwork);
+  render_track_reset();
   return ENC_SYM_TRUE;
 }
 
@@ -2849,6 +3432,10 @@ void lbm_display_extensions_init(void) {
   disp_clear = NULL;
   disp_reset = NULL;
 
+  // Called after the LBM memory was set up again, so the old hashes are
+  // already gone.
+  memset(render_track, 0, sizeof(render_track));
+
   lbm_add_extension("img-buffer", ext_image_buffer);
   lbm_add_extension("img-buffer?", ext_is_image_buffer);
   lbm_add_extension("img-color", ext_color);
@@ -2883,4 +3470,5 @@ void lbm_display_extensions_set_callbacks(
   disp_render_image = render_image ? render_image : display_dummy_render_image;  
   disp_clear = clear ? clear : display_dummy_clear;
   disp_reset = reset ? reset : display_dummy_reset;
+  render_track_reset();
 }
@@ -34,6 +34,10 @@ static lbm_uint sym_num_gc_recovered_cells;
 static lbm_uint sym_num_gc_recovered_arrays;
 static lbm_uint sym_num_least_free;
 static lbm_uint sym_num_last_free;
+static lbm_uint sym_num_gc_sweep_steps;
+static lbm_uint sym_gc_time_last;
+static lbm_uint sym_gc_time_max;
+static lbm_uint sym_num_gc_minor;
 #endif
 
 lbm_value ext_eval_set_quota(lbm_value *args, lbm_uint argn) {
@@ -58,6 +62,13 @@ lbm_value ext_memory_longest_free(lbm_value *args, lbm_uint argn) {
   return lbm_enc_i((lbm_int)n);
 }
 
+lbm_value ext_memory_num_free_blocks(lbm_value *args, lbm_uint argn) {
+  (void)args;
+  (void)argn;
+  lbm_uint n = lbm_memory_num_free_blocks();
+  return lbm_enc_i((lbm_int)n);
+}
+
 lbm_value ext_memory_size(lbm_value *args, lbm_uint argn) {
   (void)args;
   (void)argn;
@@ -111,6 +122,14 @@ lbm_value ext_lbm_heap_state(lbm_value *args, lbm_uint argn) {
       res = lbm_enc_u(hs.gc_least_free);
     } else if (s == sym_num_last_free) {
       res = lbm_enc_u(hs.gc_last_free);
+    } else if (s == sym_num_gc_sweep_steps) {
+      res = lbm_enc_u(hs.gc_sweep_steps);
+    } else if (s == sym_gc_time_last) {
+      res = lbm_enc_u(hs.gc_time_last);
+    } else if (s == sym_gc_time_max) {
+      res = lbm_enc_u(hs.gc_time_max);
+    } else if (s == sym_num_gc_minor) {
+      res = lbm_enc_u(hs.gc_num_minor);
     } else {
       res = ENC_SYM_NIL;
     }
@@ -138,6 +157,7 @@ lbm_value ext_env_set(lbm_value *args, lbm_uint argn) {
     lbm_uint ix = lbm_dec_as_u32(args[0]) & GLOBAL_ENV_MASK;
     lbm_value *glob_env = lbm_get_global_env();
     glob_env[ix] = args[1];
+    lbm_global_env_cache_clear();
     return ENC_SYM_TRUE;
   }
   return ENC_SYM_NIL;
@@ -161,6 +181,14 @@ lbm_value ext_set_gc_stack_size(lbm_value *args, lbm_uint argn) {
   return ENC_SYM_TERROR;
 }
 
+lbm_value ext_set_gc_sweep_budget(lbm_value *args, lbm_uint argn) {
+  if (argn == 1 && lbm_is_number(args[0])) {
+    lbm_gc_set_sweep_budget(lbm_dec_as_u32(args[0]));
+    return ENC_SYM_TRUE;
+  }
+  return ENC_SYM_TERROR;
+}
+
 lbm_value ext_is_64bit(lbm_value *args, lbm_uint argn) {
   (void) args;
   (void) argn;
@@ -210,6 +238,10 @@ void lbm_runtime_extensions_init(void) {
     lbm_add_symbol_const("get-gc-num-recovered-arrays", &sym_num_gc_recovered_arrays);
     lbm_add_symbol_const("get-gc-num-least-free", &sym_num_least_free);
     lbm_add_symbol_const("get-gc-num-last-free", &sym_num_last_free);
+    lbm_add_symbol_const("get-gc-num-sweep-steps", &sym_num_gc_sweep_steps);
+    lbm_add_symbol_const("get-gc-time-last", &sym_gc_time_last);
+    lbm_add_symbol_const("get-gc-time-max", &sym_gc_time_max);
+    lbm_add_symbol_const("get-gc-num-minor", &sym_num_gc_minor);
 #endif
 
 #ifndef FULL_RTS_LIB
@@ -218,6 +250,7 @@ void lbm_runtime_extensions_init(void) {
     lbm_add_extension("set-eval-quota", ext_eval_set_quota);
     lbm_add_extension("mem-num-free", ext_memory_num_free);
     lbm_add_extension("mem-longest-free", ext_memory_longest_free);
+    lbm_add_extension("mem-num-free-blocks", ext_memory_num_free_blocks);
     lbm_add_extension("mem-size", ext_memory_size);
     lbm_add_extension("word-size", ext_memory_word_size);
     lbm_add_extension("lbm-version", ext_lbm_version);
@@ -226,6 +259,7 @@ void lbm_runtime_extensions_init(void) {
     lbm_add_extension("env-set", ext_env_set);
     lbm_add_extension("local-env-get", ext_local_env_get);
     lbm_add_extension("set-gc-stack-size", ext_set_gc_stack_size);
+    lbm_add_extension("set-gc-sweep-budget", ext_set_gc_sweep_budget);
     lbm_add_extension("is-64bit", ext_is_64bit);
     lbm_add_extension("symtab-size", ext_symbol_table_size);
     lbm_add_extension("symtab-size-flash", ext_symbol_table_size_flash);
@@ -709,6 +709,7 @@ static lbm_value fundamental_undefine(lbm_value *args, lbm_uint nargs, eval_cont
       return ENC_SYM_NIL;
     }
     global_env[ix_key] = res;
+    lbm_global_env_cache_clear();
     return ENC_SYM_TRUE;
   } else if (nargs == 1 && lbm_is_cons(args[0])) {
     lbm_value curr = args[0];
@@ -722,6 +723,7 @@ static lbm_value fundamental_undefine(lbm_value *args, lbm_uint nargs, eval_cont
       }
       curr = lbm_cdr(curr);
     }
+    lbm_global_env_cache_clear();
     return ENC_SYM_TRUE;
   }
   return ENC_SYM_TERROR;
@@ -852,6 +854,7 @@ static lbm_value fundamental_set_ix(lbm_value *args, lbm_uint nargs, eval_contex
       lbm_uint size = header->size / sizeof(lbm_value);
       if (index < size) {
         arrdata[index] = val;
+        lbm_heap_write_barrier(args[0], val);
         result = args[0];
       }  // index out of range will be eval error.
     }
@@ -1247,7 +1250,7 @@ static lbm_value fundamental_range(lbm_value *args, lbm_uint nargs, eval_context
 
   int num = end - start;
 
-  if ((unsigned int)num > lbm_heap_num_free()) {
+  if (!lbm_heap_ensure_free((lbm_uint)num)) {
     return ENC_SYM_MERROR;
   }
 
@@ -36,16 +36,60 @@
 #endif
 
 
-static inline lbm_value lbm_set_gc_mark(lbm_value x) {
-  return x | LBM_GC_MARKED;
+#ifndef LBM_GC_SWEEP_BUDGET
+#define LBM_GC_SWEEP_BUDGET 256
+#endif
+
+#ifndef LBM_GC_REMSET_SIZE
+#define LBM_GC_REMSET_SIZE 64
+#endif
+
+#define GC_MARK_WORD_BITS (sizeof(lbm_uint) * 8)
+#define GC_MARK_WORDS(n)  (((n) + GC_MARK_WORD_BITS - 1) / GC_MARK_WORD_BITS)
+
+// GC marks are kept in a bitmap indexed by heap cell rather than in the
+// cdr, so that live cells that are not yet swept can be used as normal
+// while a sweep is pending. If there is no room for the bitmap, marks
+// are kept in the cdr and the sweep is never incremental.
+static inline void lbm_set_gc_mark(lbm_uint ix) {
+  if (lbm_heap_state.gc_mark_bits) {
+    lbm_heap_state.gc_mark_bits[ix / GC_MARK_WORD_BITS] |= (lbm_uint)1 << (ix % GC_MARK_WORD_BITS);
+  } else {
+    lbm_heap_state.heap[ix].cdr |= LBM_GC_MARKED;
+  }
 }
 
-static inline lbm_value lbm_clr_gc_mark(lbm_value x) {
-  return x & ~LBM_GC_MASK;
+static inline void lbm_clr_gc_mark(lbm_uint ix) {
+  if (lbm_heap_state.gc_mark_bits) {
+    lbm_heap_state.gc_mark_bits[ix / GC_MARK_WORD_BITS] &= ~((lbm_uint)1 << (ix % GC_MARK_WORD_BITS));
+  } else {
+    lbm_heap_state.heap[ix].cdr &= ~LBM_GC_MASK;
+  }
+}
+
+static inline bool lbm_get_gc_mark(lbm_uint ix) {
+  if (lbm_heap_state.gc_mark_bits) {
+    return lbm_heap_state.gc_mark_bits[ix / GC_MARK_WORD_BITS] & ((lbm_uint)1 << (ix % GC_MARK_WORD_BITS));
+  }
+  return lbm_heap_state.heap[ix].cdr & LBM_GC_MASK;
+}
+
+// Old bits are only used together with the mark bitmap.
+static inline void gc_set_old(lbm_uint ix) {
+  lbm_heap_state.gc_old_bits[ix / GC_MARK_WORD_BITS] |= (lbm_uint)1 << (ix % GC_MARK_WORD_BITS);
+}
+
+static inline void gc_clr_old(lbm_uint ix) {
+  lbm_heap_state.gc_old_bits[ix / GC_MARK_WORD_BITS] &= ~((lbm_uint)1 << (ix % GC_MARK_WORD_BITS));
+}
+
+static inline bool gc_get_old(lbm_uint ix) {
+  return lbm_heap_state.gc_old_bits[ix / GC_MARK_WORD_BITS] & ((lbm_uint)1 << (ix % GC_MARK_WORD_BITS));
 }
 
-static inline bool lbm_get_gc_mark(lbm_value x) {
-  return x & LBM_GC_MASK;
+// During a minor GC old cells count as marked, so tracing stops there.
+static inline bool gc_is_marked(lbm_uint ix) {
+  return lbm_get_gc_mark(ix) || (lbm_heap_state.gc_minor && gc_get_old(ix));
 }
 
 // flag is the same bit as mark, but in car
@@ -511,7 +555,10 @@ void lbm_nil_freelist(void) {
 }
 
 static void heap_init_state(lbm_cons_t *addr, lbm_uint num_cells,
-                            lbm_uint* gc_stack_storage, lbm_uint gc_stack_size) {
+                            lbm_uint* gc_stack_storage, lbm_uint gc_stack_size,
+                            lbm_uint *gc_mark_bits,
+                            lbm_uint *gc_old_bits,
+                            lbm_value *gc_remset) {
   lbm_heap_state.heap         = addr;
   lbm_heap_state.heap_bytes   = (unsigned int)(num_cells * sizeof(lbm_cons_t));
   lbm_heap_state.heap_size    = num_cells;
@@ -526,6 +573,35 @@ static void heap_init_state(lbm_cons_t *addr, lbm_uint num_cells,
   lbm_heap_state.gc_recovered_arrays = 0;
   lbm_heap_state.gc_least_free       = num_cells;
   lbm_heap_state.gc_last_free        = num_cells;
+
+  lbm_heap_state.gc_mark_bits        = gc_mark_bits;
+  lbm_heap_state.gc_sweep_ix         = num_cells;
+  lbm_heap_state.gc_sweep_budget     = gc_mark_bits ? LBM_GC_SWEEP_BUDGET : 0;
+  lbm_heap_state.gc_sweep_steps      = 0;
+  lbm_heap_state.gc_time_last        = 0;
+  lbm_heap_state.gc_time_max         = 0;
+  lbm_heap_state.gc_time_total       = 0;
+  if (gc_mark_bits) {
+    memset(gc_mark_bits, 0, GC_MARK_WORDS(num_cells) * sizeof(lbm_uint));
+  }
+
+  lbm_heap_state.gc_old_bits         = gc_old_bits;
+  lbm_heap_state.gc_minor            = false;
+  lbm_heap_state.gc_remset           = gc_remset;
+  lbm_heap_state.gc_remset_num       = 0;
+  lbm_heap_state.gc_remset_overflow  = false;
+  lbm_heap_state.gc_num_old          = 0;
+  lbm_heap_state.gc_num_minor        = 0;
+  if (gc_old_bits) {
+    memset(gc_old_bits, 0, GC_MARK_WORDS(num_cells) * sizeof(lbm_uint));
+  }
+}
+
+void lbm_heap_new_gc_time(lbm_uint dur) {
+  lbm_heap_state.gc_time_last = dur;
+  lbm_heap_state.gc_time_total += dur;
+  if (dur > lbm_heap_state.gc_time_max)
+    lbm_heap_state.gc_time_max = dur;
 }
 
 void lbm_heap_new_freelist_length(void) {
@@ -545,8 +621,27 @@ int lbm_heap_init(lbm_cons_t *addr, lbm_uint num_cells,
   lbm_uint *gc_stack_storage = (lbm_uint*)lbm_malloc(gc_stack_size * sizeof(lbm_uint));
   if (gc_stack_storage == NULL) return 0;
 
+  // NULL is fine here, marks are then kept in the cells.
+  lbm_uint *gc_mark_bits = (lbm_uint*)lbm_malloc(GC_MARK_WORDS(num_cells) * sizeof(lbm_uint));
+
+  // Minor GC needs the mark bitmap, an old bitmap and a remembered set.
+  // Without them every GC is a full GC.
+  lbm_uint *gc_old_bits = NULL;
+  lbm_value *gc_remset = NULL;
+  if (gc_mark_bits) {
+    gc_old_bits = (lbm_uint*)lbm_malloc(GC_MARK_WORDS(num_cells) * sizeof(lbm_uint));
+    gc_remset = (lbm_value*)lbm_malloc(LBM_GC_REMSET_SIZE * sizeof(lbm_value));
+    if (!gc_old_bits || !gc_remset) {
+      lbm_free(gc_old_bits);
+      lbm_free(gc_remset);
+      gc_old_bits = NULL;
+      gc_remset = NULL;
+    }
+  }
+
   heap_init_state(addr, num_cells,
-                  gc_stack_storage, gc_stack_size);
+                  gc_stack_storage, gc_stack_size,
+                  gc_mark_bits, gc_old_bits, gc_remset);
 
   lbm_heaps[0] = addr;
 
@@ -557,6 +652,9 @@ int lbm_heap_init(lbm_cons_t *addr, lbm_uint num_cells,
 lbm_value lbm_heap_allocate_cell(lbm_type ptr_type, lbm_value car, lbm_value cdr) {
   lbm_value r;
   lbm_value cell = lbm_heap_state.freelist;
+  if (!cell && lbm_gc_sweep_until(1)) {
+    cell = lbm_heap_state.freelist;
+  }
   if (cell) {
     lbm_uint heap_ix = lbm_dec_ptr(cell);
     lbm_heap_state.freelist = lbm_heap_state.heap[heap_ix].cdr;
@@ -572,7 +670,7 @@ lbm_value lbm_heap_allocate_cell(lbm_type ptr_type, lbm_value car, lbm_value cdr
 
 lbm_value lbm_heap_allocate_list(lbm_uint n) {
   if (n == 0) return ENC_SYM_NIL;
-  if (lbm_heap_num_free() < n) return ENC_SYM_MERROR;
+  if (!lbm_heap_ensure_free(n)) return ENC_SYM_MERROR;
 
   lbm_value curr = lbm_heap_state.freelist;
   lbm_value res  = curr;
@@ -596,7 +694,7 @@ lbm_value lbm_heap_allocate_list(lbm_uint n) {
 
 lbm_value lbm_heap_allocate_list_init_va(unsigned int n, va_list valist) {
   if (n == 0) return ENC_SYM_NIL;
-  if (lbm_heap_num_free() < n) return ENC_SYM_MERROR;
+  if (!lbm_heap_ensure_free(n)) return ENC_SYM_MERROR;
 
   lbm_value curr = lbm_heap_state.freelist;
   lbm_value res  = curr;
@@ -660,6 +758,8 @@ void lbm_gc_mark_phase(lbm_value root) {
 
   if (!lbm_is_ptr(root)) return;
 
+  lbm_gc_sweep_finish();
+
   mutex_lock(&lbm_const_heap_mutex);
   lbm_value curr = root;
   lbm_value prev = lbm_enc_cons_ptr(LBM_PTR_NULL);
@@ -669,10 +769,10 @@ void lbm_gc_mark_phase(lbm_value root) {
     while (lbm_is_ptr(curr) &&
            (lbm_dec_ptr(curr) != LBM_PTR_NULL) &&
            ((curr & LBM_PTR_TO_CONSTANT_BIT) == 0) &&
-           !lbm_get_gc_mark(lbm_cdr(curr))) {
+           !gc_is_marked(lbm_dec_ptr(curr))) {
       // Mark the cell if not a constant cell
       lbm_cons_t *cell = lbm_ref_cell(curr);
-      cell->cdr = lbm_set_gc_mark(cell->cdr);
+      lbm_set_gc_mark(lbm_dec_ptr(curr));
       if (lbm_is_cons_rw(curr)) {
         lbm_value next = 0;
         value_assign(&next, cell->car);
@@ -716,6 +816,9 @@ extern eval_context_t *ctx_running;
 void lbm_gc_mark_phase(lbm_value root) {
   lbm_value t_ptr;
   lbm_stack_t *s = &lbm_heap_state.gc_stack;
+
+  lbm_gc_sweep_finish();
+
   s->data[s->sp++] = root;
 
   while (!lbm_stack_is_empty(s)) {
@@ -729,9 +832,10 @@ void lbm_gc_mark_phase(lbm_value root) {
       continue;
     }
 
-    lbm_cons_t *cell = &lbm_heap_state.heap[lbm_dec_ptr(curr)];
+    lbm_uint ix = lbm_dec_ptr(curr);
+    lbm_cons_t *cell = &lbm_heap_state.heap[ix];
 
-    if (lbm_get_gc_mark(cell->cdr)) {
+    if (gc_is_marked(ix)) {
       continue;
     }
 
@@ -751,8 +855,7 @@ void lbm_gc_mark_phase(lbm_value root) {
       // 2. Any other ptr is marked immediately and index is increased.
       if (lbm_is_ptr(arrdata[index]) && ((arrdata[index] & LBM_PTR_TO_CONSTANT_BIT) == 0) &&
           !((arrdata[index] & LBM_CONTINUATION_INTERNAL) == LBM_CONTINUATION_INTERNAL)) {
-        lbm_cons_t *elt = &lbm_heap_state.heap[lbm_dec_ptr(arrdata[index])];
-        if (!lbm_get_gc_mark(elt->cdr)) {
+        if (!gc_is_marked(lbm_dec_ptr(arrdata[index]))) {
           curr = arrdata[index];
           goto mark_shortcut;
         }
@@ -763,13 +866,13 @@ void lbm_gc_mark_phase(lbm_value root) {
       }
 
       arr->index = 0;
-      cell->cdr = lbm_set_gc_mark(cell->cdr);
+      lbm_set_gc_mark(ix);
       lbm_heap_state.gc_marked ++;
       lbm_pop(s, &curr); // Remove array from GC stack as we are done marking it.
       continue;
     }
 
-    cell->cdr = lbm_set_gc_mark(cell->cdr);
+    lbm_set_gc_mark(ix);
     lbm_heap_state.gc_marked ++;
 
     if (t_ptr == LBM_TYPE_CONS) {
@@ -791,11 +894,15 @@ void lbm_gc_mark_env(lbm_value env) {
   lbm_value curr = env;
   lbm_cons_t *c;
 
+  lbm_gc_sweep_finish();
+
   while (lbm_is_ptr(curr)) {
+    // The rest of an old environment is old or remembered.
+    if (lbm_heap_state.gc_minor && gc_is_marked(lbm_dec_ptr(curr))) break;
     c = lbm_ref_cell(curr);
-    c->cdr = lbm_set_gc_mark(c->cdr); // mark the environent list structure.
+    lbm_set_gc_mark(lbm_dec_ptr(curr));   // mark the environent list structure.
     lbm_cons_t *b = lbm_ref_cell(c->car);
-    b->cdr = lbm_set_gc_mark(b->cdr); // mark the binding list head cell.
+    lbm_set_gc_mark(lbm_dec_ptr(c->car)); // mark the binding list head cell.
     lbm_gc_mark_phase(b->cdr);        // mark the bound object.
     lbm_heap_state.gc_marked +=2;
     curr = c->cdr;
@@ -823,15 +930,48 @@ void lbm_gc_mark_roots(lbm_uint *roots, lbm_uint num_roots) {
   }
 }
 
+// Cells that survive become old. A minor GC keeps all old cells.
+static inline bool gc_sweep_keep(lbm_uint ix) {
+  if (lbm_heap_state.gc_old_bits) {
+    if (gc_is_marked(ix)) {
+      lbm_clr_gc_mark(ix);
+      gc_set_old(ix);
+      lbm_heap_state.gc_num_old ++;
+      return true;
+    }
+    gc_clr_old(ix);
+    return false;
+  }
+  if (lbm_get_gc_mark(ix)) {
+    lbm_clr_gc_mark(ix);
+    return true;
+  }
+  return false;
+}
+
 // Sweep moves non-marked heap objects to the free list.
-int lbm_gc_sweep_phase(void) {
-  unsigned int i = 0;
+static void gc_sweep_range(lbm_uint start, lbm_uint end) {
   lbm_cons_t *heap = (lbm_cons_t *)lbm_heap_state.heap;
-
-  for (i = 0; i < lbm_heap_state.heap_size; i ++) {
-    if ( lbm_get_gc_mark(heap[i].cdr)) {
-      heap[i].cdr = lbm_clr_gc_mark(heap[i].cdr);
-    } else {
+  lbm_uint *mark_bits = lbm_heap_state.gc_mark_bits;
+  lbm_uint *old_bits = lbm_heap_state.gc_old_bits;
+
+  for (lbm_uint i = start; i < end; i ++) {
+    // Words where every cell survives are handled in one go.
+    if (old_bits &&
+        (i % GC_MARK_WORD_BITS) == 0 &&
+        end - i >= GC_MARK_WORD_BITS) {
+      lbm_uint w = i / GC_MARK_WORD_BITS;
+      lbm_uint live = mark_bits[w];
+      if (lbm_heap_state.gc_minor) live |= old_bits[w];
+      if (live == ~(lbm_uint)0) {
+        mark_bits[w] = 0;
+        old_bits[w] = live;
+        lbm_heap_state.gc_num_old += GC_MARK_WORD_BITS;
+        i += GC_MARK_WORD_BITS - 1;
+        continue;
+      }
+    }
+    if (!gc_sweep_keep(i)) {
       // Check if this cell is a pointer to an array
       // and free it.
       if (lbm_type_of(heap[i].cdr) == LBM_TYPE_SYMBOL) {
@@ -885,9 +1025,107 @@ int lbm_gc_sweep_phase(void) {
       lbm_heap_state.gc_recovered ++;
     }
   }
+}
+
+bool lbm_gc_sweep_step(lbm_uint budget) {
+  lbm_uint start = lbm_heap_state.gc_sweep_ix;
+  lbm_uint end = lbm_heap_state.heap_size;
+
+  if (start >= end) return true;
+  if (budget > 0 && budget < end - start) {
+    end = start + budget;
+  }
+  gc_sweep_range(start, end);
+  lbm_heap_state.gc_sweep_ix = end;
+  lbm_heap_state.gc_sweep_steps ++;
+
+  if (end == lbm_heap_state.heap_size) {
+    lbm_heap_new_freelist_length();
+    lbm_heap_state.gc_minor = false;
+    return true;
+  }
+  return false;
+}
+
+bool lbm_gc_sweep_until(lbm_uint n) {
+  while (lbm_heap_num_free() < n &&
+         !lbm_gc_sweep_step(lbm_heap_state.gc_sweep_budget));
+  return lbm_heap_num_free() >= n;
+}
+
+void lbm_gc_sweep_finish(void) {
+  if (lbm_gc_sweep_pending()) {
+    lbm_gc_sweep_step(0);
+  }
+}
+
+void lbm_gc_sweep_start(void) {
+  lbm_heap_state.gc_sweep_ix = 0;
+  lbm_heap_state.gc_num_old = 0;
+  lbm_gc_sweep_step(lbm_heap_state.gc_sweep_budget);
+}
+
+int lbm_gc_sweep_phase(void) {
+  lbm_heap_state.gc_sweep_ix = 0;
+  lbm_heap_state.gc_num_old = 0;
+  lbm_gc_sweep_step(0);
   return 1;
 }
 
+void lbm_gc_mark_begin(bool minor) {
+  lbm_heap_state_t *hs = &lbm_heap_state;
+
+  hs->gc_minor = (minor &&
+                  hs->gc_old_bits != NULL &&
+                  !hs->gc_remset_overflow);
+  if (hs->gc_minor) {
+    hs->gc_num_minor ++;
+    for (lbm_uint i = 0; i < hs->gc_remset_num; i ++) {
+      lbm_value c = hs->gc_remset[i];
+      if (lbm_type_of(c) == LBM_TYPE_LISPARRAY) {
+        lbm_array_header_t *arr = (lbm_array_header_t*)lbm_ref_cell(c)->car;
+        lbm_gc_mark_aux((lbm_uint*)arr->data, arr->size / sizeof(lbm_value));
+      } else {
+        lbm_cons_t *cell = lbm_ref_cell(c);
+        lbm_gc_mark_phase(cell->car);
+        lbm_gc_mark_phase(cell->cdr);
+      }
+    }
+  }
+  hs->gc_remset_num = 0;
+  hs->gc_remset_overflow = false;
+}
+
+void lbm_gc_remember(lbm_value c, lbm_value v) {
+  lbm_heap_state_t *hs = &lbm_heap_state;
+  lbm_uint c_ix = lbm_dec_ptr(c);
+  lbm_uint v_ix = lbm_dec_ptr(v);
+
+  // Only old cells need to be remembered. While a sweep is pending,
+  // marked cells are about to become old.
+  if ((c & LBM_PTR_TO_CONSTANT_BIT) ||
+      !(gc_get_old(c_ix) || lbm_get_gc_mark(c_ix)) ||
+      v_ix >= hs->heap_size ||
+      gc_get_old(v_ix) || lbm_get_gc_mark(v_ix)) {
+    return;
+  }
+  for (lbm_uint i = hs->gc_remset_num; i > 0; i --) {
+    if (hs->gc_remset[i - 1] == c) return;
+  }
+  if (hs->gc_remset_num < LBM_GC_REMSET_SIZE) {
+    hs->gc_remset[hs->gc_remset_num ++] = c;
+  } else {
+    hs->gc_remset_overflow = true;
+  }
+}
+
+void lbm_gc_set_sweep_budget(lbm_uint budget) {
+  if (lbm_heap_state.gc_mark_bits) {
+    lbm_heap_state.gc_sweep_budget = budget;
+  }
+}
+
+
 void lbm_gc_state_inc(void) {
   lbm_heap_state.gc_num ++;
   lbm_heap_state.gc_recovered = 0;
@@ -984,6 +1222,7 @@ int lbm_set_car(lbm_value c, lbm_value v) {
   if (lbm_type_of(c) == LBM_TYPE_CONS) {
     lbm_cons_t *cell = lbm_ref_cell(c);
     cell->car = v;
+    lbm_heap_write_barrier(c, v);
     r = 1;
   }
   return r;
@@ -994,6 +1233,7 @@ int lbm_set_cdr(lbm_value c, lbm_value v) {
   if (lbm_is_cons_rw(c)){
     lbm_cons_t *cell = lbm_ref_cell(c);
     cell->cdr = v;
+    lbm_heap_write_barrier(c, v);
     r = 1;
   }
   return r;
@@ -1005,6 +1245,8 @@ int lbm_set_car_and_cdr(lbm_value c, lbm_value car_val, lbm_value cdr_val) {
     lbm_cons_t *cell = lbm_ref_cell(c);
     cell->car = car_val;
     cell->cdr = cdr_val;
+    lbm_heap_write_barrier(c, car_val);
+    lbm_heap_write_barrier(c, cdr_val);
     r = 1;
   }
   return r;
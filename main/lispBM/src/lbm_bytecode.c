@@ -0,0 +1,603 @@
+/*
+    Copyright 2024 Joel Svensson        svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <lbm_bytecode.h>
+#include <env.h>
+#include <fundamental.h>
+
+#include <string.h>
+
+// Instructions. Operands are bytes except for jump targets which are
+// 16 bit code positions stored high byte first.
+#define OP_CONST   0  // k      push consts[k]
+#define OP_LOAD    1  // r      push regs[r]
+#define OP_STORE   2  // r      pop into regs[r]
+#define OP_GLOBAL  3  // k      push value of free variable consts[k]
+#define OP_FUND    4  // f n    apply fundamental f to the n topmost values
+#define OP_POP     5  //        drop top of stack
+#define OP_DUP     6  //        push top of stack
+#define OP_JMP     7  // a a    jump
+#define OP_JMPF    8  // a a    pop and jump if nil
+#define OP_JMPT    9  // a a    pop and jump if not nil
+#define OP_TAIL    10 //        pop the arguments into the parameters and restart
+#define OP_RET     11 //        pop and return
+
+/****************************************************/
+/* Compiler                                         */
+
+static bool compile_exp(lbm_bc_compiler_t *c, lbm_value exp, bool tail);
+
+static void emit(lbm_bc_compiler_t *c, uint8_t b) {
+  if (c->code_size < LBM_BC_MAX_CODE) {
+    c->code[c->code_size++] = b;
+  } else {
+    c->ok = false;
+  }
+}
+
+static void emit_2(lbm_bc_compiler_t *c, uint8_t op, uint8_t arg) {
+  emit(c, op);
+  emit(c, arg);
+}
+
+// Returns the position of the target to patch.
+static lbm_uint emit_jump(lbm_bc_compiler_t *c, uint8_t op) {
+  emit(c, op);
+  lbm_uint pos = c->code_size;
+  emit(c, 0);
+  emit(c, 0);
+  return pos;
+}
+
+static void patch_jump(lbm_bc_compiler_t *c, lbm_uint pos) {
+  if (c->ok && pos + 1 < LBM_BC_MAX_CODE) {
+    c->code[pos]     = (uint8_t)(c->code_size >> 8);
+    c->code[pos + 1] = (uint8_t)c->code_size;
+  }
+}
+
+static void push(lbm_bc_compiler_t *c, lbm_uint n) {
+  c->depth += n;
+  if (c->depth > c->max_depth) c->max_depth = c->depth;
+  if (c->depth > LBM_BC_MAX_STACK) c->ok = false;
+}
+
+static void pop(lbm_bc_compiler_t *c, lbm_uint n) {
+  c->depth -= n;
+}
+
+static void emit_const(lbm_bc_compiler_t *c, uint8_t op, lbm_value v) {
+  lbm_uint k;
+  for (k = 0; k < c->num_consts; k ++) {
+    if (c->consts[k] == v) break;
+  }
+  if (k == c->num_consts) {
+    if (k == LBM_BC_MAX_CONSTS) {
+      c->ok = false;
+      return;
+    }
+    c->consts[c->num_consts++] = v;
+  }
+  emit_2(c, op, (uint8_t)k);
+  push(c, 1);
+}
+
+static void emit_ret(lbm_bc_compiler_t *c, bool tail) {
+  if (tail) {
+    emit(c, OP_RET);
+    pop(c, 1);
+  }
+}
+
+static bool lookup_reg(lbm_bc_compiler_t *c, lbm_value sym, uint8_t *reg) {
+  for (lbm_uint i = c->scope_size; i > 0; i --) {
+    if (c->scope_sym[i-1] == sym) {
+      *reg = c->scope_reg[i-1];
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool add_reg(lbm_bc_compiler_t *c, lbm_value sym) {
+  if (!lbm_is_symbol(sym) ||
+      lbm_dec_sym(sym) < RUNTIME_SYMBOLS_START ||
+      c->num_regs == LBM_BC_MAX_REGS) {
+    return false;
+  }
+  c->scope_sym[c->scope_size] = sym;
+  c->scope_reg[c->scope_size] = (uint8_t)c->num_regs;
+  c->scope_size ++;
+  c->num_regs ++;
+  return true;
+}
+
+// Fundamental operations that only compute a value from their arguments.
+static bool is_pure_fundamental(lbm_uint f) {
+  switch (f) {
+  case SYM_ADD: case SYM_SUB: case SYM_MUL: case SYM_DIV: case SYM_MOD:
+  case SYM_EQ: case SYM_NOT_EQ: case SYM_NUMEQ: case SYM_NUM_NOT_EQ:
+  case SYM_LT: case SYM_GT: case SYM_LEQ: case SYM_GEQ: case SYM_NOT:
+  case SYM_CONS: case SYM_CAR: case SYM_CDR: case SYM_LIST: case SYM_IX:
+  case SYM_TO_I: case SYM_TO_I32: case SYM_TO_U: case SYM_TO_U32:
+  case SYM_TO_FLOAT: case SYM_TO_I64: case SYM_TO_U64: case SYM_TO_DOUBLE:
+  case SYM_TO_BYTE: case SYM_SHL: case SYM_SHR: case SYM_BITWISE_AND:
+  case SYM_BITWISE_OR: case SYM_BITWISE_XOR: case SYM_BITWISE_NOT:
+  case SYM_TYPE_OF: case SYM_LIST_LENGTH: case SYM_IS_LIST: case SYM_IS_NUMBER:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool compile_args(lbm_bc_compiler_t *c, lbm_value args, lbm_uint *n) {
+  *n = 0;
+  while (lbm_is_cons(args)) {
+    if (!compile_exp(c, lbm_car(args), false)) return false;
+    (*n) ++;
+    args = lbm_cdr(args);
+  }
+  return lbm_is_symbol_nil(args) && *n < 256;
+}
+
+static bool compile_progn(lbm_bc_compiler_t *c, lbm_value exps, bool tail) {
+  if (!lbm_is_cons(exps)) {
+    emit_const(c, OP_CONST, ENC_SYM_NIL);
+    emit_ret(c, tail);
+    return true;
+  }
+  while (lbm_is_cons(lbm_cdr(exps))) {
+    if (!compile_exp(c, lbm_car(exps), false)) return false;
+    emit(c, OP_POP);
+    pop(c, 1);
+    exps = lbm_cdr(exps);
+  }
+  return compile_exp(c, lbm_car(exps), tail);
+}
+
+// Condition is compiled by the caller.
+static bool compile_branches(lbm_bc_compiler_t *c, lbm_value then_exp, lbm_value else_exp, bool tail) {
+  lbm_uint else_pos = emit_jump(c, OP_JMPF);
+  pop(c, 1);
+  lbm_uint depth = c->depth;
+  if (!compile_exp(c, then_exp, tail)) return false;
+  lbm_uint end_pos = 0;
+  if (!tail) end_pos = emit_jump(c, OP_JMP);
+  patch_jump(c, else_pos);
+  c->depth = depth;
+  if (!compile_exp(c, else_exp, tail)) return false;
+  if (!tail) patch_jump(c, end_pos);
+  return true;
+}
+
+static bool compile_if(lbm_bc_compiler_t *c, lbm_value args, bool tail) {
+  lbm_uint n = lbm_list_length(args);
+  if (n < 2 || n > 3) return false;
+  if (!compile_exp(c, lbm_car(args), false)) return false;
+  lbm_value rest = lbm_cdr(args);
+  return compile_branches(c, lbm_car(rest), lbm_car(lbm_cdr(rest)), tail);
+}
+
+// (cond (c1 e1) ... (cN eN)) is compiled as nested ifs.
+static bool compile_cond(lbm_bc_compiler_t *c, lbm_value clauses, bool tail) {
+  if (!lbm_is_cons(clauses)) {
+    emit_const(c, OP_CONST, ENC_SYM_NIL);
+    emit_ret(c, tail);
+    return true;
+  }
+  lbm_value clause = lbm_car(clauses);
+  if (lbm_list_length(clause) != 2) return false;
+  if (!compile_exp(c, lbm_car(clause), false)) return false;
+  lbm_uint else_pos = emit_jump(c, OP_JMPF);
+  pop(c, 1);
+  lbm_uint depth = c->depth;
+  if (!compile_exp(c, lbm_car(lbm_cdr(clause)), tail)) return false;
+  lbm_uint end_pos = 0;
+  if (!tail) end_pos = emit_jump(c, OP_JMP);
+  patch_jump(c, else_pos);
+  c->depth = depth;
+  if (!compile_cond(c, lbm_cdr(clauses), tail)) return false;
+  if (!tail) patch_jump(c, end_pos);
+  return true;
+}
+
+// (and a b) is a DUP JMPF end POP b end
+static bool compile_and_or(lbm_bc_compiler_t *c, lbm_value args, bool is_and, bool tail) {
+  if (!lbm_is_cons(args)) {
+    emit_const(c, OP_CONST, is_and ? ENC_SYM_TRUE : ENC_SYM_NIL);
+    emit_ret(c, tail);
+    return true;
+  }
+  lbm_uint end_pos[LBM_BC_MAX_NESTING];
+  lbm_uint num_jumps = 0;
+  while (lbm_is_cons(lbm_cdr(args))) {
+    if (!compile_exp(c, lbm_car(args), false)) return false;
+    if (num_jumps == LBM_BC_MAX_NESTING) return false;
+    emit(c, OP_DUP);
+    push(c, 1);
+    end_pos[num_jumps++] = emit_jump(c, is_and ? OP_JMPF : OP_JMPT);
+    pop(c, 1);
+    emit(c, OP_POP);
+    pop(c, 1);
+    args = lbm_cdr(args);
+  }
+  if (!compile_exp(c, lbm_car(args), false)) return false;
+  for (lbm_uint i = 0; i < num_jumps; i ++) {
+    patch_jump(c, end_pos[i]);
+  }
+  emit_ret(c, tail);
+  return true;
+}
+
+// All names are in scope while the values are computed, as in let.
+// Registers of names that are not yet assigned hold nil.
+static bool compile_let(lbm_bc_compiler_t *c, lbm_value args, bool tail) {
+  if (lbm_list_length(args) != 2) return false;
+  lbm_value binds = lbm_car(args);
+  lbm_uint scope = c->scope_size;
+  lbm_uint first_reg = c->num_regs;
+  lbm_value curr = binds;
+  while (lbm_is_cons(curr)) {
+    lbm_value b = lbm_car(curr);
+    if (lbm_list_length(b) != 2 || !add_reg(c, lbm_car(b))) return false;
+    curr = lbm_cdr(curr);
+  }
+  if (!lbm_is_symbol_nil(curr)) return false;
+  lbm_uint reg = first_reg;
+  curr = binds;
+  while (lbm_is_cons(curr)) {
+    if (!compile_exp(c, lbm_car(lbm_cdr(lbm_car(curr))), false)) return false;
+    emit_2(c, OP_STORE, (uint8_t)reg++);
+    pop(c, 1);
+    curr = lbm_cdr(curr);
+  }
+  if (!compile_exp(c, lbm_car(lbm_cdr(args)), tail)) return false;
+  c->scope_size = scope;
+  return true;
+}
+
+static bool compile_app(lbm_bc_compiler_t *c, lbm_value fun, lbm_value args, bool tail) {
+  uint8_t reg;
+  if (fun == c->name && !lookup_reg(c, fun, &reg)) {
+    lbm_uint n;
+    if (!tail || !compile_args(c, args, &n) || n != c->num_params) return false;
+    emit(c, OP_TAIL);
+    pop(c, n);
+    return true;
+  }
+
+  if (!lbm_is_symbol(fun)) return false;
+  lbm_uint s = lbm_dec_sym(fun);
+
+  switch (s) {
+  case SYM_QUOTE:
+    emit_const(c, OP_CONST, lbm_car(args));
+    emit_ret(c, tail);
+    return true;
+  case SYM_IF:
+    return compile_if(c, args, tail);
+  case SYM_COND:
+    return compile_cond(c, args, tail);
+  case SYM_LET:
+    return compile_let(c, args, tail);
+  case SYM_PROGN:
+    return compile_progn(c, args, tail);
+  case SYM_AND:
+    return compile_and_or(c, args, true, tail);
+  case SYM_OR:
+    return compile_and_or(c, args, false, tail);
+  default:
+    break;
+  }
+
+  if (SYMBOL_KIND(s) == SYMBOL_KIND_FUNDAMENTAL && is_pure_fundamental(s)) {
+    lbm_uint n;
+    if (!compile_args(c, args, &n)) return false;
+    emit(c, OP_FUND);
+    emit(c, (uint8_t)SYMBOL_IX(s));
+    emit(c, (uint8_t)n);
+    pop(c, n);
+    push(c, 1);
+    emit_ret(c, tail);
+    return true;
+  }
+  return false;
+}
+
+static bool compile_exp(lbm_bc_compiler_t *c, lbm_value exp, bool tail) {
+  bool r = false;
+  if (!c->ok || c->nesting >= LBM_BC_MAX_NESTING) return false;
+  c->nesting ++;
+
+  if (lbm_is_symbol(exp)) {
+    uint8_t reg;
+    if (lookup_reg(c, exp, &reg)) {
+      emit_2(c, OP_LOAD, reg);
+      push(c, 1);
+    } else if (lbm_dec_sym(exp) >= RUNTIME_SYMBOLS_START) {
+      emit_const(c, OP_GLOBAL, exp);
+    } else {
+      // Other symbols evaluate to themselves.
+      emit_const(c, OP_CONST, exp);
+    }
+    emit_ret(c, tail);
+    r = true;
+  } else if (lbm_is_cons(exp)) {
+    r = compile_app(c, lbm_car(exp), lbm_cdr(exp), tail);
+  } else {
+    emit_const(c, OP_CONST, exp);
+    emit_ret(c, tail);
+    r = true;
+  }
+
+  c->nesting --;
+  return r && c->ok;
+}
+
+bool lbm_bc_compile(lbm_bc_compiler_t *c, lbm_value name, lbm_value params, lbm_value body) {
+  c->name = name;
+  c->code_size = LBM_BC_HEADER_SIZE;
+  c->num_consts = 0;
+  c->scope_size = 0;
+  c->num_regs = 0;
+  c->depth = 0;
+  c->max_depth = 0;
+  c->nesting = 0;
+  c->ok = true;
+
+  lbm_value curr = params;
+  while (lbm_is_cons(curr)) {
+    lbm_value p = lbm_car(curr);
+    uint8_t reg;
+    if (p == ENC_SYM_REST_ARGS || lookup_reg(c, p, &reg) || !add_reg(c, p)) {
+      return false;
+    }
+    curr = lbm_cdr(curr);
+  }
+  if (!lbm_is_symbol_nil(curr)) return false;
+  c->num_params = c->num_regs;
+
+  if (!compile_exp(c, body, true)) return false;
+
+  c->code[0] = (uint8_t)c->num_params;
+  c->code[1] = (uint8_t)c->num_regs;
+  c->code[2] = (uint8_t)c->max_depth;
+  c->code[3] = 0;
+  return true;
+}
+
+/****************************************************/
+/* Verifier                                         */
+
+#define DEPTH_UNKNOWN 0xFF
+
+// Record the operand stack depth at a jump target. All jumps made by the
+// compiler go forward, so the target has not been checked yet.
+static bool verify_target(uint8_t *depth, lbm_uint pc, lbm_uint target, lbm_uint code_size, lbm_uint d) {
+  if (target <= pc || target >= code_size) return false;
+  if (depth[target] == DEPTH_UNKNOWN) {
+    depth[target] = (uint8_t)d;
+    return true;
+  }
+  return depth[target] == d;
+}
+
+bool lbm_bc_verify(uint8_t *code, lbm_uint code_size, lbm_uint num_consts) {
+  if (code_size <= LBM_BC_HEADER_SIZE || code_size > LBM_BC_MAX_CODE) return false;
+
+  lbm_uint num_params = LBM_BC_NUM_PARAMS(code);
+  lbm_uint num_regs = LBM_BC_NUM_REGS(code);
+  lbm_uint stack_size = LBM_BC_STACK_SIZE(code);
+  if (num_params > num_regs || num_regs > LBM_BC_MAX_REGS ||
+      stack_size > LBM_BC_MAX_STACK || code[3] != 0) {
+    return false;
+  }
+
+  uint8_t depth[LBM_BC_MAX_CODE];
+  memset(depth, DEPTH_UNKNOWN, code_size);
+
+  lbm_uint pc = LBM_BC_HEADER_SIZE;
+  lbm_uint d = 0;
+  bool reachable = true; // by falling through from the previous instruction
+
+  while (pc < code_size) {
+    if (!reachable) {
+      // Only jumps lead here. The compiler does not emit dead code.
+      if (depth[pc] == DEPTH_UNKNOWN) return false;
+      d = depth[pc];
+    } else if (depth[pc] != DEPTH_UNKNOWN && depth[pc] != d) {
+      return false;
+    }
+    reachable = true;
+
+    uint8_t op = code[pc];
+    lbm_uint len = (op == OP_FUND || op == OP_JMP || op == OP_JMPF || op == OP_JMPT) ? 3 :
+                   (op <= OP_GLOBAL) ? 2 : 1;
+    if (pc + len > code_size) return false;
+    // Jumps may not land inside an instruction.
+    for (lbm_uint i = 1; i < len; i ++) {
+      if (depth[pc + i] != DEPTH_UNKNOWN) return false;
+    }
+
+    switch (op) {
+    case OP_CONST: case OP_GLOBAL:
+      if (code[pc+1] >= num_consts || d >= stack_size) return false;
+      d ++;
+      break;
+    case OP_LOAD:
+      if (code[pc+1] >= num_regs || d >= stack_size) return false;
+      d ++;
+      break;
+    case OP_STORE:
+      if (code[pc+1] >= num_regs || d < 1) return false;
+      d --;
+      break;
+    case OP_FUND: {
+      lbm_uint n = code[pc+2];
+      if (!is_pure_fundamental(FUNDAMENTAL_SYMBOLS_START | code[pc+1]) ||
+          d < n || d - n >= stack_size) {
+        return false;
+      }
+      d = d - n + 1;
+    } break;
+    case OP_POP:
+      if (d < 1) return false;
+      d --;
+      break;
+    case OP_DUP:
+      if (d < 1 || d >= stack_size) return false;
+      d ++;
+      break;
+    case OP_JMP:
+      if (!verify_target(depth, pc, ((lbm_uint)code[pc+1] << 8) | code[pc+2], code_size, d)) return false;
+      reachable = false;
+      break;
+    case OP_JMPF: case OP_JMPT:
+      if (d < 1) return false;
+      d --;
+      if (!verify_target(depth, pc, ((lbm_uint)code[pc+1] << 8) | code[pc+2], code_size, d)) return false;
+      break;
+    case OP_TAIL:
+      if (d < num_params) return false;
+      reachable = false;
+      break;
+    case OP_RET:
+      if (d < 1) return false;
+      reachable = false;
+      break;
+    default:
+      return false;
+    }
+    pc += len;
+  }
+  // Running off the end of the code is not allowed.
+  return !reachable;
+}
+
+/****************************************************/
+/* Virtual machine                                  */
+
+int lbm_bc_run(lbm_bc_state_t *s, eval_context_t *ctx) {
+  uint8_t *code = s->code;
+  lbm_value *consts = s->consts;
+  lbm_value *regs = s->regs;
+  lbm_uint pc = s->pc;
+  lbm_uint sp = s->sp;
+  lbm_uint quota = s->quota;
+  int r;
+
+  for (;;) {
+    switch (code[pc]) {
+    case OP_CONST:
+      regs[sp++] = consts[code[pc+1]];
+      pc += 2;
+      break;
+    case OP_LOAD:
+      regs[sp++] = regs[code[pc+1]];
+      pc += 2;
+      break;
+    case OP_STORE:
+      regs[code[pc+1]] = regs[--sp];
+      pc += 2;
+      break;
+    case OP_GLOBAL: {
+      lbm_value sym = consts[code[pc+1]];
+      if (!lbm_env_lookup_b(&regs[sp], sym, s->env) &&
+          !lbm_global_env_lookup(&regs[sp], sym)) {
+        s->res = ENC_SYM_NOT_FOUND;
+        s->err_at = sym;
+        r = LBM_BC_ERROR;
+        goto out;
+      }
+      sp ++;
+      pc += 2;
+    } break;
+    case OP_FUND: {
+      lbm_uint f = code[pc+1];
+      lbm_uint n = code[pc+2];
+      lbm_value v = fundamental_table[f](&regs[sp - n], n, ctx);
+      if (lbm_is_error(v)) {
+        s->res = v;
+        s->err_at = lbm_enc_sym(FUNDAMENTAL_SYMBOLS_START | f);
+        r = lbm_is_symbol_merror(v) ? LBM_BC_MERROR : LBM_BC_ERROR;
+        goto out;
+      }
+      sp -= n;
+      regs[sp++] = v;
+      pc += 3;
+    } break;
+    case OP_POP:
+      sp --;
+      pc ++;
+      break;
+    case OP_DUP:
+      regs[sp] = regs[sp-1];
+      sp ++;
+      pc ++;
+      break;
+    case OP_JMP:
+      pc = ((lbm_uint)code[pc+1] << 8) | code[pc+2];
+      break;
+    case OP_JMPF:
+      if (lbm_is_symbol_nil(regs[--sp])) {
+        pc = ((lbm_uint)code[pc+1] << 8) | code[pc+2];
+      } else {
+        pc += 3;
+      }
+      break;
+    case OP_JMPT:
+      if (!lbm_is_symbol_nil(regs[--sp])) {
+        pc = ((lbm_uint)code[pc+1] << 8) | code[pc+2];
+      } else {
+        pc += 3;
+      }
+      break;
+    case OP_TAIL: {
+      lbm_uint n = LBM_BC_NUM_PARAMS(code);
+      lbm_uint num_regs = LBM_BC_NUM_REGS(code);
+      sp -= n;
+      for (lbm_uint i = 0; i < n; i ++) {
+        regs[i] = regs[sp + i];
+      }
+      for (lbm_uint i = n; i < num_regs; i ++) {
+        regs[i] = ENC_SYM_NIL;
+      }
+      sp = num_regs;
+      pc = LBM_BC_HEADER_SIZE;
+      if (quota == 0) {
+        r = LBM_BC_SUSPEND;
+        goto out;
+      }
+      quota --;
+    } break;
+    case OP_RET:
+      s->res = regs[--sp];
+      r = LBM_BC_DONE;
+      goto out;
+    default:
+      s->res = ENC_SYM_FATAL_ERROR;
+      s->err_at = ENC_SYM_NIL;
+      r = LBM_BC_ERROR;
+      goto out;
+    }
+  }
+ out:
+  s->pc = pc;
+  s->sp = sp;
+  s->quota = quota;
+  return r;
+}
@@ -222,6 +222,7 @@ int lbm_undefine(char *symbol) {
 
   if (new_env == ENC_SYM_NOT_FOUND) return 0;
   glob_env[ix_key] = new_env;
+  lbm_global_env_cache_clear();
   return 1;
 }
 
@@ -275,6 +276,7 @@ void lbm_clear_env(void) {
   for (int i = 0; i < GLOBAL_ENV_ROOTS; i ++) {
     env[i] = ENC_SYM_NIL;
   }
+  lbm_global_env_cache_clear();
   lbm_perform_gc();
 }
 
@@ -68,10 +68,13 @@ static void free_defrag_allocation(lbm_uint *allocation) {
   // cleared in the defrag_mem.
 
   cell_back_ptr = lbm_set_ptr_type(cell_back_ptr, LBM_TYPE_CONS);
-  bool marked = lbm_cdr(cell_back_ptr) & LBM_GC_MASK;
-  lbm_value new_cdr = marked ? (ENC_SYM_NIL | LBM_GC_MARKED) : ENC_SYM_NIL;
+  lbm_value new_cdr = ENC_SYM_NIL;
+  // The mark is kept in the mark bitmap, which is left as is. Only
+  // without a bitmap does the mark live in the cdr and need to be kept.
+  if (!lbm_heap_state.gc_mark_bits) {
+    new_cdr |= lbm_cdr(cell_back_ptr) & LBM_GC_MASK;
+  }
   lbm_set_car_and_cdr(cell_back_ptr, ENC_SYM_NIL, new_cdr);
-  // possible optimize, if not marked. dont bother setting anything.
 
   for (lbm_uint i = 0; i < nwords; i ++) {
     allocation[i] = 0;
@@ -19,6 +19,7 @@
 #include <lbm_flat_value.h>
 #include <eval_cps.h>
 #include <stack.h>
+#include "platform_mutex.h"
 
 #include <setjmp.h>
 
@@ -27,9 +28,111 @@
 int lbm_perform_gc(void);
 
 
+// ------------------------------------------------------------
+// Buffer pool
+//
+// Events from interrupt handlers and driver threads are small and
+// frequent. Taking their buffers from a fixed pool avoids a trip
+// through lbm_memory (and waiting for GC when it is fragmented)
+// for every CAN frame.
+
+static mutex_t  flat_pool_mutex;
+static bool     flat_pool_mutex_initialized = false;
+static uint8_t  *flat_pool = NULL;
+static lbm_uint *flat_pool_free = NULL; // bit i set when buffer i is free
+static lbm_uint flat_pool_num_bufs = 0;
+static lbm_uint flat_pool_buf_size = 0;
+
+#define FLAT_POOL_BITS (sizeof(lbm_uint) * 8)
+
+bool lbm_flat_value_pool_init(lbm_uint num_bufs, lbm_uint buf_size) {
+  if (!flat_pool_mutex_initialized) {
+    mutex_init(&flat_pool_mutex);
+    flat_pool_mutex_initialized = true;
+  }
+
+  mutex_lock(&flat_pool_mutex);
+  // lbm_memory has been reset by lbm_init, so any earlier pool is already gone.
+  flat_pool = NULL;
+  flat_pool_free = NULL;
+  flat_pool_num_bufs = 0;
+  flat_pool_buf_size = 0;
+
+  bool res = false;
+  buf_size = (buf_size + sizeof(lbm_uint) - 1) & ~(sizeof(lbm_uint) - 1);
+  lbm_uint bitmap_words = (num_bufs + FLAT_POOL_BITS - 1) / FLAT_POOL_BITS;
+  if (num_bufs > 0 && buf_size > 0) {
+    uint8_t *pool = lbm_malloc(num_bufs * buf_size);
+    lbm_uint *bitmap = lbm_malloc(bitmap_words * sizeof(lbm_uint));
+    if (pool && bitmap) {
+      memset(bitmap, 0, bitmap_words * sizeof(lbm_uint));
+      for (lbm_uint i = 0; i < num_bufs; i ++) {
+        bitmap[i / FLAT_POOL_BITS] |= (lbm_uint)1 << (i % FLAT_POOL_BITS);
+      }
+      flat_pool = pool;
+      flat_pool_free = bitmap;
+      flat_pool_num_bufs = num_bufs;
+      flat_pool_buf_size = buf_size;
+      res = true;
+    } else {
+      if (pool) lbm_free(pool);
+      if (bitmap) lbm_free(bitmap);
+    }
+  }
+  mutex_unlock(&flat_pool_mutex);
+  return res;
+}
+
+static bool in_pool(uint8_t *buf) {
+  return (flat_pool &&
+          buf >= flat_pool &&
+          buf < flat_pool + (flat_pool_num_bufs * flat_pool_buf_size));
+}
+
+static uint8_t *pool_alloc(size_t buffer_size) {
+  uint8_t *res = NULL;
+  if (buffer_size > flat_pool_buf_size) return NULL;
+  mutex_lock(&flat_pool_mutex);
+  lbm_uint bitmap_words = (flat_pool_num_bufs + FLAT_POOL_BITS - 1) / FLAT_POOL_BITS;
+  for (lbm_uint w = 0; w < bitmap_words; w ++) {
+    lbm_uint bits = flat_pool_free[w];
+    if (bits) {
+      lbm_uint b = 0;
+      while (!(bits & ((lbm_uint)1 << b))) b ++;
+      flat_pool_free[w] &= ~((lbm_uint)1 << b);
+      res = flat_pool + ((w * FLAT_POOL_BITS + b) * flat_pool_buf_size);
+      break;
+    }
+  }
+  mutex_unlock(&flat_pool_mutex);
+  return res;
+}
+
+void lbm_flat_value_free_buf(uint8_t *buf) {
+  if (in_pool(buf)) {
+    lbm_uint i = (lbm_uint)(buf - flat_pool) / flat_pool_buf_size;
+    mutex_lock(&flat_pool_mutex);
+    flat_pool_free[i / FLAT_POOL_BITS] |= (lbm_uint)1 << (i % FLAT_POOL_BITS);
+    mutex_unlock(&flat_pool_mutex);
+  } else {
+    lbm_free(buf);
+  }
+}
+
 // ------------------------------------------------------------
 // Flatteners
 
+bool lbm_start_flatten_pooled(lbm_flat_value_t *v, size_t buffer_size) {
+  uint8_t *data = pool_alloc(buffer_size);
+  if (data) {
+    v->buf = data;
+    v->buf_size = buffer_size;
+    v->buf_pos = 0;
+    return true;
+  }
+  return lbm_start_flatten(v, buffer_size);
+}
+
 bool lbm_start_flatten(lbm_flat_value_t *v, size_t buffer_size) {
   bool res = false;
   uint8_t *data = lbm_malloc_reserve(buffer_size);
@@ -46,6 +149,9 @@ bool lbm_finish_flatten(lbm_flat_value_t *v) {
 
   lbm_uint size_words;
 
+  // Pool buffers have a fixed size and are never shrunk.
+  if (in_pool(v->buf)) return true;
+
   if (v->buf_pos % sizeof(lbm_uint) == 0) {
     size_words = v->buf_pos / sizeof(lbm_uint);
   } else {
@@ -32,12 +32,22 @@ void lbm_request_gc(void);
 #define START         2  //10b
 #define START_END     3  //11b
 
-/* States in memory_allocate state-machine*/
-#define INIT                 0
-#define FREE_LENGTH_CHECK    1
-#define SKIP                 2
-#define ALLOC_DONE           0xF00DF00D
-#define ALLOC_FAILED         0xDEADBEAF
+/* Free blocks
+
+   Free words are always merged into maximal free blocks. The first
+   and the last word of a free block hold the size of the block. Blocks
+   of at least FREE_BLOCK_MIN_TRACKED words also hold the index of the
+   next and previous block in words 1 and 2 and are kept in size-class
+   bins: one bin per exact size for small blocks and one bin per power
+   of two for larger blocks. Smaller fragments are not in any bin and
+   are only used when they merge with a neighbour or, as a last resort,
+   for allocations that are too small to use a tracked block.
+*/
+#define FREE_BLOCK_MIN_TRACKED 4
+#define NUM_EXACT_BINS         12   // sizes 4 to 15
+#define FIRST_RANGE_BIN_SHIFT  4    // first range bin holds sizes 16 to 31
+#define NUM_BINS               32
+#define NO_BLOCK               ((lbm_uint)-1)
 
 static lbm_uint *bitmap = NULL;
 static lbm_uint *memory = NULL;
@@ -45,10 +55,15 @@ static lbm_uint memory_size;  // in 4 or 8 byte words depending on 32 or 64 bit
 static lbm_uint bitmap_size;  // in 4 or 8 byte words
 static lbm_uint memory_base_address = 0;
 static lbm_uint memory_num_free = 0;
+static lbm_uint memory_least_free = 0;
+static lbm_uint memory_num_free_blocks = 0;
 static volatile lbm_uint memory_reserve_level = 0;
 static mutex_t lbm_mem_mutex;
 static bool    lbm_mem_mutex_initialized;
-static lbm_uint alloc_offset = 0;
+static lbm_uint free_bins[NUM_BINS];
+static uint32_t free_bins_used = 0; // bit n set when bin n is not empty
+
+static void make_free_block(lbm_uint ix, lbm_uint size);
 
 int lbm_memory_init(lbm_uint *data, lbm_uint data_size,
                     lbm_uint *bits, lbm_uint bits_size) {
@@ -58,11 +73,12 @@ int lbm_memory_init(lbm_uint *data, lbm_uint data_size,
     lbm_mem_mutex_initialized = true;
   }
 
-  alloc_offset = 0;
-
   mutex_lock(&lbm_mem_mutex);
   int res = 0;
-  if (data == NULL || bits == NULL) return 0;
+  if (data == NULL || bits == NULL) {
+    mutex_unlock(&lbm_mem_mutex);
+    return 0;
+  }
 
   if (((lbm_uint)data % sizeof(lbm_uint) != 0) ||
       (data_size * 2) != (bits_size * sizeof(lbm_uint) * 8) ||
@@ -86,7 +102,15 @@ int lbm_memory_init(lbm_uint *data, lbm_uint data_size,
     memory_base_address = (lbm_uint)data;
     memory_size = data_size;
     memory_num_free = data_size;
+    memory_least_free = data_size;
+    memory_num_free_blocks = 0;
     memory_reserve_level = (lbm_uint)(0.1 * (lbm_float)data_size);
+
+    for (int i = 0; i < NUM_BINS; i ++) {
+      free_bins[i] = NO_BLOCK;
+    }
+    free_bins_used = 0;
+    make_free_block(0, memory_size);
     res = 1;
   }
   mutex_unlock(&lbm_mem_mutex);
@@ -156,52 +180,184 @@ static inline void set_status(lbm_uint i, lbm_uint status) {
   bitmap[word_ix] |= mask;
 }
 
-lbm_uint lbm_memory_num_words(void) {
-  return memory_size;
+// Index of the END status of the allocation starting at ix.
+// Bitmap words with no status set are skipped in one step.
+static lbm_uint find_end(lbm_uint ix) {
+  lbm_uint i = ix + 1;
+  while (i < memory_size) {
+    if ((i & ((1 << BITMAP_SIZE_SHIFT) - 1)) == 0 &&
+        bitmap[i >> BITMAP_SIZE_SHIFT] == 0) {
+      i += (1 << BITMAP_SIZE_SHIFT);
+      continue;
+    }
+    if (status(i) == END) return i;
+    i ++;
+  }
+  return NO_BLOCK;
 }
 
-lbm_uint lbm_memory_num_free(void) {
-  if (memory == NULL || bitmap == NULL) {
-    return 0;
+static inline lbm_uint size_to_bin(lbm_uint size) {
+  if (size < FREE_BLOCK_MIN_TRACKED + NUM_EXACT_BINS) {
+    return size - FREE_BLOCK_MIN_TRACKED;
   }
-  mutex_lock(&lbm_mem_mutex);
-  unsigned int state = INIT;
-  lbm_uint sum_length = 0;
+  lbm_uint bin = NUM_EXACT_BINS;
+  lbm_uint s = size >> FIRST_RANGE_BIN_SHIFT;
+  while (s > 1 && bin < NUM_BINS - 1) {
+    s >>= 1;
+    bin ++;
+  }
+  return bin;
+}
 
-  for (unsigned int i = 0; i < (bitmap_size << BITMAP_SIZE_SHIFT); i ++) {
+static void bin_insert(lbm_uint ix, lbm_uint size) {
+  lbm_uint bin = size_to_bin(size);
+  lbm_uint head = free_bins[bin];
+  memory[ix + 1] = head;
+  memory[ix + 2] = NO_BLOCK;
+  if (head != NO_BLOCK) {
+    memory[head + 2] = ix;
+  }
+  free_bins[bin] = ix;
+  free_bins_used |= ((uint32_t)1 << bin);
+}
 
-    switch(status(i)) {
-    case FREE_OR_USED:
-      switch (state) {
-      case INIT:
-          state = FREE_LENGTH_CHECK;
-          sum_length ++;
-        break;
-      case FREE_LENGTH_CHECK:
-        sum_length ++;
-        state = FREE_LENGTH_CHECK;
-        break;
-      case SKIP:
-        break;
+static void bin_remove(lbm_uint ix, lbm_uint size) {
+  lbm_uint next = memory[ix + 1];
+  lbm_uint prev = memory[ix + 2];
+  if (prev != NO_BLOCK) {
+    memory[prev + 1] = next;
+  } else {
+    lbm_uint bin = size_to_bin(size);
+    free_bins[bin] = next;
+    if (next == NO_BLOCK) {
+      free_bins_used &= ~((uint32_t)1 << bin);
+    }
+  }
+  if (next != NO_BLOCK) {
+    memory[next + 2] = prev;
+  }
+}
+
+static void make_free_block(lbm_uint ix, lbm_uint size) {
+  memory[ix] = size;
+  memory[ix + size - 1] = size;
+  if (size >= FREE_BLOCK_MIN_TRACKED) {
+    bin_insert(ix, size);
+  }
+  memory_num_free_blocks ++;
+}
+
+static void unlink_free_block(lbm_uint ix) {
+  lbm_uint size = memory[ix];
+  if (size >= FREE_BLOCK_MIN_TRACKED) {
+    bin_remove(ix, size);
+  }
+  memory_num_free_blocks --;
+}
+
+// Return the words ix to ix + n - 1 to the free blocks, merging with
+// free neighbours. The status of the words must already be cleared.
+// As an allocation always ends with an END status, a word next to the
+// range that has no status set is part of a free block.
+static void free_range(lbm_uint ix, lbm_uint n) {
+  lbm_uint end = ix + n;
+  if (ix > 0 && status(ix - 1) == FREE_OR_USED) {
+    lbm_uint left = memory[ix - 1];
+    ix -= left;
+    n += left;
+    unlink_free_block(ix);
+  }
+  if (end < memory_size && status(end) == FREE_OR_USED) {
+    n += memory[end];
+    unlink_free_block(end);
+  }
+  make_free_block(ix, n);
+}
+
+// Best fit within the bin of num_words, otherwise the first block of the
+// next non-empty bin, which is always large enough.
+static lbm_uint find_free_block(lbm_uint num_words) {
+  lbm_uint bin = 0;
+  if (num_words >= FREE_BLOCK_MIN_TRACKED) {
+    bin = size_to_bin(num_words);
+    lbm_uint best = NO_BLOCK;
+    lbm_uint best_size = 0;
+    for (lbm_uint ix = free_bins[bin]; ix != NO_BLOCK; ix = memory[ix + 1]) {
+      lbm_uint size = memory[ix];
+      if (size >= num_words && (best == NO_BLOCK || size < best_size)) {
+        best = ix;
+        best_size = size;
+        if (size == num_words) break;
       }
-      break;
-    case END:
-      state = INIT;
-      break;
-    case START:
-      state = SKIP;
+    }
+    if (best != NO_BLOCK) return best;
+    bin ++;
+  }
+  for (; bin < NUM_BINS; bin ++) {
+    if (free_bins_used & ((uint32_t)1 << bin)) {
+      return free_bins[bin];
+    }
+  }
+  return NO_BLOCK;
+}
+
+// Walk all blocks looking for an untracked fragment of at least
+// num_words. Only used when no tracked block is left.
+static lbm_uint find_fragment(lbm_uint num_words) {
+  lbm_uint ix = 0;
+  while (ix < memory_size) {
+    switch (status(ix)) {
+    case FREE_OR_USED:
+      if (memory[ix] >= num_words) return ix;
+      ix += memory[ix];
       break;
     case START_END:
-      state = INIT;
+      ix ++;
       break;
+    case START: {
+      lbm_uint end = find_end(ix);
+      if (end == NO_BLOCK) return NO_BLOCK;
+      ix = end + 1;
+    } break;
     default:
-      mutex_unlock(&lbm_mem_mutex);
-      return 0;
-      break;
+      return NO_BLOCK;
     }
   }
+  return NO_BLOCK;
+}
+
+lbm_uint lbm_memory_num_words(void) {
+  return memory_size;
+}
+
+lbm_uint lbm_memory_num_free(void) {
+  if (memory == NULL || bitmap == NULL) {
+    return 0;
+  }
+  mutex_lock(&lbm_mem_mutex);
+  lbm_uint n = memory_num_free;
+  mutex_unlock(&lbm_mem_mutex);
+  return n;
+}
+
+lbm_uint lbm_memory_least_free(void) {
+  if (memory == NULL || bitmap == NULL) {
+    return 0;
+  }
+  mutex_lock(&lbm_mem_mutex);
+  lbm_uint n = memory_least_free;
   mutex_unlock(&lbm_mem_mutex);
-  return sum_length;
+  return n;
+}
+
+lbm_uint lbm_memory_num_free_blocks(void) {
+  if (memory == NULL || bitmap == NULL) {
+    return 0;
+  }
+  mutex_lock(&lbm_mem_mutex);
+  lbm_uint n = memory_num_free_blocks;
+  mutex_unlock(&lbm_mem_mutex);
+  return n;
 }
 
 lbm_uint lbm_memory_longest_free(void) {
@@ -209,42 +365,23 @@ lbm_uint lbm_memory_longest_free(void) {
     return 0;
   }
   mutex_lock(&lbm_mem_mutex);
-  unsigned int state = INIT;
   lbm_uint max_length = 0;
 
-  lbm_uint curr_length = 0;
-  for (unsigned int i = 0; i < (bitmap_size << BITMAP_SIZE_SHIFT); i ++) {
-
-    switch(status(i)) {
-    case FREE_OR_USED:
-      switch (state) {
-      case INIT:
-        curr_length = 1;
-        if (curr_length > max_length) max_length = curr_length;
-        state = FREE_LENGTH_CHECK;
-        break;
-      case FREE_LENGTH_CHECK:
-        curr_length ++;
-        if (curr_length > max_length) max_length = curr_length;
-        state = FREE_LENGTH_CHECK;
-        break;
-      case SKIP:
+  int bin = NUM_BINS - 1;
+  while (bin >= 0 && !(free_bins_used & ((uint32_t)1 << bin))) {
+    bin --;
+  }
+  if (bin >= 0) {
+    for (lbm_uint ix = free_bins[bin]; ix != NO_BLOCK; ix = memory[ix + 1]) {
+      if (memory[ix] > max_length) max_length = memory[ix];
+    }
+  } else {
+    // Only fragments are left.
+    for (lbm_uint n = FREE_BLOCK_MIN_TRACKED - 1; n > 0; n --) {
+      if (find_fragment(n) != NO_BLOCK) {
+        max_length = n;
         break;
       }
-      break;
-    case END:
-      state = INIT;
-      break;
-    case START:
-      state = SKIP;
-      break;
-    case START_END:
-      state = INIT;
-      break;
-    default:
-      mutex_unlock(&lbm_mem_mutex);
-      return 0;
-      break;
     }
   }
   mutex_unlock(&lbm_mem_mutex);
@@ -257,82 +394,39 @@ lbm_uint lbm_memory_longest_free(void) {
 
 static lbm_uint *lbm_memory_allocate_internal(lbm_uint num_words) {
 
-  if (memory == NULL || bitmap == NULL) {
+  if (memory == NULL || bitmap == NULL || num_words == 0) {
     return NULL;
   }
 
   mutex_lock(&lbm_mem_mutex);
 
-  lbm_uint start_ix = 0;
-  lbm_uint end_ix = 0;
-  lbm_uint free_length = 0;
-  unsigned int state = INIT;
-  lbm_uint loop_max = (bitmap_size << BITMAP_SIZE_SHIFT);
-
-  for (lbm_uint i = 0; i < loop_max; i ++) {
-    switch(status(alloc_offset)) {
-    case FREE_OR_USED:
-      switch (state) {
-      case INIT:
-        start_ix = alloc_offset;
-        if (num_words == 1) {
-          end_ix = alloc_offset;
-          state = ALLOC_DONE;
-        } else {
-          state = FREE_LENGTH_CHECK;
-          free_length = 1;
-        }
-        break;
-      case FREE_LENGTH_CHECK:
-        free_length ++;
-        if (free_length == num_words) {
-          end_ix = alloc_offset;
-          state = ALLOC_DONE;
-        } else {
-          state = FREE_LENGTH_CHECK;
-        }
-        break;
-      case SKIP:
-        break;
-      }
-      break;
-    case END:
-      state = INIT;
-      break;
-    case START:
-      state = SKIP;
-      break;
-    case START_END:
-      state = INIT;
-      break;
-    default: // error case
-      mutex_unlock(&lbm_mem_mutex);
-      return NULL;
-    }
-
-    if (state == ALLOC_DONE) break;
+  lbm_uint ix = find_free_block(num_words);
+  if (ix == NO_BLOCK && num_words < FREE_BLOCK_MIN_TRACKED) {
+    ix = find_fragment(num_words);
+  }
+  if (ix == NO_BLOCK) {
+    mutex_unlock(&lbm_mem_mutex);
+    return NULL;
+  }
 
-    alloc_offset++;
-    if (alloc_offset == loop_max ) {
-      free_length = 0;
-      alloc_offset = 0;
-      state = INIT;
-    }
+  lbm_uint size = memory[ix];
+  unlink_free_block(ix);
+  if (size > num_words) {
+    make_free_block(ix + num_words, size - num_words);
   }
 
-  if (state == ALLOC_DONE) {
-    if (start_ix == end_ix) {
-      set_status(start_ix, START_END);
-    } else {
-      set_status(start_ix, START);
-      set_status(end_ix, END);
-    }
-    memory_num_free -= num_words;
-    mutex_unlock(&lbm_mem_mutex);
-    return bitmap_ix_to_address(start_ix);
+  if (num_words == 1) {
+    set_status(ix, START_END);
+  } else {
+    set_status(ix, START);
+    set_status(ix + num_words - 1, END);
+  }
+  memory_num_free -= num_words;
+  if (memory_num_free < memory_least_free) {
+    memory_least_free = memory_num_free;
   }
   mutex_unlock(&lbm_mem_mutex);
-  return NULL;
+  return bitmap_ix_to_address(ix);
 }
 
 lbm_uint *lbm_memory_allocate(lbm_uint num_words) {
@@ -345,38 +439,31 @@ lbm_uint *lbm_memory_allocate(lbm_uint num_words) {
 
 int lbm_memory_free(lbm_uint *ptr) {
   int r = 0;
-  lbm_uint count_freed = 0;
   if (lbm_memory_ptr_inside(ptr)) {
     mutex_lock(&lbm_mem_mutex);
     lbm_uint ix = address_to_bitmap_ix(ptr);
-    alloc_offset = ix;
+    lbm_uint end = ix;
 
     switch(status(ix)) {
     case START:
-      set_status(ix, FREE_OR_USED);
-      for (lbm_uint i = ix; i < (bitmap_size << BITMAP_SIZE_SHIFT); i ++) {
-        count_freed ++;
-        if (status(i) == END) {
-          set_status(i, FREE_OR_USED);
-          r = 1;
-          break;
-        }
+      end = find_end(ix);
+      if (end != NO_BLOCK) {
+        set_status(ix, FREE_OR_USED);
+        set_status(end, FREE_OR_USED);
+        r = 1;
       }
       break;
     case START_END:
       set_status(ix, FREE_OR_USED);
-      count_freed = 1;
       r = 1;
       break;
     default:
       break;
     }
     if (r) {
-      while (alloc_offset > 0 && status(alloc_offset - 1) == FREE_OR_USED) {
-        alloc_offset--;
-      }
+      free_range(ix, end - ix + 1);
+      memory_num_free += end - ix + 1;
     }
-    memory_num_free += count_freed;
     mutex_unlock(&lbm_mem_mutex);
   }
   return r;
@@ -428,41 +515,21 @@ int lbm_memory_shrink(lbm_uint *ptr, lbm_uint n) {
     return 0; // ptr does not point to the start of an allocated range.
   }
 
-  bool done = false;
-  unsigned int i = 0;
-
-  for (i = 0; i < ((bitmap_size << BITMAP_SIZE_SHIFT) - ix); i ++) {
-    if (status(ix+i) == END && i < n) {
-      mutex_unlock(&lbm_mem_mutex);
-      return 0; // cannot shrink allocation to a larger size
-    }
-
-    if (i == (n-1)) {
-      if (status(ix+i) == END ||
-          status(ix+i) == START_END) {
-        done = true;
-      }
-      if (i == 0) {
-        set_status(ix+i, START_END);
-      }
-      else {
-        set_status(ix+i, END);
-      }
-      break;
-    }
+  lbm_uint end = find_end(ix);
+  if (end == NO_BLOCK || n > end - ix + 1) {
+    mutex_unlock(&lbm_mem_mutex);
+    return 0; // cannot shrink allocation to a larger size
   }
-  alloc_offset = ix+i;
 
-  lbm_uint count = 0;
-  if (!done) {
-    i++; // move to next position, prev position should be END or START_END
-    for (;i < ((bitmap_size << BITMAP_SIZE_SHIFT) - ix); i ++) {
-      count ++;
-      if (status(ix+i) == END) {
-        set_status(ix+i, FREE_OR_USED);
-        break;
-      }
+  lbm_uint count = end - ix + 1 - n;
+  if (count > 0) {
+    set_status(end, FREE_OR_USED);
+    if (n == 1) {
+      set_status(ix, START_END);
+    } else {
+      set_status(ix + n - 1, END);
     }
+    free_range(ix + n, count);
   }
 
   memory_num_free += count;
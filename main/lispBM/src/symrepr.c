@@ -33,6 +33,21 @@
 #define ID     1
 #define NEXT   2
 
+// Open addressing hash index from name to symbol. The size must be a
+// power of two. Symbols that do not fit are still found by the linear
+// scans, which are only done once the index is full.
+#ifndef LBM_SYMBOL_HASH_SIZE
+#define LBM_SYMBOL_HASH_SIZE   1024
+#endif
+#define SYMBOL_HASH_MASK       (LBM_SYMBOL_HASH_SIZE - 1)
+#define SYMBOL_HASH_MAX_LOAD   ((LBM_SYMBOL_HASH_SIZE * 3) / 4)
+#define SYMBOL_HASH_EMPTY      0
+
+// Number of runtime symbols that are indexed by id.
+#ifndef LBM_SYMBOL_INDEX_SIZE
+#define LBM_SYMBOL_INDEX_SIZE  512
+#endif
+
 typedef struct {
   const char *name;
   const lbm_uint id;
@@ -81,6 +96,7 @@ special_sym const special_symbols[] =  {
   {"trap"         , SYM_TRAP},
   {"rest-args"    , SYM_REST_ARGS},
   {"rotate"       , SYM_ROTATE},
+  {"bytecode-compile", SYM_BYTECODE_COMPILE},
 
   // pattern matching
   {"?"          , SYM_MATCH_ANY},
@@ -112,6 +128,7 @@ special_sym const special_symbols[] =  {
   {"$nonsense"       , SYM_NONSENSE},
   {"$dm-array"       , SYM_DEFRAG_ARRAY_TYPE},
   {"$dm"             , SYM_DEFRAG_MEM_TYPE},
+  {"$bytecode"       , SYM_BYTECODE},
 
   // tokenizer symbols with unparsable names
   {"[openpar]"        , SYM_OPENPAR},
@@ -252,9 +269,108 @@ static lbm_uint symbol_table_size_list_flash = 0;
 static lbm_uint symbol_table_size_strings = 0;
 static lbm_uint symbol_table_size_strings_flash = 0;
 
+// A hash slot refers to special_symbols[ref - 1] when ref is below
+// EXTENSION_SYMBOLS_START and holds the symbol id otherwise.
+static uint32_t symbol_hash[LBM_SYMBOL_HASH_SIZE];
+static lbm_uint symbol_hash_num = 0;
+static bool symbol_hash_full = false;
+// Symbol list entries of runtime symbols by id - RUNTIME_SYMBOLS_START.
+static lbm_uint *symbol_index[LBM_SYMBOL_INDEX_SIZE];
+
 lbm_value symbol_x = ENC_SYM_NIL;
 lbm_value symbol_y = ENC_SYM_NIL;
 
+static uint32_t name_hash(const char *name) {
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  while (*name) {
+    h ^= (uint8_t)*name++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static const char *hash_ref_name(uint32_t ref) {
+  if (ref < EXTENSION_SYMBOLS_START) {
+    return special_symbols[ref - 1].name;
+  }
+  return lbm_get_name_by_symbol(ref);
+}
+
+static lbm_uint hash_ref_id(uint32_t ref) {
+  if (ref < EXTENSION_SYMBOLS_START) {
+    return special_symbols[ref - 1].id;
+  }
+  return ref;
+}
+
+static void hash_insert(const char *name, uint32_t ref) {
+  uint32_t h = name_hash(name) & SYMBOL_HASH_MASK;
+  while (symbol_hash[h] != SYMBOL_HASH_EMPTY) {
+    if (symbol_hash[h] == ref) return;
+    h = (h + 1) & SYMBOL_HASH_MASK;
+  }
+  if (symbol_hash_num >= SYMBOL_HASH_MAX_LOAD) {
+    symbol_hash_full = true;
+    return;
+  }
+  symbol_hash[h] = ref;
+  symbol_hash_num ++;
+}
+
+// Slots are never removed. A slot of a cleared extension has no name
+// and is skipped.
+static bool hash_lookup(char *name, lbm_uint *id) {
+  uint32_t h = name_hash(name) & SYMBOL_HASH_MASK;
+  while (symbol_hash[h] != SYMBOL_HASH_EMPTY) {
+    const char *str = hash_ref_name(symbol_hash[h]);
+    if (str && str_eq(name, (char *)str)) {
+      *id = hash_ref_id(symbol_hash[h]);
+      return true;
+    }
+    h = (h + 1) & SYMBOL_HASH_MASK;
+  }
+  return false;
+}
+
+static void index_symbol_list_entry(lbm_uint *entry) {
+  lbm_uint ix = entry[ID] - RUNTIME_SYMBOLS_START;
+  if (ix < LBM_SYMBOL_INDEX_SIZE) {
+    symbol_index[ix] = entry;
+  }
+  hash_insert((const char *)entry[NAME], (uint32_t)entry[ID]);
+}
+
+void lbm_symrepr_index_symbol(char *name, lbm_uint id) {
+  hash_insert(name, (uint32_t)id);
+}
+
+// Leaves only the special symbols in the index.
+static void index_clear(void) {
+  memset(symbol_hash, 0, sizeof(symbol_hash));
+  memset(symbol_index, 0, sizeof(symbol_index));
+  symbol_hash_num = 0;
+  symbol_hash_full = false;
+
+  for (unsigned int i = 0; i < NUM_SPECIAL_SYMBOLS; i ++) {
+    hash_insert(special_symbols[i].name, (uint32_t)(i + 1));
+  }
+}
+
+void lbm_symrepr_rebuild_index(void) {
+  index_clear();
+  for (unsigned int i = 0; i < lbm_get_max_extensions(); i ++) {
+    if (extension_table[i].name) {
+      hash_insert(extension_table[i].name, (uint32_t)(EXTENSION_SYMBOLS_START + i));
+    }
+  }
+  lbm_uint *curr = symlist;
+  while (curr) {
+    index_symbol_list_entry(curr);
+    curr = (lbm_uint *)curr[NEXT];
+  }
+}
+
 int lbm_symrepr_init(void) {
   symlist = NULL;
   next_symbol_id = RUNTIME_SYMBOLS_START;
@@ -262,6 +378,9 @@ int lbm_symrepr_init(void) {
   symbol_table_size_list_flash = 0;
   symbol_table_size_strings = 0;
   symbol_table_size_strings_flash = 0;
+  // The extension table may still be the one of a previous run, so it is
+  // not indexed here. lbm_extensions_init rebuilds the index.
+  index_clear();
 
   lbm_uint x = 0;
   lbm_uint y = 0;
@@ -283,6 +402,11 @@ void lbm_symrepr_name_iterator(symrepr_name_iterator_fun f) {
 
 const char *lookup_symrepr_name_memory(lbm_uint id) {
 
+  lbm_uint ix = id - RUNTIME_SYMBOLS_START;
+  if (ix < LBM_SYMBOL_INDEX_SIZE) {
+    return symbol_index[ix] ? (const char *)symbol_index[ix][NAME] : NULL;
+  }
+
   lbm_uint *curr = symlist;
   while (curr) {
     if (id == curr[ID]) {
@@ -320,6 +444,15 @@ const char *lbm_get_name_by_symbol(lbm_uint id) {
 }
 
 lbm_uint *lbm_get_symbol_list_entry_by_name(char *name) {
+  lbm_uint id;
+  if (hash_lookup(name, &id)) {
+    if (id < RUNTIME_SYMBOLS_START) return NULL;
+    lbm_uint ix = id - RUNTIME_SYMBOLS_START;
+    if (ix < LBM_SYMBOL_INDEX_SIZE) return symbol_index[ix];
+  } else if (!symbol_hash_full) {
+    return NULL;
+  }
+
   lbm_uint *curr = symlist;
   while (curr) {
     char *str = (char*)curr[NAME];
@@ -334,6 +467,9 @@ lbm_uint *lbm_get_symbol_list_entry_by_name(char *name) {
 // Lookup symbol id given symbol name
 int lbm_get_symbol_by_name(char *name, lbm_uint* id) {
 
+  if (hash_lookup(name, id)) return 1;
+  if (!symbol_hash_full) return 0;
+
   // loop through special symbols
   for (unsigned int i = 0; i < NUM_SPECIAL_SYMBOLS; i ++) {
     if (str_eq(name, (char *)special_symbols[i].name)) {
@@ -410,6 +546,7 @@ static bool add_symbol_to_symtab(char* name, lbm_uint id) {
   m[NEXT] = (lbm_uint) symlist;
   symlist = m;
   m[ID] =id;
+  index_symbol_list_entry(m);
   return true;
 }
 
@@ -422,6 +559,7 @@ static bool add_symbol_to_symtab_flash(lbm_uint name, lbm_uint id) {
   if (lbm_write_const_raw(entry,3, &entry_addr) == LBM_FLASH_WRITE_OK) {
     symlist = (lbm_uint*)entry_addr;
     symbol_table_size_list_flash += 3;
+    index_symbol_list_entry(symlist);
     return true;
   }
   return false;
@@ -471,6 +609,7 @@ int lbm_add_symbol_const_base(char *name, lbm_uint* id) {
   m[NEXT] = (lbm_uint) symlist;
   symlist = m;
   m[ID] = next_symbol_id;
+  index_symbol_list_entry(m);
   *id = next_symbol_id ++;
   return 1;
 }
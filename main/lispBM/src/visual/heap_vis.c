@@ -48,21 +48,23 @@ void heap_vis_gen_image(void) {
 
   if (pix_data == NULL) return; 
   
-  uint32_t *heap = (uint32_t*)hs.heap;
+  const uint32_t word_bits = sizeof(lbm_uint) * 8;
 
-  for (i = 0; i < num_pix*2; i +=2 ) {
+  for (i = 0; i < num_pix; i ++) {
 
-    //uint32_t car = heap[i];
-    uint32_t cdr = heap[i+1];
     rgb_t col = used_color; 
 
-    
-    
-    if ((cdr & LBM_GC_MASK) == LBM_GC_MARKED) {
+    bool marked;
+    if (hs.gc_mark_bits) {
+      marked = hs.gc_mark_bits[i / word_bits] & ((lbm_uint)1 << (i % word_bits));
+    } else {
+      marked = (hs.heap[i].cdr & LBM_GC_MASK) == LBM_GC_MARKED;
+    }
+    if (marked) {
       col = marked_color; 
     }
 
-    pix_data[i/2] = col; 
+    pix_data[i] = col; 
   }
 
   uint32_t fl = hs.freelist; 
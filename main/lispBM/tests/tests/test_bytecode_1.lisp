@@ -0,0 +1,39 @@
+(defun sum-to (n acc)
+  (if (= n 0) acc
+    (sum-to (- n 1) (+ acc n))))
+
+(defun collatz (n steps)
+  (cond ((= n 1) steps)
+        ((= (mod n 2) 0) (collatz (/ n 2) (+ steps 1)))
+        (t (collatz (+ (* 3 n) 1) (+ steps 1)))))
+
+(defun build (n acc)
+  (let ((m (- n 1)))
+    (if (< n 1) acc
+      (build m (cons n acc)))))
+
+(define k 10)
+(defun add-k (x) (and x (or nil (+ x k))))
+
+(defun uses-print (x) (progn (print x) x))
+
+(define r1 (sum-to 1000 0))
+(define r2 (collatz 27 0))
+(define r3 (build 100 nil))
+(define r4 (add-k 1))
+
+(define c1 (bytecode-compile 'sum-to))
+(define c2 (bytecode-compile 'collatz))
+(define c3 (bytecode-compile 'build))
+(define c4 (bytecode-compile 'add-k))
+(define c5 (bytecode-compile 'uses-print))
+
+(setq k 20)
+
+(check (and c1 c2 c3 c4 (not c5)
+            (= (sum-to 1000 0) r1)
+            (= (collatz 27 0) r2)
+            (eq (build 100 nil) r3)
+            (= (add-k 1) 21)
+            (eq (add-k nil) nil)
+            (eq (trap (sum-to 'a 0)) '(exit-error type_error))))
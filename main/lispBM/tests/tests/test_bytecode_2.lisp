@@ -0,0 +1,38 @@
+(defun g (x) (+ x 1))
+(defun h (x) (if (= x 0) 'zero 'other))
+
+(define c1 (bytecode-compile 'g))
+(define c2 (bytecode-compile 'h))
+
+(define r1 (g 2))
+(define r2 (h 0))
+
+(define g-code (ix (ix g 2) 2))
+(define h-code (ix (ix h 2) 2))
+
+; STORE 255 LOAD 255 RET, registers out of range
+(bufset-u8 g-code 4 2)
+(bufset-u8 g-code 5 255)
+(bufset-u8 g-code 6 1)
+(bufset-u8 g-code 7 255)
+(bufset-u8 g-code 8 11)
+(define r3 (trap (g 2)))
+
+; CONST 200, constant out of range
+(bufset-u8 g-code 4 0)
+(bufset-u8 g-code 5 200)
+(bufset-u8 g-code 6 11)
+(define r4 (trap (g 2)))
+
+; Jump past the end of the code
+(define h-len (buflen h-code))
+(bufset-u8 h-code 12 (shr h-len 8))
+(bufset-u8 h-code 13 (bitwise-and h-len 255))
+(define r5 (trap (h 0)))
+
+(check (and c1 c2
+            (= r1 3)
+            (eq r2 'zero)
+            (eq r3 '(exit-error eval_error))
+            (eq r4 '(exit-error eval_error))
+            (eq r5 '(exit-error eval_error))))
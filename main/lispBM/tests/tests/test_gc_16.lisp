@@ -0,0 +1,18 @@
+(set-gc-sweep-budget 16)
+
+(define steps0 (lbm-heap-state 'get-gc-num-sweep-steps))
+
+(define churn (lambda (n acc)
+                (if (= n 0) acc
+                  (progn
+                    (range 0 200)
+                    (churn (- n 1) (cons n acc))))))
+
+(define ls (churn 200 nil))
+
+(define steps1 (lbm-heap-state 'get-gc-num-sweep-steps))
+
+(check (and (= (length ls) 200)
+            (= (first ls) 1)
+            (= (ix ls 199) 200)
+            (> steps1 steps0)))
@@ -0,0 +1,28 @@
+(define arr (mkarray 4))
+(define ls (list 0 0 0 0))
+(define last-f 0)
+(define keep (lambda (x) (lambda () x)))
+
+(define churn (lambda (n acc)
+                (if (= n 0) acc
+                  (let ((f (+ 0.5 n))
+                        (d (+ 0.25f64 n))
+                        (i (+ 1i64 n)))
+                    (progn
+                      (setix arr (mod n 4) d)
+                      (setcar ls i)
+                      (setcdr (cdr ls) (list (list n d)))
+                      (setq last-f f)
+                      (setq acc (keep f))
+                      (churn (- n 1) acc))))))
+
+(define clo (churn 1000 nil))
+
+(check (and (= (clo) 1.5)
+            (= last-f 1.5)
+            (= (ix arr 1) 1.25f64)
+            (= (ix arr 2) 2.25f64)
+            (= (ix arr 3) 3.25f64)
+            (= (ix arr 0) 4.25f64)
+            (= (car ls) 2i64)
+            (eq (ix ls 2) '(1 1.25f64))))
@@ -0,0 +1,30 @@
+(define bufs nil)
+(define blocks-before 0)
+(define longest-before 0)
+(define blocks-frag 0)
+
+(defun mk (n acc)
+  (if (= n 0) acc
+    (mk (- n 1) (cons (bufcreate (* (word-size) (+ 1 (mod n 7)))) acc))))
+
+(defun free-every-other (ls)
+  (if (eq ls nil) nil
+    (progn
+      (free (car ls))
+      (if (eq (cdr ls) nil) nil
+        (free-every-other (cdr (cdr ls)))))))
+
+(gc)
+(setq blocks-before (mem-num-free-blocks))
+(setq longest-before (mem-longest-free))
+
+(setq bufs (mk 100 nil))
+(free-every-other bufs)
+(setq blocks-frag (mem-num-free-blocks))
+
+(setq bufs nil)
+(gc)
+
+(check (and (> blocks-frag blocks-before)
+            (= (mem-num-free-blocks) blocks-before)
+            (= (mem-longest-free) longest-before)))
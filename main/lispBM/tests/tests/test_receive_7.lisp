@@ -0,0 +1,34 @@
+
+(set-mailbox-size 16)
+
+(defun send-all (i n)
+  (if (< i n) {
+      (send (self) (list (if (= (mod i 2) 0) 'even 'odd) i))
+      (send-all (+ i 1) n)
+      }))
+
+(defun recv-odd (n acc)
+  (if (= n 0) (reverse acc)
+    (recv ((odd (? i)) (recv-odd (- n 1) (cons i acc))))))
+
+(defun recv-even (n acc)
+  (if (= n 0) (reverse acc)
+    (recv ((even (? i)) (recv-even (- n 1) (cons i acc))))))
+
+;; The oldest messages are dropped and the mailbox wraps around.
+(send-all 0 24)
+(define r1 (eq (recv-odd 8 nil) '(9 11 13 15 17 19 21 23)))
+(define r2 (eq (recv-even 8 nil) '(8 10 12 14 16 18 20 22)))
+
+;; Receiving from the middle keeps the order of the rest.
+(send-all 0 6)
+(define r3 (= (recv ((odd (? i)) i)) 1))
+(define r4 (eq (recv ((? x) x)) '(even 0)))
+(define r5 (eq (recv ((_ 2) 'two) ((even (? i)) i)) 'two))
+
+;; Shrinking the mailbox keeps the newest messages.
+(set-mailbox-size 2)
+(define r6 (eq (recv ((? x) x)) '(even 4)))
+(define r7 (eq (recv ((? x) x)) '(odd 5)))
+
+(check (and r1 r2 r3 r4 r5 r6 r7))
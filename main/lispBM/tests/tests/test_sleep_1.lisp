@@ -0,0 +1,30 @@
+
+(define me (self))
+
+(defun sleeper (i) {
+       (sleep (* 0.05 i))
+       (send me i)
+       })
+
+;; Spawned in the opposite order of when they wake up.
+(defun spawn-sleepers (i)
+  (if (> i 0) {
+      (spawn 64 sleeper i)
+      (spawn-sleepers (- i 1))
+      }))
+
+(spawn-sleepers 6)
+
+(defun collect (n acc)
+  (if (= n 0) (reverse acc)
+    (recv ((? x) (collect (- n 1) (cons x acc))))))
+
+(define r1 (eq (collect 6 nil) '(1 2 3 4 5 6)))
+
+;; A thread blocked in recv is not woken up by time passing.
+(define waiter (spawn 64 (fn () (recv ((? x) (send me x))))))
+(sleep 0.1)
+(send waiter 'hello)
+(define r2 (eq (recv ((? x) x)) 'hello))
+
+(check (and r1 r2))
@@ -0,0 +1,20 @@
+
+(defun mk-sym (n) (str2sym (str-join (list "sym-" (str-from-n n)))))
+
+(defun mk-syms (n acc)
+  (if (= n 0) acc
+    (mk-syms (- n 1) (cons (mk-sym n) acc))))
+
+(defun same-syms (n ls)
+  (if (eq ls nil) t
+    (if (and (eq (car ls) (mk-sym n))
+             (eq (sym2str (car ls)) (str-join (list "sym-" (str-from-n n)))))
+        (same-syms (+ n 1) (cdr ls))
+      nil)))
+
+(define syms (mk-syms 200 nil))
+
+(check (and (same-syms 1 syms)
+            (eq 'first 'car)
+            (eq (sym2str 'first) "car")
+            (eq (str2sym "str-join") 'str-join)))
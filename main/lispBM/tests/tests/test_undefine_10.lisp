@@ -0,0 +1,19 @@
+(define a 1)
+(defun f (x) (+ x a))
+
+(defun loop-f (n acc)
+  (if (= n 0) acc
+    (loop-f (- n 1) (f acc))))
+
+(define r1 (= (loop-f 10 0) 10))
+
+(setq a 2)
+(define r2 (= (loop-f 10 0) 20))
+
+(undefine 'a)
+(define r3 (eq (trap (f 1)) '(exit-error variable_not_bound)))
+
+(define a 3)
+(define r4 (= (loop-f 10 0) 30))
+
+(check (and r1 r2 r3 r4))
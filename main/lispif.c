@@ -27,6 +27,7 @@
 #include "terminal.h"
 #include "buffer.h"
 #include "lispbm.h"
+#include "lbm_flat_value.h"
 #include "mempools.h"
 #include "flash_helper.h"
 #include "conf_general.h"
@@ -43,6 +44,8 @@
 #define USER_EXTENSION_STORAGE_SIZE 0
 #endif
 #define PROF_DATA_NUM			30
+#define EVENT_POOL_BUFS			16
+#define EVENT_POOL_BUF_SIZE		64
 #define EXT_LOAD_CALLBACK_LEN	10
 
 static size_t heap_size = 0;
@@ -370,10 +373,14 @@ void lispif_process_cmd(unsigned char *data, unsigned int len,
 				commands_printf_lisp("Recovered arrays: %u\n", lbm_heap_state.gc_recovered_arrays);
 				commands_printf_lisp("Marked: %d\n", lbm_heap_state.gc_marked);
 				commands_printf_lisp("GC SP max: %u (size %u)\n", lbm_get_max_stack(&lbm_heap_state.gc_stack), lbm_heap_state.gc_stack.size);
+				commands_printf_lisp("GC sweep steps: %u\n", lbm_heap_state.gc_sweep_steps);
+				commands_printf_lisp("GC pause last: %u us (max %u us)\n", lbm_heap_state.gc_time_last, lbm_heap_state.gc_time_max);
+				commands_printf_lisp("Minor GC counter: %u\n", lbm_heap_state.gc_num_minor);
 				commands_printf_lisp("--(Symbol and Array memory)--\n");
 				commands_printf_lisp("Memory size: %u bytes\n", lbm_memory_num_words() * 4);
 				commands_printf_lisp("Memory free: %u bytes\n", lbm_memory_num_free() * 4);
 				commands_printf_lisp("Longest block free: %u bytes\n", lbm_memory_longest_free() * 4);
+				commands_printf_lisp("Free blocks: %u\n", lbm_memory_num_free_blocks());
 				commands_printf_lisp("Allocated arrays: %u\n", lbm_heap_state.num_alloc_arrays);
 				commands_printf_lisp("Symbol table size: %u Bytes\n", lbm_get_symbol_table_size());
 				commands_printf_lisp("Symbol table size flash: %u Bytes\n", lbm_get_symbol_table_size_flash());
@@ -725,6 +732,7 @@ bool lispif_restart(bool print, bool load_code, bool load_imports) {
 					PRINT_STACK_SIZE,
 					extension_storage, EXTENSION_STORAGE_SIZE + USER_EXTENSION_STORAGE_SIZE);
 			lbm_eval_init_events(20);
+			lbm_flat_value_pool_init(EVENT_POOL_BUFS, EVENT_POOL_BUF_SIZE);
 
 			lbm_set_timestamp_us_callback(timestamp_callback);
 			lbm_set_usleep_callback(sleep_callback);
@@ -747,6 +755,7 @@ bool lispif_restart(bool print, bool load_code, bool load_imports) {
 					PRINT_STACK_SIZE,
 					extension_storage, EXTENSION_STORAGE_SIZE + USER_EXTENSION_STORAGE_SIZE);
 			lbm_eval_init_events(20);
+			lbm_flat_value_pool_init(EVENT_POOL_BUFS, EVENT_POOL_BUF_SIZE);
 		}
 
 		lbm_pause_eval();
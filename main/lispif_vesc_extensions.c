@@ -46,6 +46,7 @@
 #include "nmea.h"
 #include "ublox.h"
 #include "log_comm.h"
+#include "file_writer.h"
 #include "comm_wifi.h"
 #include "enc_as504x.h"
 #include "imu.h"
@@ -1259,22 +1260,14 @@ static int cmp_int (const void * a, const void * b) {
 static lbm_value ext_can_list_devs(lbm_value *args, lbm_uint argn) {
 	(void)args; (void)argn;
 
+	// Slots are shared with other status messages, so there can be gaps
 	int dev_num = 0;
-	can_status_msg *msg = comm_can_get_status_msg_index(dev_num);
+	int devs[CAN_STATUS_MSGS_TO_STORE];
 
-	while (msg && msg->id >= 0) {
-		dev_num++;
-		msg = comm_can_get_status_msg_index(dev_num);
-	}
-
-	int devs[dev_num];
-
-	for (int i = 0;i < dev_num;i++) {
-		msg = comm_can_get_status_msg_index(i);
-		if (msg) {
-			devs[i] = msg->id;
-		} else {
-			devs[i] = -1;
+	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
+		can_status_msg *msg = comm_can_get_status_msg_index(i);
+		if (msg && msg->id >= 0) {
+			devs[dev_num++] = msg->id;
 		}
 	}
 
@@ -1620,7 +1613,7 @@ static void bms_cmd_handler(COMM_PACKET_ID cmd, int param1, int param2) {
 				f_sym(&v, ENC_SYM_NIL);
 
 				if (!lbm_event(&v)) {
-					lbm_free(v.buf);
+					lbm_flat_value_free_buf(v.buf);
 				}
 			}
 		}
@@ -1639,7 +1632,7 @@ static void bms_cmd_handler(COMM_PACKET_ID cmd, int param1, int param2) {
 				f_sym(&v, ENC_SYM_NIL);
 
 				if (!lbm_event(&v)) {
-					lbm_free(v.buf);
+					lbm_flat_value_free_buf(v.buf);
 				}
 			}
 		}
@@ -1658,7 +1651,7 @@ static void bms_cmd_handler(COMM_PACKET_ID cmd, int param1, int param2) {
 				f_sym(&v, ENC_SYM_NIL);
 
 				if (!lbm_event(&v)) {
-					lbm_free(v.buf);
+					lbm_flat_value_free_buf(v.buf);
 				}
 			}
 		}
@@ -1675,7 +1668,7 @@ static void bms_cmd_handler(COMM_PACKET_ID cmd, int param1, int param2) {
 				f_sym(&v, ENC_SYM_NIL);
 
 				if (!lbm_event(&v)) {
-					lbm_free(v.buf);
+					lbm_flat_value_free_buf(v.buf);
 				}
 			}
 		}
@@ -1688,7 +1681,7 @@ static void bms_cmd_handler(COMM_PACKET_ID cmd, int param1, int param2) {
 				f_sym(&v, sym_bms_zero_ofs);
 
 				if (!lbm_event(&v)) {
-					lbm_free(v.buf);
+					lbm_flat_value_free_buf(v.buf);
 				}
 			}
 		}
@@ -2164,11 +2157,11 @@ static void esp_rx_fun(void *arg) {
 
 			if (esp_now_recv_cid >= 0) {
 				if (!lbm_unblock_ctx(esp_now_recv_cid, &v)) {
-					lbm_free(v.buf);
+					lbm_flat_value_free_buf(v.buf);
 				}
 			} else {
 				if (!lbm_event(&v)) {
-					lbm_free(v.buf);
+					lbm_flat_value_free_buf(v.buf);
 				}
 			}
 		}
@@ -3011,7 +3004,10 @@ static lbm_value ext_buf_resize(lbm_value *args, lbm_uint argn) {
 // Logging
 
 static lbm_value ext_log_start(lbm_value *args, lbm_uint argn) {
-	LBM_CHECK_ARGN(5);
+	if (argn != 5 && argn != 6) {
+		lbm_set_error_reason((char*)lbm_error_str_num_args);
+		return ENC_SYM_EERROR;
+	}
 
 	if (!lbm_is_number(args[0]) ||
 			!lbm_is_number(args[1]) ||
@@ -3021,13 +3017,29 @@ static lbm_value ext_log_start(lbm_value *args, lbm_uint argn) {
 		return ENC_SYM_EERROR;
 	}
 
+	// Optional format: 0 = CSV, 1 = binary, 2 = binary with delta encoding
+	LOG_FORMAT format = LOG_FORMAT_CSV;
+	if (argn == 6) {
+		if (!lbm_is_number(args[5])) {
+			return ENC_SYM_TERROR;
+		}
+
+		int f = lbm_dec_as_i32(args[5]);
+		if (f < LOG_FORMAT_CSV || f > LOG_FORMAT_BIN_DELTA) {
+			return ENC_SYM_EERROR;
+		}
+
+		format = f;
+	}
+
 	log_comm_start(
 			lbm_dec_as_i32(args[0]),
 			lbm_dec_as_i32(args[1]),
 			lbm_dec_as_float(args[2]),
 			lbm_is_symbol_true(args[3]),
 			lbm_is_symbol_true(args[4]),
-			lbm_is_symbol_true(args[4]));
+			lbm_is_symbol_true(args[4]),
+			format);
 
 	return ENC_SYM_TRUE;
 }
@@ -3442,7 +3454,9 @@ static lbm_value ext_canmsg_send(lbm_value *args, lbm_uint argn) {
 
 // File System
 #define MAX_FILES 5
-static FILE *files_open[MAX_FILES + 1] = {0};
+#define FILE_WRITE_TIMEOUT_MS 200 // Max time f-write blocks when all buffers are in use
+static FILE *files_open[MAX_FILES] = {0};
+static file_writer_stream files_stream[MAX_FILES];
 static int file_now = 0;
 static const char* str_f_not_open = "File not open.";
 
@@ -3461,17 +3475,28 @@ static char* dec_str_check(lbm_value val) {
 	return res;
 }
 
-static FILE* file_from_arg(lbm_value arg) {
+static int file_ind_from_arg(lbm_value arg) {
 	uint32_t fn = lbm_dec_as_u32(arg);
-	FILE *f = 0;
 	for (int i = 0;i < MAX_FILES;i++) {
-		if ((FILE*)fn == files_open[i]) {
-			f = files_open[i];
-			break;
+		if (files_open[i] && (FILE*)fn == files_open[i]) {
+			return i;
 		}
 	}
 
-	return f;
+	return -1;
+}
+
+static FILE* file_from_arg(lbm_value arg) {
+	int ind = file_ind_from_arg(arg);
+	if (ind < 0) {
+		return 0;
+	}
+
+	// Writes from f-write are done by the writer task, make sure that they
+	// are in the file before it is used directly.
+	file_writer_sync(&files_stream[ind], false);
+
+	return files_open[ind];
 }
 
 // (f-connect pin-mosi pin-miso pin-sck pin-cs optSpiSpeed) -> t or nil
@@ -3569,7 +3594,15 @@ static lbm_value ext_f_open(lbm_value *args, lbm_uint argn) {
 	FILE *f = fopen(path_full, mode);
 
 	if (f) {
-		files_open[file_now++] = f;
+		for (int i = 0;i < MAX_FILES;i++) {
+			if (!files_open[i]) {
+				files_open[i] = f;
+				file_writer_open(&files_stream[i], f, FILE_WRITE_TIMEOUT_MS);
+				break;
+			}
+		}
+
+		file_now++;
 		return lbm_enc_u32((uint32_t)f);
 	} else {
 		return ENC_SYM_NIL;
@@ -3580,31 +3613,17 @@ static lbm_value ext_f_open(lbm_value *args, lbm_uint argn) {
 static lbm_value ext_f_close(lbm_value *args, lbm_uint argn) {
 	LBM_CHECK_ARGN_NUMBER(1);
 
-	uint32_t fn = lbm_dec_as_u32(args[0]);
-	FILE *f = 0;
-	int f_ind = 0;
-	for (int i = 0;i < MAX_FILES;i++) {
-		if ((FILE*)fn == files_open[i]) {
-			f = files_open[i];
-			f_ind = i;
-			break;
-		}
-	}
-
-	if (!f) {
+	int ind = file_ind_from_arg(args[0]);
+	if (ind < 0) {
 		lbm_set_error_reason((char*)str_f_not_open);
 		return ENC_SYM_EERROR;
 	}
 
-	for (int i = f_ind;i < file_now;i++) {
-		files_open[i] = files_open[i + 1];
-	}
-
+	files_open[ind] = 0;
 	file_now--;
 
-	fclose(f);
-
-	return ENC_SYM_TRUE;
+	// Returns false if one of the buffered writes failed
+	return file_writer_close(&files_stream[ind]) ? ENC_SYM_TRUE : ENC_SYM_NIL;
 }
 
 // (f-read file size) -> array
@@ -3682,17 +3701,19 @@ static lbm_value ext_f_write(lbm_value *args, lbm_uint argn) {
 		return ENC_SYM_TERROR;
 	}
 
-	FILE *f = file_from_arg(args[0]);
-	if (!f) {
+	int ind = file_ind_from_arg(args[0]);
+	if (ind < 0) {
 		lbm_set_error_reason((char*)str_f_not_open);
 		return ENC_SYM_EERROR;
 	}
 
+	// Buffered and written by the writer task, so that slow cards do not
+	// block the evaluator. Errors from earlier writes show up in f-sync
+	// and f-close.
 	lbm_array_header_t *array = (lbm_array_header_t *)lbm_car(args[1]);
 	lbm_value res = ENC_SYM_EERROR;
 	if (array) {
-		int wr = fwrite(array->data, 1, array->size, f);
-		if (wr == array->size) {
+		if (file_writer_write(&files_stream[ind], array->data, array->size)) {
 			res = ENC_SYM_TRUE;
 		} else {
 			lbm_set_error_reason("Could not write to file.");
@@ -3702,6 +3723,63 @@ static lbm_value ext_f_write(lbm_value *args, lbm_uint argn) {
 	return res;
 }
 
+// (f-sync file) -> t, nil
+static lbm_value ext_f_sync(lbm_value *args, lbm_uint argn) {
+	LBM_CHECK_ARGN_NUMBER(1);
+
+	int ind = file_ind_from_arg(args[0]);
+	if (ind < 0) {
+		lbm_set_error_reason((char*)str_f_not_open);
+		return ENC_SYM_EERROR;
+	}
+
+	return file_writer_sync(&files_stream[ind], true) ? ENC_SYM_TRUE : ENC_SYM_NIL;
+}
+
+// (f-fsync-interval optMs) -> interval
+static lbm_value ext_f_fsync_interval(lbm_value *args, lbm_uint argn) {
+	if (argn > 1) {
+		lbm_set_error_reason((char*)lbm_error_str_num_args);
+		return ENC_SYM_TERROR;
+	}
+
+	LBM_CHECK_NUMBER_ALL();
+
+	if (argn == 1) {
+		file_writer_set_fsync_interval(lbm_dec_as_i32(args[0]));
+	}
+
+	return lbm_enc_i(file_writer_get_fsync_interval());
+}
+
+// (f-writer-stats) -> (bytes-written writes write-max-ms fsyncs fsync-max-ms stalls drops errors queued)
+static lbm_value ext_f_writer_stats(lbm_value *args, lbm_uint argn) {
+	(void)args; (void)argn;
+
+	file_writer_stats stats;
+	file_writer_get_stats(&stats);
+
+	lbm_value res = ENC_SYM_NIL;
+	res = lbm_cons(lbm_enc_i(stats.queued), res);
+	res = lbm_cons(lbm_enc_u32(stats.errors), res);
+	res = lbm_cons(lbm_enc_u32(stats.drops), res);
+	res = lbm_cons(lbm_enc_u32(stats.stalls), res);
+	res = lbm_cons(lbm_enc_u32(stats.fsync_time_max_ms), res);
+	res = lbm_cons(lbm_enc_u32(stats.fsyncs), res);
+	res = lbm_cons(lbm_enc_u32(stats.write_time_max_ms), res);
+	res = lbm_cons(lbm_enc_u32(stats.writes), res);
+	res = lbm_cons(lbm_enc_u32(stats.bytes_written), res);
+
+	return res;
+}
+
+// (f-writer-stats-reset) -> t
+static lbm_value ext_f_writer_stats_reset(lbm_value *args, lbm_uint argn) {
+	(void)args; (void)argn;
+	file_writer_reset_stats();
+	return ENC_SYM_TRUE;
+}
+
 // (f-tell file) -> position
 static lbm_value ext_f_tell(lbm_value *args, lbm_uint argn) {
 	LBM_CHECK_ARGN_NUMBER(1);
@@ -5654,6 +5732,10 @@ void lispif_load_vesc_extensions(void) {
 	lbm_add_extension("f-read", ext_f_read);
 	lbm_add_extension("f-readline", ext_f_readline);
 	lbm_add_extension("f-write", ext_f_write);
+	lbm_add_extension("f-sync", ext_f_sync);
+	lbm_add_extension("f-fsync-interval", ext_f_fsync_interval);
+	lbm_add_extension("f-writer-stats", ext_f_writer_stats);
+	lbm_add_extension("f-writer-stats-reset", ext_f_writer_stats_reset);
 	lbm_add_extension("f-tell", ext_f_tell);
 	lbm_add_extension("f-seek", ext_f_seek);
 	lbm_add_extension("f-mkdir", ext_f_mkdir);
@@ -5757,9 +5839,11 @@ void lispif_disable_all_events(void) {
 	can_recv_eid_cid = -1;
 	recv_data_cid = -1;
 
-	for (int i = 0;i < file_now;i++) {
-		fclose(files_open[i]);
-		files_open[i] = 0;
+	for (int i = 0;i < MAX_FILES;i++) {
+		if (files_open[i]) {
+			file_writer_close(&files_stream[i]);
+			files_open[i] = 0;
+		}
 	}
 
 	file_now = 0;
@@ -5771,7 +5855,9 @@ void lispif_disable_all_events(void) {
 }
 
 static bool start_flatten_with_gc(lbm_flat_value_t *v, size_t buffer_size) {
-	if (lbm_start_flatten(v, buffer_size)) {
+	// Small values get a buffer from the preallocated pool so that
+	// frequent events such as CAN-frames do not have to wait for GC.
+	if (lbm_start_flatten_pooled(v, buffer_size)) {
 		return true;
 	}
 
@@ -5818,17 +5904,17 @@ void lispif_process_can(uint32_t can_id, uint8_t *data8, int len, bool is_ext) {
 
 		if (can_recv_sid_cid >= 0 && !is_ext) {
 			if (!lbm_unblock_ctx(can_recv_sid_cid, &v)) {
-				lbm_free(v.buf);
+				lbm_flat_value_free_buf(v.buf);
 			}
 			can_recv_sid_cid = -1;
 		} else if (can_recv_eid_cid >= 0 && is_ext) {
 			if (!lbm_unblock_ctx(can_recv_eid_cid, &v)) {
-				lbm_free(v.buf);
+				lbm_flat_value_free_buf(v.buf);
 			}
 			can_recv_eid_cid = -1;
 		} else {
 			if (!lbm_event(&v)) {
-				lbm_free(v.buf);
+				lbm_flat_value_free_buf(v.buf);
 			}
 		}
 	}
@@ -5850,12 +5936,12 @@ void lispif_process_custom_app_data(unsigned char *data, unsigned int len) {
 
 		if (recv_data_cid >= 0) {
 			if (!lbm_unblock_ctx(recv_data_cid, &v)) {
-				lbm_free(v.buf);
+				lbm_flat_value_free_buf(v.buf);
 			}
 			recv_data_cid = -1;
 		} else {
 			if (!lbm_event(&v)) {
-				lbm_free(v.buf);
+				lbm_flat_value_free_buf(v.buf);
 			}
 		}
 	}
@@ -5879,7 +5965,7 @@ void lispif_process_rmsg(int slot, unsigned char *data, unsigned int len) {
 		lbm_finish_flatten(&v);
 
 		if (!lbm_unblock_ctx(rmsg_slots[slot].cid, &v)) {
-			lbm_free(v.buf);
+			lbm_flat_value_free_buf(v.buf);
 		}
 
 		rmsg_slots[slot].cid = -1;
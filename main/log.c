@@ -27,12 +27,15 @@
 #include "buffer.h"
 #include "utils.h"
 #include "esp_vfs_fat_nand.h"
+#include "file_writer.h"
 
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <math.h>
 
 typedef struct {
 	char key[25];
@@ -41,11 +44,55 @@ typedef struct {
 	int8_t precision;
 	bool is_relative;
 	bool is_timestamp;
-	double value;
-	bool updated;
 } log_header;
 
 #define LOG_MAX_FIELDS		120
+#define LOG_FIELD_WORDS		((LOG_MAX_FIELDS + 31) / 32)
+#define LOG_UPDATE_CHUNK	16 // Field values stored per critical section
+
+/*
+ * Binary log format (.bin), all numbers big endian. Use
+ * tools/log_bin_to_csv.py to convert it to the CSV layout.
+ *
+ * Header:
+ * "VLOG", uint8 version, uint8 format, uint16 columns, float32 rate_hz
+ * For each column:
+ * key\0 name\0 unit\0 int8 precision, uint8 is_relative,
+ * uint8 is_timestamp, uint8 encoding, uint8 print precision
+ *
+ * Records:
+ * 0x01, presence bitmap (1 bit per column, LSB first), then one value per
+ * present column. 0x00 where a record is expected is padding.
+ *
+ * Encodings:
+ * LOG_BIN_ENC_F32: IEEE float32
+ * LOG_BIN_ENC_F64: IEEE float64
+ * LOG_BIN_ENC_DELTA: The value is scaled with 10^(print precision) and
+ * rounded. The difference to the previous value in the column is stored as
+ * zigzag varint + 1. A 0 varint means that an IEEE float64 follows, which is
+ * used for values that cannot be scaled. The previous value starts at 0.
+ */
+#define LOG_BIN_VERSION			1
+#define LOG_BIN_MAX_COLS		(LOG_MAX_FIELDS + 7)
+#define LOG_COL_WORDS			((LOG_BIN_MAX_COLS + 31) / 32)
+#define LOG_BIN_REC_MAX			(1 + (LOG_BIN_MAX_COLS + 7) / 8 + LOG_BIN_MAX_COLS * 10)
+#define LOG_BIN_SECTOR_SIZE		512
+#define LOG_BIN_REC_SAMPLE		0x01
+#define LOG_BIN_ENC_F32			0
+#define LOG_BIN_ENC_F64			1
+#define LOG_BIN_ENC_DELTA		2
+
+typedef struct {
+	int fields;
+	int cols;
+	uint8_t enc[LOG_BIN_MAX_COLS];
+	uint8_t print_prec[LOG_BIN_MAX_COLS];
+	int64_t last[LOG_BIN_MAX_COLS];
+	int64_t next[LOG_BIN_MAX_COLS];
+	uint8_t rec[LOG_BIN_REC_MAX];
+} log_bin_state;
+
+#define LOG_CSV_LINE_LEN		FILE_WRITER_BUF_SIZE
 
 char *file_basepath = "/sdcard/";
 
@@ -56,6 +103,17 @@ static spi_nand_flash_device_t *nand_flash_device_handle = 0;
 
 static volatile log_header m_headers[LOG_MAX_FIELDS];
 
+// Field values are kept apart from the metadata. Writers set the dirty bit
+// of each field they update, and the log task only visits dirty fields.
+static portMUX_TYPE m_field_lock = portMUX_INITIALIZER_UNLOCKED;
+static double m_values[LOG_MAX_FIELDS];
+static uint32_t m_dirty[LOG_FIELD_WORDS];
+
+// Values of the sample being written, taken from m_values with the
+// special columns after the fields.
+static double m_sample[LOG_BIN_MAX_COLS];
+static uint32_t m_sample_present[LOG_COL_WORDS];
+
 static log_header m_header_ts;
 static log_header m_header_ts_gnss;
 static log_header m_header_lat;
@@ -69,19 +127,320 @@ static volatile float m_rate_hz = 10.0;
 static volatile bool m_append_time = false;
 static volatile bool m_append_gnss = false;
 static volatile bool m_append_gnss_time = false;
+static volatile LOG_FORMAT m_format = LOG_FORMAT_CSV;
 
-static void print_header(log_header *h, FILE *file) {
-	fprintf(file, "%s:%s:%s:%d:%d:%d",
+static file_writer_stream m_stream;
+static char *m_line = 0;
+static int m_line_len = 0;
+
+static void print_header(log_header *h) {
+	file_writer_printf(&m_stream, "%s:%s:%s:%d:%d:%d",
 			h->key, h->name, h->unit,
 			h->precision, h->is_relative, h->is_timestamp);
 }
 
+/**
+ * Format into the current CSV line, which is written as a whole so that
+ * a line is either logged completely or dropped.
+ */
+static void line_printf(const char *fmt, ...) {
+	int left = LOG_CSV_LINE_LEN - m_line_len;
+
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(m_line + m_line_len, left, fmt, args);
+	va_end(args);
+
+	if (n > 0) {
+		m_line_len += n < left ? n : left - 1;
+	}
+}
+
+static void line_separators(int num) {
+	int left = LOG_CSV_LINE_LEN - 1 - m_line_len;
+	if (num > left) {
+		num = left;
+	}
+
+	if (num > 0) {
+		memset(m_line + m_line_len, ';', num);
+		m_line_len += num;
+	}
+}
+
+/**
+ * Move the dirty fields below num to the sample and clear their dirty
+ * bits. The lock is only held for one bitmap word at a time, so writers
+ * are never blocked for long.
+ */
+static void sample_take_fields(int num) {
+	memset(m_sample_present, 0, sizeof(m_sample_present));
+
+	for (int w = 0;w < (num + 31) / 32;w++) {
+		uint32_t mask = 0xFFFFFFFF;
+		if ((w + 1) * 32 > num) {
+			mask = (1u << (num % 32)) - 1;
+		}
+
+		portENTER_CRITICAL(&m_field_lock);
+		uint32_t bits = m_dirty[w] & mask;
+		m_dirty[w] &= ~bits;
+
+		uint32_t b = bits;
+		while (b) {
+			int i = w * 32 + __builtin_ctz(b);
+			b &= b - 1;
+			m_sample[i] = m_values[i];
+		}
+		portEXIT_CRITICAL(&m_field_lock);
+
+		m_sample_present[w] = bits;
+	}
+}
+
+static void sample_set(int col, double value, bool present) {
+	m_sample[col] = value;
+	if (present) {
+		m_sample_present[col / 32] |= 1u << (col % 32);
+	}
+}
+
+/**
+ * Decode consecutive field values starting at field_ind. The values are
+ * decoded a few at a time into a local buffer and the lock is only held
+ * while they are stored, so interrupts stay enabled during the decode.
+ */
+static void fields_update(int field_ind, unsigned char *data, int32_t ind,
+		unsigned int len, bool f64) {
+	double vals[LOG_UPDATE_CHUNK];
+
+	while (field_ind < LOG_MAX_FIELDS && ind < (int32_t)len) {
+		int num = 0;
+		while (num < LOG_UPDATE_CHUNK && (field_ind + num) < LOG_MAX_FIELDS &&
+				ind < (int32_t)len) {
+			vals[num++] = f64 ? buffer_get_float64_auto(data, &ind) :
+					buffer_get_float32_auto(data, &ind);
+		}
+
+		portENTER_CRITICAL(&m_field_lock);
+		for (int i = 0;i < num;i++) {
+			int f = field_ind + i;
+			m_values[f] = vals[i];
+			m_dirty[f / 32] |= 1u << (f % 32);
+		}
+		portEXIT_CRITICAL(&m_field_lock);
+
+		field_ind += num;
+	}
+}
+
+/**
+ * Pad what is buffered with zeros to a multiple of the sector size and pass
+ * it to the writer, so that the file offset stays sector aligned.
+ */
+static void bin_flush(log_bin_state *st) {
+	int pad = (LOG_BIN_SECTOR_SIZE - m_stream.len % LOG_BIN_SECTOR_SIZE) % LOG_BIN_SECTOR_SIZE;
+	memset(st->rec, 0, pad);
+	file_writer_write(&m_stream, st->rec, pad);
+	file_writer_submit(&m_stream);
+}
+
+static void bin_append_f32(uint8_t *buffer, float number, int32_t *ind) {
+	uint32_t u;
+	memcpy(&u, &number, sizeof(u));
+	buffer_append_uint32(buffer, u, ind);
+}
+
+static void bin_append_f64(uint8_t *buffer, double number, int32_t *ind) {
+	uint64_t u;
+	memcpy(&u, &number, sizeof(u));
+	buffer_append_uint64(buffer, u, ind);
+}
+
+static void bin_append_varint(uint8_t *buffer, uint64_t number, int32_t *ind) {
+	while (number >= 0x80) {
+		buffer[(*ind)++] = (number & 0x7F) | 0x80;
+		number >>= 7;
+	}
+	buffer[(*ind)++] = number;
+}
+
+static void bin_add_column(log_bin_state *st, log_header *h, int print_prec, LOG_FORMAT format) {
+	int c = st->cols++;
+
+	if (print_prec < 0) {
+		// printf treats negative precision as omitted
+		print_prec = 6;
+	}
+
+	if (format == LOG_FORMAT_BIN_DELTA && print_prec <= 9) {
+		st->enc[c] = LOG_BIN_ENC_DELTA;
+	} else if (h->is_timestamp || print_prec > 5) {
+		st->enc[c] = LOG_BIN_ENC_F64;
+	} else {
+		st->enc[c] = LOG_BIN_ENC_F32;
+	}
+
+	st->print_prec[c] = print_prec;
+	st->last[c] = 0;
+
+	uint8_t buffer[80];
+	int32_t ind = 0;
+	strcpy((char*)buffer + ind, h->key);
+	ind += strlen(h->key) + 1;
+	strcpy((char*)buffer + ind, h->name);
+	ind += strlen(h->name) + 1;
+	strcpy((char*)buffer + ind, h->unit);
+	ind += strlen(h->unit) + 1;
+	buffer[ind++] = h->precision;
+	buffer[ind++] = h->is_relative;
+	buffer[ind++] = h->is_timestamp;
+	buffer[ind++] = st->enc[c];
+	buffer[ind++] = st->print_prec[c];
+	file_writer_write(&m_stream, buffer, ind);
+}
+
+static log_bin_state *bin_open(LOG_FORMAT format) {
+	log_bin_state *st = malloc(sizeof(log_bin_state));
+	if (!st) {
+		return 0;
+	}
+
+	st->cols = 0;
+
+	st->fields = m_field_num;
+	if (st->fields > LOG_MAX_FIELDS) {
+		st->fields = LOG_MAX_FIELDS;
+	}
+
+	int cols = st->fields;
+	if (m_append_time) {
+		cols++;
+	}
+	if (m_append_gnss_time) {
+		cols++;
+	}
+	if (m_append_gnss) {
+		cols += 5;
+	}
+
+	uint8_t buffer[12];
+	int32_t ind = 0;
+	memcpy(buffer, "VLOG", 4);
+	ind += 4;
+	buffer[ind++] = LOG_BIN_VERSION;
+	buffer[ind++] = format;
+	buffer_append_uint16(buffer, cols, &ind);
+	bin_append_f32(buffer, m_rate_hz, &ind);
+	file_writer_write(&m_stream, buffer, ind);
+
+	// Same column order and print precision as the CSV writer
+	for (int i = 0;i < st->fields;i++) {
+		log_header *h = (log_header*)&m_headers[i];
+		bin_add_column(st, h, h->precision, format);
+	}
+
+	if (m_append_time) {
+		bin_add_column(st, &m_header_ts, 3, format);
+	}
+
+	if (m_append_gnss_time) {
+		bin_add_column(st, &m_header_ts_gnss, 3, format);
+	}
+
+	if (m_append_gnss) {
+		bin_add_column(st, &m_header_lat, 8, format);
+		bin_add_column(st, &m_header_lon, 8, format);
+		bin_add_column(st, &m_header_alt, 2, format);
+		bin_add_column(st, &m_header_hacc, 2, format);
+		bin_add_column(st, &m_header_hvel, 2, format);
+	}
+
+	return st;
+}
+
+static void bin_close(log_bin_state *st) {
+	bin_flush(st);
+	free(st);
+}
+
+/**
+ * Write one record from m_sample and m_sample_present.
+ */
+static void bin_write_sample(log_bin_state *st) {
+	static const double scale[10] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+	uint8_t *buffer = st->rec;
+	int32_t ind = 0;
+	buffer[ind++] = LOG_BIN_REC_SAMPLE;
+	int bitmap_len = (st->cols + 7) / 8;
+	for (int i = 0;i < bitmap_len;i++) {
+		buffer[ind++] = m_sample_present[i / 4] >> (8 * (i % 4));
+	}
+
+	for (int w = 0;w < LOG_COL_WORDS;w++) {
+		uint32_t b = m_sample_present[w];
+		while (b) {
+			int i = w * 32 + __builtin_ctz(b);
+			b &= b - 1;
+
+			double v = m_sample[i];
+
+			switch (st->enc[i]) {
+			case LOG_BIN_ENC_F32:
+				bin_append_f32(buffer, v, &ind);
+				break;
+
+			case LOG_BIN_ENC_F64:
+				bin_append_f64(buffer, v, &ind);
+				break;
+
+			case LOG_BIN_ENC_DELTA: {
+				double s = v * scale[st->print_prec[i]];
+				bool scalable = isfinite(s) && fabs(s) < 4.0e18;
+				int64_t q = scalable ? llrint(s) : 0; // Round half to even like printf
+
+				st->next[i] = st->last[i];
+
+				// Negative values that round to 0 are printed as -0 in the CSV
+				if (scalable && (q != 0 || !signbit(s))) {
+					int64_t d = q - st->last[i];
+					st->next[i] = q;
+					uint64_t zz = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+					bin_append_varint(buffer, zz + 1, &ind);
+				} else {
+					buffer[ind++] = 0;
+					bin_append_f64(buffer, v, &ind);
+				}
+			} break;
+
+			default:
+				break;
+			}
+		}
+	}
+
+	// The deltas only advance when the record made it to the file
+	if (file_writer_write(&m_stream, buffer, ind)) {
+		for (int w = 0;w < LOG_COL_WORDS;w++) {
+			uint32_t b = m_sample_present[w];
+			while (b) {
+				int i = w * 32 + __builtin_ctz(b);
+				b &= b - 1;
+				st->last[i] = st->next[i];
+			}
+		}
+	}
+}
+
 static void log_task(void *arg) {
 	FILE *f_log = 0;
 	int gga_cnt_last = 0;
 	int rmc_cnt_last = 0;
 	int64_t ms_last = utils_ms_tot();
-	TickType_t tick_last_fsync = xTaskGetTickCount();
+	TickType_t tick_last_flush = xTaskGetTickCount();
+	LOG_FORMAT format = LOG_FORMAT_CSV;
+	log_bin_state *bin = 0;
 
 	for (;;) {
 		if (!m_card) {
@@ -115,16 +474,19 @@ static void log_task(void *arg) {
 				continue;
 			}
 
+			format = m_format;
+			const char *ext = format == LOG_FORMAT_CSV ? "csv" : "bin";
+
 			if (date_valid) {
 				char path[200];
 				sprintf(path,
-						"%slog_can/date/%02d-%02d-%02d %02d-%02d-%02d.csv", file_basepath,
-						s->rmc.yy, s->rmc.mo, s->rmc.dd, s->rmc.hh, s->rmc.mm, s->rmc.ss);
+						"%slog_can/date/%02d-%02d-%02d %02d-%02d-%02d.%s", file_basepath,
+						s->rmc.yy, s->rmc.mo, s->rmc.dd, s->rmc.hh, s->rmc.mm, s->rmc.ss, ext);
 				f_log = fopen(path, "w");
 			} else {
 				char path[200];
 				for (int i = 0;i < 999;i++) {
-					sprintf(path, "%slog_can/no_date/log_%03d.csv", file_basepath, i);
+					sprintf(path, "%slog_can/no_date/log_%03d.%s", file_basepath, i, ext);
 					if (access(path, F_OK) != 0) {
 						f_log = fopen(path, "w");
 						break;
@@ -132,124 +494,199 @@ static void log_task(void *arg) {
 				}
 			}
 
+			if (f_log) {
+				// Wait for buffers while writing the header, the samples are
+				// dropped instead when the card cannot keep up.
+				file_writer_open(&m_stream, f_log, 1000);
+
+				// Only whole buffers are written, so stdio buffering just adds a copy
+				setvbuf(f_log, NULL, _IONBF, 0);
+
+				if (format == LOG_FORMAT_CSV) {
+					m_line = malloc(LOG_CSV_LINE_LEN);
+					if (!m_line) {
+						file_writer_close(&m_stream);
+						f_log = 0;
+					}
+				} else {
+					bin = bin_open(format);
+					if (!bin) {
+						file_writer_close(&m_stream);
+						f_log = 0;
+					}
+				}
+			}
+
 			if (f_log) {
 				// To get the first sample
 				gga_updated = true;
 				rmc_updated = true;
+			}
 
+			if (f_log && format == LOG_FORMAT_CSV) {
 				for (int i = 0;i < m_field_num;i++) {
-					print_header((log_header*)&m_headers[i], f_log);
+					print_header((log_header*)&m_headers[i]);
 					if (i == (m_field_num - 1)) {
 						if (m_append_time || m_append_gnss_time || m_append_gnss) {
-							fprintf(f_log, ";");
+							file_writer_printf(&m_stream, ";");
 						}
 
 						if (m_append_time) {
-							print_header(&m_header_ts, f_log);
+							print_header(&m_header_ts);
 							if (m_append_gnss_time || m_append_gnss) {
-								fprintf(f_log, ";");
+								file_writer_printf(&m_stream, ";");
 							}
 						}
 
 						if (m_append_gnss_time) {
-							print_header(&m_header_ts_gnss, f_log);
+							print_header(&m_header_ts_gnss);
 							if (m_append_gnss) {
-								fprintf(f_log, ";");
+								file_writer_printf(&m_stream, ";");
 							}
 						}
 
 						if (m_append_gnss) {
-							print_header(&m_header_lat, f_log);
-							fprintf(f_log, ";");
+							print_header(&m_header_lat);
+							file_writer_printf(&m_stream, ";");
 
-							print_header(&m_header_lon, f_log);
-							fprintf(f_log, ";");
+							print_header(&m_header_lon);
+							file_writer_printf(&m_stream, ";");
 
-							print_header(&m_header_alt, f_log);
-							fprintf(f_log, ";");
+							print_header(&m_header_alt);
+							file_writer_printf(&m_stream, ";");
 
-							print_header(&m_header_hacc, f_log);
-							fprintf(f_log, ";");
+							print_header(&m_header_hacc);
+							file_writer_printf(&m_stream, ";");
 
-							print_header(&m_header_hvel, f_log);
+							print_header(&m_header_hvel);
 						}
 
-						fprintf(f_log, "\n");
+						file_writer_printf(&m_stream, "\n");
 					} else {
-						fprintf(f_log, ";");
+						file_writer_printf(&m_stream, ";");
 					}
 				}
 			}
+
+			m_stream.timeout_ms = 0;
 		}
 
 		if (m_field_num <= 0 && f_log) {
-			fclose(f_log);
+			if (bin) {
+				bin_close(bin);
+				bin = 0;
+			} else {
+				free(m_line);
+				m_line = 0;
+			}
+
+			file_writer_close(&m_stream);
 			f_log = 0;
 		}
 
-		if (f_log) {
-			for (int i = 0;i < m_field_num;i++) {
-				log_header *h = (log_header*)&m_headers[i];
-				if (h->updated) {
-					fprintf(f_log, "%.*f", h->precision, h->value);
-					h->updated = false;
+		if (bin) {
+			sample_take_fields(bin->fields);
+
+			int c = bin->fields;
+			if (m_append_time) {
+				sample_set(c++, (float)utils_ms_today() / 1000.0, true);
+			}
+
+			if (m_append_gnss_time) {
+				sample_set(c++, (float)s->gga.ms_today / 1000.0, gga_updated);
+			}
+
+			if (m_append_gnss) {
+				sample_set(c++, s->gga.lat, gga_updated);
+				sample_set(c++, s->gga.lon, gga_updated);
+				sample_set(c++, s->gga.height, gga_updated);
+				sample_set(c++, s->gga.h_dop * 4.0, gga_updated);
+				sample_set(c++, s->rmc.speed * 3.6, rmc_updated);
+			}
+
+			bin_write_sample(bin);
+
+			// The writer task does the fsync, see file_writer_set_fsync_interval
+			if (UTILS_AGE_S(tick_last_flush) > 2.0) {
+				tick_last_flush = xTaskGetTickCount();
+				bin_flush(bin);
+			}
+		} else if (f_log) {
+			int fields = m_field_num;
+			if (fields > LOG_MAX_FIELDS) {
+				fields = LOG_MAX_FIELDS;
+			}
+
+			sample_take_fields(fields);
+
+			// Only the updated fields are formatted, the cells in between are empty
+			m_line_len = 0;
+			int cell = 0;
+			for (int w = 0;w < LOG_FIELD_WORDS;w++) {
+				uint32_t b = m_sample_present[w];
+				while (b) {
+					int i = w * 32 + __builtin_ctz(b);
+					b &= b - 1;
+					line_separators(i - cell);
+					cell = i;
+					line_printf("%.*f", m_headers[i].precision, m_sample[i]);
 				}
-				if (i == (m_field_num - 1)) {
-					if (m_append_time || m_append_gnss_time || m_append_gnss) {
-						fprintf(f_log, ";");
-					}
+			}
+			line_separators(fields - 1 - cell);
 
-					if (m_append_time) {
-						fprintf(f_log, "%.3f", (float)utils_ms_today() / 1000.0);
-						if (m_append_gnss_time || m_append_gnss) {
-							fprintf(f_log, ";");
-						}
-					}
+			if (m_append_time || m_append_gnss_time || m_append_gnss) {
+				line_printf(";");
+			}
 
-					if (m_append_gnss_time) {
-						if (gga_updated) {
-							fprintf(f_log, "%.3f", (float)s->gga.ms_today / 1000.0);
-						}
-						if (m_append_gnss) {
-							fprintf(f_log, ";");
-						}
-					}
+			if (m_append_time) {
+				line_printf("%.3f", (float)utils_ms_today() / 1000.0);
+				if (m_append_gnss_time || m_append_gnss) {
+					line_printf(";");
+				}
+			}
 
-					if (m_append_gnss) {
-						if (gga_updated) {
-							fprintf(f_log, "%.8f", s->gga.lat);
-						}
-						fprintf(f_log, ";");
+			if (m_append_gnss_time) {
+				if (gga_updated) {
+					line_printf("%.3f", (float)s->gga.ms_today / 1000.0);
+				}
+				if (m_append_gnss) {
+					line_printf(";");
+				}
+			}
 
-						if (gga_updated) {
-							fprintf(f_log, "%.8f", s->gga.lon);
-						}
-						fprintf(f_log, ";");
+			if (m_append_gnss) {
+				if (gga_updated) {
+					line_printf("%.8f", s->gga.lat);
+				}
+				line_printf(";");
 
-						if (gga_updated) {
-							fprintf(f_log, "%.2f", s->gga.height);
-						}
-						fprintf(f_log, ";");
+				if (gga_updated) {
+					line_printf("%.8f", s->gga.lon);
+				}
+				line_printf(";");
 
-						if (gga_updated) {
-							fprintf(f_log, "%.2f", s->gga.h_dop * 4.0);
-						}
-						fprintf(f_log, ";");
+				if (gga_updated) {
+					line_printf("%.2f", s->gga.height);
+				}
+				line_printf(";");
 
-						if (rmc_updated) {
-							fprintf(f_log, "%.2f", s->rmc.speed * 3.6);
-						}
-					}
+				if (gga_updated) {
+					line_printf("%.2f", s->gga.h_dop * 4.0);
+				}
+				line_printf(";");
 
-					fprintf(f_log, "\n");
-				} else {
-					fprintf(f_log, ";");
+				if (rmc_updated) {
+					line_printf("%.2f", s->rmc.speed * 3.6);
 				}
 			}
 
-			if (UTILS_AGE_S(tick_last_fsync) > 2.0) {
-				tick_last_fsync = xTaskGetTickCount();
-				fsync(fileno(f_log));
+			line_printf("\n");
+
+			file_writer_write(&m_stream, m_line, m_line_len);
+
+			if (UTILS_AGE_S(tick_last_flush) > 2.0) {
+				tick_last_flush = xTaskGetTickCount();
+				file_writer_submit(&m_stream);
 			}
 		}
 
@@ -380,8 +817,6 @@ bool log_init(void) {
 		m_headers[i].precision = 2;
 		m_headers[i].is_relative = false;
 		m_headers[i].is_timestamp = false;
-		m_headers[i].value = 0.0;
-		m_headers[i].updated = false;
 	}
 
 	// Special headers
@@ -391,8 +826,6 @@ bool log_init(void) {
 	m_header_ts.precision = 3;
 	m_header_ts.is_relative = false;
 	m_header_ts.is_timestamp = true;
-	m_header_ts.value = 0.0;
-	m_header_ts.updated = false;
 
 	strcpy(m_header_ts_gnss.key, "t_day_pos");
 	strcpy(m_header_ts_gnss.name, "Time GNSS");
@@ -400,8 +833,6 @@ bool log_init(void) {
 	m_header_ts_gnss.precision = 3;
 	m_header_ts_gnss.is_relative = false;
 	m_header_ts_gnss.is_timestamp = true;
-	m_header_ts_gnss.value = 0.0;
-	m_header_ts_gnss.updated = false;
 
 	strcpy(m_header_lat.key, "gnss_lat");
 	strcpy(m_header_lat.name, "Latitude");
@@ -409,8 +840,6 @@ bool log_init(void) {
 	m_header_lat.precision = 7;
 	m_header_lat.is_relative = false;
 	m_header_lat.is_timestamp = false;
-	m_header_lat.value = 0.0;
-	m_header_lat.updated = false;
 
 	strcpy(m_header_lon.key, "gnss_lon");
 	strcpy(m_header_lon.name, "Longitude");
@@ -418,8 +847,6 @@ bool log_init(void) {
 	m_header_lon.precision = 7;
 	m_header_lon.is_relative = false;
 	m_header_lon.is_timestamp = false;
-	m_header_lon.value = 0.0;
-	m_header_lon.updated = false;
 
 	strcpy(m_header_alt.key, "gnss_alt");
 	strcpy(m_header_alt.name, "Altitude");
@@ -427,8 +854,6 @@ bool log_init(void) {
 	m_header_alt.precision = 2;
 	m_header_alt.is_relative = false;
 	m_header_alt.is_timestamp = false;
-	m_header_alt.value = 0.0;
-	m_header_alt.updated = false;
 
 	strcpy(m_header_hacc.key, "gnss_h_acc");
 	strcpy(m_header_hacc.name, "H. Accuracy GNSS");
@@ -436,8 +861,6 @@ bool log_init(void) {
 	m_header_hacc.precision = 2;
 	m_header_hacc.is_relative = false;
 	m_header_hacc.is_timestamp = false;
-	m_header_hacc.value = 0.0;
-	m_header_hacc.updated = false;
 
 	strcpy(m_header_hvel.key, "gnss_h_vel");
 	strcpy(m_header_hvel.name, "H. Speed GNSS");
@@ -445,9 +868,8 @@ bool log_init(void) {
 	m_header_hvel.precision = 2;
 	m_header_hvel.is_relative = false;
 	m_header_hvel.is_timestamp = false;
-	m_header_hvel.value = 0.0;
-	m_header_hvel.updated = false;
 
+	file_writer_init();
 	xTaskCreatePinnedToCore(log_task, "log", 3072, NULL, 8, NULL, tskNO_AFFINITY);
 
 	return true;
@@ -473,11 +895,20 @@ void log_process_packet(unsigned char *data, unsigned int len) {
 		mkdir(path, 0775);
 
 		int32_t ind = 0;
-		m_field_num = buffer_get_int16(data, &ind);
+		int field_num = buffer_get_int16(data, &ind);
 		m_rate_hz = buffer_get_float32_auto(data, &ind);
 		m_append_time = data[ind++];
 		m_append_gnss = data[ind++];
 		m_append_gnss_time = data[ind++];
+
+		// Optional, older senders only support CSV
+		m_format = LOG_FORMAT_CSV;
+		if (ind < (int32_t)len && data[ind] <= LOG_FORMAT_BIN_DELTA) {
+			m_format = data[ind++];
+		}
+
+		// Set last as the log task starts when this is non-zero
+		m_field_num = field_num;
 	} break;
 
 	case COMM_LOG_STOP: {
@@ -514,11 +945,7 @@ void log_process_packet(unsigned char *data, unsigned int len) {
 			break;
 		}
 
-		while (field_ind < LOG_MAX_FIELDS && ind < len) {
-			m_headers[field_ind].value = buffer_get_float32_auto(data, &ind);
-			m_headers[field_ind].updated = true;
-			field_ind++;
-		}
+		fields_update(field_ind, data, ind, len, false);
 	} break;
 
 	case COMM_LOG_DATA_F64: {
@@ -529,11 +956,7 @@ void log_process_packet(unsigned char *data, unsigned int len) {
 			break;
 		}
 
-		while (field_ind < LOG_MAX_FIELDS && ind < len) {
-			m_headers[field_ind].value = buffer_get_float64_auto(data, &ind);
-			m_headers[field_ind].updated = true;
-			field_ind++;
-		}
+		fields_update(field_ind, data, ind, len, true);
 	} break;
 
 	default:
@@ -25,6 +25,12 @@
 #include "esp_vfs_fat.h"
 #include "sdmmc_cmd.h"
 
+typedef enum {
+	LOG_FORMAT_CSV = 0,
+	LOG_FORMAT_BIN, // Binary, values as float32/float64
+	LOG_FORMAT_BIN_DELTA // Binary, values as delta encoded integers
+} LOG_FORMAT;
+
 // Functions
 bool log_init(void);
 bool log_mount_card(int pin_mosi, int pin_miso, int pin_sck, int pin_cs, int freq);
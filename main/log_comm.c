@@ -32,7 +32,8 @@ void log_comm_start(
 		float rate_hz,
 		bool append_time,
 		bool append_gnss,
-		bool append_gnss_time) {
+		bool append_gnss_time,
+		LOG_FORMAT format) {
 
 	int32_t ind = 0;
 	uint8_t buffer[20];
@@ -44,6 +45,11 @@ void log_comm_start(
 	buffer[ind++] = append_gnss;
 	buffer[ind++] = append_gnss_time;
 
+	// Receivers that do not know about the format ignore this and log CSV
+	if (format != LOG_FORMAT_CSV) {
+		buffer[ind++] = format;
+	}
+
 	log_comm_send(can_id, buffer, ind);
 }
 
@@ -22,6 +22,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "log.h"
 
 // Functions
 void log_comm_start(
@@ -30,7 +31,8 @@ void log_comm_start(
 		float rate_hz,
 		bool append_time,
 		bool append_gnss,
-		bool append_gnss_time);
+		bool append_gnss_time,
+		LOG_FORMAT format);
 void log_comm_stop(int can_id);
 void log_comm_config_field(
 		int can_id,
@@ -22,6 +22,7 @@
 #include "crc.h"
 
 // Private functions
+static void decode_rx_buffer(PACKET_STATE_t *state);
 static int try_decode_packet(unsigned char *buffer, unsigned int in_len,
 		void(*process_func)(unsigned char *data, unsigned int len), int *bytes_left);
 
@@ -32,43 +33,75 @@ void packet_init(void (*s_func)(unsigned char *data, unsigned int len),
 	state->process_func = p_func;
 }
 
+void packet_init_vec(void (*s_func_vec)(PACKET_SEG_t *segs, int seg_num),
+		void (*p_func)(unsigned char *data, unsigned int len), PACKET_STATE_t *state) {
+	memset(state, 0, sizeof(PACKET_STATE_t));
+	state->send_func_vec = s_func_vec;
+	state->process_func = p_func;
+}
+
 void packet_reset(PACKET_STATE_t *state) {
 	state->rx_read_ptr = 0;
 	state->rx_write_ptr = 0;
 	state->bytes_left = 0;
 }
 
+/**
+ * Send a packet using the send function(s) of state.
+ *
+ * The payload is not copied. Header, payload and trailer are passed as three
+ * separate segments to send_func_vec if it is set, otherwise send_func is called
+ * once for each of them in order.
+ *
+ * @param data
+ * The payload. Must stay valid until the send function returns.
+ *
+ * @param len
+ * Length of the payload.
+ *
+ * @param state
+ * The packet state.
+ */
 void packet_send_packet(unsigned char *data, unsigned int len, PACKET_STATE_t *state) {
 	if (len == 0 || len > PACKET_MAX_PL_LEN) {
 		return;
 	}
 
+	unsigned char header[4];
+	unsigned char trailer[3];
 	int b_ind = 0;
 
 	if (len <= 255) {
-		state->tx_buffer[b_ind++] = 2;
-		state->tx_buffer[b_ind++] = len;
+		header[b_ind++] = 2;
+		header[b_ind++] = len;
 	} else if (len <= 65535) {
-		state->tx_buffer[b_ind++] = 3;
-		state->tx_buffer[b_ind++] = len >> 8;
-		state->tx_buffer[b_ind++] = len & 0xFF;
+		header[b_ind++] = 3;
+		header[b_ind++] = len >> 8;
+		header[b_ind++] = len & 0xFF;
 	} else {
-		state->tx_buffer[b_ind++] = 4;
-		state->tx_buffer[b_ind++] = len >> 16;
-		state->tx_buffer[b_ind++] = (len >> 8) & 0xFF;
-		state->tx_buffer[b_ind++] = len & 0xFF;
+		header[b_ind++] = 4;
+		header[b_ind++] = len >> 16;
+		header[b_ind++] = (len >> 8) & 0xFF;
+		header[b_ind++] = len & 0xFF;
 	}
 
-	memcpy(state->tx_buffer + b_ind, data, len);
-	b_ind += len;
-
 	unsigned short crc = crc16(data, len);
-	state->tx_buffer[b_ind++] = (uint8_t)(crc >> 8);
-	state->tx_buffer[b_ind++] = (uint8_t)(crc & 0xFF);
-	state->tx_buffer[b_ind++] = 3;
-
-	if (state->send_func) {
-		state->send_func(state->tx_buffer, b_ind);
+	trailer[0] = (uint8_t)(crc >> 8);
+	trailer[1] = (uint8_t)(crc & 0xFF);
+	trailer[2] = 3;
+
+	PACKET_SEG_t segs[PACKET_SEG_NUM] = {
+			{header, b_ind},
+			{data, len},
+			{trailer, sizeof(trailer)}
+	};
+
+	if (state->send_func_vec) {
+		state->send_func_vec(segs, PACKET_SEG_NUM);
+	} else if (state->send_func) {
+		for (int i = 0;i < PACKET_SEG_NUM;i++) {
+			state->send_func(segs[i].data, segs[i].len);
+		}
 	}
 }
 
@@ -96,13 +129,107 @@ void packet_process_byte(uint8_t rx_data, PACKET_STATE_t *state) {
 	}
 
 	state->rx_buffer[state->rx_write_ptr++] = rx_data;
-	data_len++;
 
 	if (state->bytes_left > 1) {
 		state->bytes_left--;
 		return;
 	}
 
+	decode_rx_buffer(state);
+}
+
+/**
+ * Process a chunk of received data, e.g. everything returned by one recv() call.
+ *
+ * Complete packets that are contiguous in data are decoded in place and passed to
+ * process_func without being copied to rx_buffer first. Only the bytes of packets
+ * that are split across calls are buffered. The result is the same as calling
+ * packet_process_byte for every byte in data.
+ *
+ * Note that process_func gets a pointer into data in that case, so it must not
+ * modify the payload or keep the pointer after returning.
+ *
+ * @param data
+ * The received data.
+ *
+ * @param len
+ * Number of bytes in data.
+ *
+ * @param state
+ * The packet state.
+ */
+void packet_process_buffer(const uint8_t *data, unsigned int len, PACKET_STATE_t *state) {
+	while (len > 0) {
+		unsigned int data_len = state->rx_write_ptr - state->rx_read_ptr;
+
+		if (data_len > 0) {
+			// A packet has been started in an earlier call. Append as many
+			// bytes as it needs in one go and continue decoding from rx_buffer.
+			unsigned int to_copy = state->bytes_left > 1 ? (unsigned int)state->bytes_left : 1;
+			if (to_copy > len) {
+				to_copy = len;
+			}
+
+			if (data_len + to_copy > PACKET_BUFFER_LEN) {
+				// Out of space (should not happen), same as in packet_process_byte
+				packet_process_byte(*data++, state);
+				len--;
+				continue;
+			}
+
+			if (state->rx_write_ptr + to_copy > PACKET_BUFFER_LEN) {
+				memmove(state->rx_buffer,
+						state->rx_buffer + state->rx_read_ptr,
+						data_len);
+
+				state->rx_read_ptr = 0;
+				state->rx_write_ptr = data_len;
+			}
+
+			memcpy(state->rx_buffer + state->rx_write_ptr, data, to_copy);
+			state->rx_write_ptr += to_copy;
+			data += to_copy;
+			len -= to_copy;
+
+			if (state->bytes_left > (int)to_copy) {
+				state->bytes_left -= to_copy;
+				continue;
+			}
+
+			decode_rx_buffer(state);
+			continue;
+		}
+
+		// Nothing buffered, decode directly from data.
+		int res = try_decode_packet((unsigned char*)data, len,
+				state->process_func, &state->bytes_left);
+
+		if (res > 0) {
+			data += res;
+			len -= res;
+		} else if (res == -1) {
+			data++;
+			len--;
+		} else {
+			// Incomplete packet at the end of data. A valid packet always fits
+			// in rx_buffer, so keep the rest there until more data arrives.
+			memcpy(state->rx_buffer, data, len);
+			state->rx_read_ptr = 0;
+			state->rx_write_ptr = len;
+			break;
+		}
+	}
+}
+
+/**
+ * Decode as many packets as possible from rx_buffer and drop invalid data.
+ *
+ * @param state
+ * The packet state.
+ */
+static void decode_rx_buffer(PACKET_STATE_t *state) {
+	unsigned int data_len = state->rx_write_ptr - state->rx_read_ptr;
+
 	// Try decoding the packet at various offsets until it succeeds, or
 	// until we run out of data.
 	for (;;) {
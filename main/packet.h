@@ -30,22 +30,33 @@
 
 #define PACKET_BUFFER_LEN		(PACKET_MAX_PL_LEN + 8)
 
+// Header, payload and trailer
+#define PACKET_SEG_NUM			3
+
 // Types
+typedef struct {
+	unsigned char *data;
+	unsigned int len;
+} PACKET_SEG_t;
+
 typedef struct {
 	void(*send_func)(unsigned char *data, unsigned int len);
+	void(*send_func_vec)(PACKET_SEG_t *segs, int seg_num);
 	void(*process_func)(unsigned char *data, unsigned int len);
 	unsigned int rx_read_ptr;
 	unsigned int rx_write_ptr;
 	int bytes_left;
 	unsigned char rx_buffer[PACKET_BUFFER_LEN];
-	unsigned char tx_buffer[PACKET_BUFFER_LEN];
 } PACKET_STATE_t;
 
 // Functions
 void packet_init(void (*s_func)(unsigned char *data, unsigned int len),
 		void (*p_func)(unsigned char *data, unsigned int len), PACKET_STATE_t *state);
+void packet_init_vec(void (*s_func_vec)(PACKET_SEG_t *segs, int seg_num),
+		void (*p_func)(unsigned char *data, unsigned int len), PACKET_STATE_t *state);
 void packet_reset(PACKET_STATE_t *state);
 void packet_process_byte(uint8_t rx_data, PACKET_STATE_t *state);
+void packet_process_buffer(const uint8_t *data, unsigned int len, PACKET_STATE_t *state);
 void packet_send_packet(unsigned char *data, unsigned int len, PACKET_STATE_t *state);
 
 #endif /* PACKET_H_ */
@@ -196,6 +196,26 @@ void terminal_process_string(char *str) {
 		commands_printf("Custom BLE Started: %d", custom_ble_started());
 		commands_printf("CAN RX Recoveries : %d", comm_can_get_rx_recovery_cnt());
 
+		can_rx_stats can_stats;
+		comm_can_get_rx_stats(&can_stats);
+		commands_printf("CAN RX Frames     : %u", can_stats.frames);
+		commands_printf("CAN RX Overflows  : %u", can_stats.overflows);
+		commands_printf("CAN RX Wakeups    : %u", can_stats.wakeups);
+		commands_printf("CAN RX High Water : %d/%d", can_stats.high_water, can_stats.size);
+		commands_printf("CAN Buf Completed : %u", can_stats.buf_completed);
+		commands_printf("CAN Buf CRC Errors: %u", can_stats.buf_crc_errors);
+		commands_printf("CAN Buf Aborted   : %u", can_stats.buf_aborted);
+		commands_printf("CAN Buf Dropped   : %u", can_stats.buf_dropped);
+
+		can_tx_stats can_tx;
+		comm_can_get_tx_stats(&can_tx);
+		commands_printf("CAN TX Frames     : %u", can_tx.frames);
+		commands_printf("CAN TX Buffers    : %u", can_tx.buffers);
+		commands_printf("CAN TX Buf Bytes  : %u", can_tx.buffer_bytes);
+		commands_printf("CAN TX Buf Stalls : %u", can_tx.stalls);
+		commands_printf("CAN TX Buf Dropped: %u", can_tx.dropped);
+		commands_printf("CAN TX Buf Queued : %d", can_tx.queued);
+
 		esp_ip4_addr_t ip = comm_wifi_get_ip();
 		esp_ip4_addr_t ip_client = comm_wifi_get_ip_client();
 
@@ -231,6 +251,9 @@ void terminal_process_string(char *str) {
 		commands_printf("Reset Reason      : %d", esp_reset_reason());
 
 		commands_printf(" ");
+	} else if (strcmp(argv[0], "can_stats_reset") == 0) {
+		comm_can_reset_rx_stats();
+		commands_printf("CAN RX statistics reset\n");
 	} else if (strcmp(argv[0], "can_scan") == 0) {
 		bool found = false;
 		for (int i = 0;i < 254;i++) {
@@ -275,6 +298,9 @@ void terminal_process_string(char *str) {
 		commands_printf("hw_status");
 		commands_printf("  Print some hardware status information.");
 
+		commands_printf("can_stats_reset");
+		commands_printf("  Reset the CAN RX statistics printed by hw_status.");
+
 		commands_printf("can_scan");
 		commands_printf("  Scan CAN-bus using ping commands, and print all devices that are found.");
 
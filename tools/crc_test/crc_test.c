@@ -0,0 +1,137 @@
+/*
+	Copyright 2026 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+/*
+ * Host side conformance test and benchmark for crc.c. Built once for every
+ * value of CRC_SLICES by the Makefile. The table code is checked against a
+ * bitwise reference over random lengths, alignments and initial values.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc.h"
+
+#define BUF_SIZE		4096
+#define TEST_ROUNDS		20000
+#define BENCH_LEN		1024
+#define BENCH_ROUNDS	20000
+
+static unsigned short ref_crc16(const uint8_t *buf, unsigned int len, unsigned short cksum) {
+	for (unsigned int i = 0;i < len;i++) {
+		cksum ^= (unsigned short)(buf[i] << 8);
+		for (int b = 0;b < 8;b++) {
+			cksum = (cksum & 0x8000) ? (unsigned short)((cksum << 1) ^ 0x1021) : (unsigned short)(cksum << 1);
+		}
+	}
+	return cksum;
+}
+
+static uint32_t ref_crc32(const uint8_t *buf, uint32_t len, uint32_t cksum) {
+	cksum = ~cksum;
+	for (uint32_t i = 0;i < len;i++) {
+		cksum ^= buf[i];
+		for (int b = 0;b < 8;b++) {
+			cksum = (cksum & 1) ? (cksum >> 1) ^ 0xEDB88320 : cksum >> 1;
+		}
+	}
+	return ~cksum;
+}
+
+static double now_s(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+	static uint8_t buf[BUF_SIZE + 8];
+	int fails = 0;
+
+	srand(1234);
+	for (int i = 0;i < (int)sizeof(buf);i++) {
+		buf[i] = (uint8_t)rand();
+	}
+
+	// Check values for "123456789"
+	uint8_t check[] = "123456789";
+	if (crc16(check, 9) != 0x31C3) {
+		printf("crc16 check value wrong: %04x\n", crc16(check, 9));
+		fails++;
+	}
+	if (crc32_with_init(check, 9, 0) != 0xCBF43926) {
+		printf("crc32 check value wrong: %08x\n", crc32_with_init(check, 9, 0));
+		fails++;
+	}
+
+	for (int r = 0;r < TEST_ROUNDS;r++) {
+		unsigned int ofs = (unsigned int)rand() % 8;
+		unsigned int len = (unsigned int)rand() % (r < TEST_ROUNDS / 2 ? 40 : BUF_SIZE);
+		unsigned short init16 = (r % 3) ? (unsigned short)rand() : 0;
+		uint32_t init32 = (r % 3) ? (uint32_t)rand() : 0;
+
+		unsigned short c16 = crc16_with_init(buf + ofs, len, init16);
+		unsigned short r16 = ref_crc16(buf + ofs, len, init16);
+		uint32_t c32 = crc32_with_init(buf + ofs, len, init32);
+		uint32_t r32 = ref_crc32(buf + ofs, len, init32);
+
+		if (c16 != r16 || c32 != r32) {
+			if (fails < 10) {
+				printf("mismatch ofs %u len %u: crc16 %04x/%04x crc32 %08x/%08x\n",
+						ofs, len, c16, r16, c32, r32);
+			}
+			fails++;
+		}
+	}
+
+	volatile uint32_t sink = 0;
+
+	double t0 = now_s();
+	for (int r = 0;r < BENCH_ROUNDS;r++) {
+		sink += crc16(buf + (r & 7), BENCH_LEN);
+	}
+	double t16 = now_s() - t0;
+
+	t0 = now_s();
+	for (int r = 0;r < BENCH_ROUNDS;r++) {
+		sink += ref_crc16(buf + (r & 7), BENCH_LEN, 0);
+	}
+	double t16_ref = now_s() - t0;
+
+	t0 = now_s();
+	for (int r = 0;r < BENCH_ROUNDS;r++) {
+		sink += crc32_with_init(buf + (r & 7), BENCH_LEN, 0);
+	}
+	double t32 = now_s() - t0;
+
+	t0 = now_s();
+	for (int r = 0;r < BENCH_ROUNDS;r++) {
+		sink += ref_crc32(buf + (r & 7), BENCH_LEN, 0);
+	}
+	double t32_ref = now_s() - t0;
+
+	double mb = (double)BENCH_LEN * BENCH_ROUNDS / 1e6;
+	printf("CRC_SLICES=%d: %d mismatches in %d rounds\n", CRC_SLICES, fails, TEST_ROUNDS);
+	printf("  crc16 %8.1f MB/s (bitwise %6.1f MB/s)\n", mb / t16, mb / t16_ref);
+	printf("  crc32 %8.1f MB/s (bitwise %6.1f MB/s)\n", mb / t32, mb / t32_ref);
+
+	return fails ? 1 : 0;
+}
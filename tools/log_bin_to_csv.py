@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+
+# Copyright 2026 Benjamin Vedder	benjamin@vedder.se
+#
+# This file is part of the VESC firmware.
+#
+# The VESC firmware is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# The VESC firmware is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Converts binary CAN logs (.bin, see main/log.c) to the same CSV layout
+# that the firmware writes when logging in CSV mode.
+#
+# Usage: log_bin_to_csv.py input.bin [output.csv]
+
+import struct
+import sys
+
+ENC_F32 = 0
+ENC_F64 = 1
+ENC_DELTA = 2
+
+REC_SAMPLE = 0x01
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.ind = 0
+
+    def left(self):
+        return len(self.data) - self.ind
+
+    def u8(self):
+        v = self.data[self.ind]
+        self.ind += 1
+        return v
+
+    def i8(self):
+        v = self.u8()
+        return v - 256 if v > 127 else v
+
+    def unpack(self, fmt):
+        v = struct.unpack_from(fmt, self.data, self.ind)[0]
+        self.ind += struct.calcsize(fmt)
+        return v
+
+    def string(self):
+        end = self.data.index(b'\0', self.ind)
+        v = self.data[self.ind:end].decode('utf-8', errors='replace')
+        self.ind = end + 1
+        return v
+
+    def varint(self):
+        v = 0
+        shift = 0
+        while True:
+            b = self.u8()
+            v |= (b & 0x7F) << shift
+            shift += 7
+            if b < 0x80:
+                return v
+
+def convert(data, out):
+    r = Reader(data)
+
+    if data[0:4] != b'VLOG':
+        raise ValueError('not a binary log file')
+    r.ind = 4
+
+    version = r.u8()
+    if version != 1:
+        raise ValueError('unsupported version {}'.format(version))
+
+    r.u8() # Format, the encoding is given per column
+    col_num = r.unpack('>H')
+    r.unpack('>f') # Rate
+
+    cols = []
+    for _ in range(col_num):
+        c = {}
+        c['key'] = r.string()
+        c['name'] = r.string()
+        c['unit'] = r.string()
+        c['precision'] = r.i8()
+        c['is_relative'] = r.u8()
+        c['is_timestamp'] = r.u8()
+        c['enc'] = r.u8()
+        c['print_prec'] = r.u8()
+        c['last'] = 0
+        cols.append(c)
+
+    out.write(';'.join('{}:{}:{}:{}:{}:{}'.format(
+        c['key'], c['name'], c['unit'],
+        c['precision'], c['is_relative'], c['is_timestamp']) for c in cols))
+    out.write('\n')
+
+    bitmap_len = (col_num + 7) // 8
+
+    while r.left() > 0:
+        rec = r.u8()
+        if rec == 0:
+            # Sector padding
+            continue
+
+        if rec != REC_SAMPLE:
+            raise ValueError('unknown record 0x{:02x} at {}'.format(rec, r.ind - 1))
+
+        try:
+            bitmap = r.data[r.ind:r.ind + bitmap_len]
+            r.ind += bitmap_len
+            cells = []
+
+            for i, c in enumerate(cols):
+                if not (bitmap[i // 8] >> (i % 8)) & 1:
+                    cells.append('')
+                    continue
+
+                if c['enc'] == ENC_F32:
+                    v = r.unpack('>f')
+                elif c['enc'] == ENC_F64:
+                    v = r.unpack('>d')
+                elif c['enc'] == ENC_DELTA:
+                    zz = r.varint()
+                    if zz == 0:
+                        v = r.unpack('>d')
+                    else:
+                        zz -= 1
+                        d = (zz >> 1) ^ -(zz & 1)
+                        c['last'] += d
+                        v = c['last'] / (10 ** c['print_prec'])
+                else:
+                    raise ValueError('unknown encoding {}'.format(c['enc']))
+
+                cells.append('%.*f' % (c['print_prec'], v))
+        except (IndexError, struct.error):
+            # Truncated last record, e.g. from a power loss
+            break
+
+        out.write(';'.join(cells))
+        out.write('\n')
+
+def main():
+    if len(sys.argv) < 2:
+        print('Usage: {} input.bin [output.csv]'.format(sys.argv[0]))
+        sys.exit(1)
+
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], 'w') as out:
+            convert(data, out)
+    else:
+        convert(data, sys.stdout)
+
+if __name__ == '__main__':
+    main()